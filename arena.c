@@ -50,6 +50,8 @@ typedef struct {
     double time_elapsed;
 } perf_stats;
 
+// standalone demo; bench_alloc links this file with ARENA_NO_MAIN
+#ifndef ARENA_NO_MAIN
 int main() {
     printf("======== arena allocator test ========\n\n");
     ui64 arena_size = MiB(10);
@@ -94,6 +96,7 @@ int main() {
     printf("\n======== test completed ========\n");
     return 0;
 }
+#endif // ARENA_NO_MAIN
 
 mem_arena* arena_create(ui64 capacity) {
     mem_arena* arena = (mem_arena*)malloc(capacity);
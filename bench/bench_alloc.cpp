@@ -0,0 +1,381 @@
+// allocator benchmark: the C++ MemArena, the C mem_arena from arena.c,
+// malloc/free and SlabPool on the same size distributions, 1..N threads.
+//
+//   bench_alloc [--json out.json] [--threads N] [--trials T] [--warmup W]
+//               [--batch K] [--batches B] [--dist name] [--alloc name]
+//
+// every thread runs `batches` rounds of: allocate `batch` blocks drawn from
+// the distribution, touch each one, then give them all back (one free per
+// block for malloc/slab, a single reset for the arenas). each allocation is
+// timed on its own; free ns is the give-back phase spread over its blocks.
+// sizes are generated up front so the rng is never on the clock.
+//
+// rss is the process working set sampled at the peak of a round. it is
+// process-wide and malloc/slab keep what they grew, so use --alloc to look
+// at one allocator in isolation.
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../include/arena.h"
+#include "../include/slab.h"
+#include "bench_common.h"
+
+#define BENCH_PAGE_BYTES 4096
+
+// arena.c, built as c with ARENA_NO_MAIN
+extern "C" {
+typedef struct {
+    ui64 capacity;
+    ui64 pos;
+} mem_arena;
+
+mem_arena* arena_create(ui64 capacity);
+void arena_destroy(mem_arena* arena);
+void* arena_push(mem_arena* arena, ui64 size, int32_t non_zero);
+void arena_clear(mem_arena* arena);
+}
+
+// one allocator under test. arenas give memory back with reset() only,
+// release() is left null for them.
+struct AllocOps {
+    const char* name;
+    void* (*create)(ui64 capacity);
+    void (*destroy)(void* self);
+    void* (*alloc)(void* self, ui64 size);
+    void (*release)(void* self, void* ptr);
+    void (*reset)(void* self);
+};
+
+static const AllocOps ALLOCATORS[] = {
+    {"memarena",
+     [](ui64 capacity) -> void* { return new MemArena(capacity); },
+     [](void* self) { delete (MemArena*)self; },
+     [](void* self, ui64 size) { return ((MemArena*)self)->push(size, 1); },
+     nullptr,
+     [](void* self) {
+         MemArena* a = (MemArena*)self;
+         a->pop(a->get_used());
+     }},
+    {"c_arena",
+     [](ui64 capacity) -> void* {
+         mem_arena* a = arena_create(capacity);
+         if (a == nullptr) throw std::bad_alloc();
+         return a;
+     },
+     [](void* self) { arena_destroy((mem_arena*)self); },
+     [](void* self, ui64 size) {
+         void* p = arena_push((mem_arena*)self, size, 0);
+         if (p == nullptr) throw std::bad_alloc();
+         return p;
+     },
+     nullptr,
+     [](void* self) { arena_clear((mem_arena*)self); }},
+    {"malloc",
+     [](ui64) -> void* { return nullptr; },
+     [](void*) {},
+     [](void*, ui64 size) {
+         void* p = malloc(size);
+         if (p == nullptr) throw std::bad_alloc();
+         return p;
+     },
+     [](void*, void* ptr) { free(ptr); },
+     nullptr},
+    {"slab",
+     [](ui64) -> void* { return nullptr; },
+     [](void*) {},
+     [](void*, ui64 size) { return SlabPool::alloc(size); },
+     [](void*, void* ptr) { SlabPool::release(ptr); },
+     nullptr},
+};
+
+static ui64 next_random(ui64& state) {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dull;
+}
+
+static ui64 draw_range(ui64& rng, ui64 lo, ui64 hi) {
+    return lo + next_random(rng) % (hi - lo + 1);
+}
+
+struct SizeDist {
+    const char* name;
+    ui64 max_size;
+    ui64 (*draw)(ui64& rng, ui64 i);
+};
+
+static const SizeDist DISTRIBUTIONS[] = {
+    {"uniform", 4096, [](ui64& rng, ui64) { return draw_range(rng, 16, 4096); }},
+    // many small control records, a few large buffers
+    {"bimodal", 65536, [](ui64& rng, ui64) {
+         return next_random(rng) % 10 ? draw_range(rng, 16, 128) : draw_range(rng, 8192, 65536);
+     }},
+    // framed chat traffic: header + short lines mostly, some pastes, the
+    // odd coalesced batch
+    {"chat", 65536, [](ui64& rng, ui64) {
+         ui64 roll = next_random(rng) % 100;
+         if (roll < 80) return draw_range(rng, 48 + 8, 48 + 200);
+         if (roll < 95) return draw_range(rng, 48 + 200, 48 + 1024);
+         if (roll < 99) return draw_range(rng, 1024, 4096);
+         return draw_range(rng, 16384, 65536);
+     }},
+    // what the old main.c / arena.c one-offs pushed
+    {"legacy", 64 + 511, [](ui64&, ui64 i) { return 64 + (i % 512); }},
+};
+
+struct BenchOptions {
+    const char* json_path;
+    const char* only_dist;
+    const char* only_alloc;
+    ui64 max_threads;
+    ui64 trials;
+    ui64 warmup;
+    ui64 batch;
+    ui64 batches;
+};
+
+struct AllocResult {
+    std::string dist;
+    std::string alloc;
+    ui64 threads;
+    ui64 allocs;
+    double mops;
+    double p50_ns;
+    double p99_ns;
+    double p999_ns;
+    double free_ns;
+    double rss_mb;
+};
+
+struct ThreadRun {
+    std::vector<ui32> sizes;
+    std::vector<void*> blocks;
+    std::vector<ui64> samples;
+    ui64 free_cycles;
+    ui64 peak_rss;
+};
+
+// one round-trip of every thread through the workload; returns wall seconds
+static double run_trial(const AllocOps& ops, const BenchOptions& opt, ui64 capacity,
+                        std::vector<ThreadRun>& runs, bool record) {
+    ui64 threads = runs.size();
+    std::atomic<ui64> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> workers;
+    bench_clock::time_point start;
+
+    for (ui64 t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            ThreadRun& run = runs[t];
+            void* self = ops.create(capacity);
+            run.free_cycles = 0;
+            run.peak_rss = 0;
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+
+            const ui32* size = run.sizes.data();
+            ui64* sample = run.samples.data();
+            for (ui64 b = 0; b < opt.batches; ++b) {
+                for (ui64 i = 0; i < opt.batch; ++i, ++size) {
+                    ui64 c0 = bench_cycles();
+                    ui8* p = (ui8*)ops.alloc(self, *size);
+                    ui64 c1 = bench_cycles();
+                    if (record) *sample++ = c1 - c0;
+                    // one write per page, so the memory is really backed
+                    for (ui64 off = 0; off < *size; off += BENCH_PAGE_BYTES) p[off] = (ui8)off;
+                    p[*size - 1] = (ui8)i;
+                    run.blocks[i] = p;
+                }
+                if (record && t == 0 && b + 1 == opt.batches) {
+                    run.peak_rss = bench_rss_bytes();
+                }
+
+                ui64 c0 = bench_cycles();
+                if (ops.release) {
+                    for (ui64 i = 0; i < opt.batch; ++i) ops.release(self, run.blocks[i]);
+                } else {
+                    ops.reset(self);
+                }
+                run.free_cycles += bench_cycles() - c0;
+            }
+            ops.destroy(self);
+        });
+    }
+
+    while (ready.load() < threads) {
+        std::this_thread::yield();
+    }
+    start = bench_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& w : workers) w.join();
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+static AllocResult measure(const SizeDist& dist, const AllocOps& ops, ui64 threads, const BenchOptions& opt) {
+    ui64 per_thread = opt.batch * opt.batches;
+    std::vector<ThreadRun> runs(threads);
+    ui64 max_batch_bytes = 0;
+    for (ui64 t = 0; t < threads; ++t) {
+        ThreadRun& run = runs[t];
+        ui64 rng = 0x9e3779b97f4a7c15ull * (t + 1);
+        run.sizes.resize(per_thread);
+        run.blocks.resize(opt.batch);
+        run.samples.resize(per_thread);
+        for (ui64 b = 0; b < opt.batches; ++b) {
+            ui64 batch_bytes = 0;
+            for (ui64 i = 0; i < opt.batch; ++i) {
+                ui64 size = dist.draw(rng, b * opt.batch + i);
+                run.sizes[b * opt.batch + i] = (ui32)size;
+                batch_bytes += ALIGN_UP_POW2(size, ARENA_ALIGN);
+            }
+            max_batch_bytes = MAX(max_batch_bytes, batch_bytes);
+        }
+    }
+    // one round has to fit the fixed-size c arena
+    ui64 capacity = ALIGN_UP_POW2(max_batch_bytes + KiB(4), KiB(64));
+
+    for (ui64 w = 0; w < opt.warmup; ++w) {
+        run_trial(ops, opt, capacity, runs, false);
+    }
+
+    std::vector<ui64> samples;
+    samples.reserve(per_thread * threads * opt.trials);
+    std::vector<double> walls;
+    ui64 free_cycles = 0;
+    ui64 peak_rss = 0;
+    for (ui64 trial = 0; trial < opt.trials; ++trial) {
+        walls.push_back(run_trial(ops, opt, capacity, runs, true));
+        for (ThreadRun& run : runs) {
+            samples.insert(samples.end(), run.samples.begin(), run.samples.end());
+            free_cycles += run.free_cycles;
+            peak_rss = MAX(peak_rss, run.peak_rss);
+        }
+    }
+
+    std::sort(walls.begin(), walls.end());
+    BenchStats s = bench_stats(samples);
+    double hz = bench_cycles_per_sec();
+    AllocResult r;
+    r.dist = dist.name;
+    r.alloc = ops.name;
+    r.threads = threads;
+    r.allocs = per_thread * threads;
+    r.mops = r.allocs / walls[walls.size() / 2] / 1e6;
+    r.p50_ns = s.median / hz * 1e9;
+    r.p99_ns = s.p99 / hz * 1e9;
+    r.p999_ns = s.p999 / hz * 1e9;
+    r.free_ns = free_cycles / hz * 1e9 / (double)(r.allocs * opt.trials);
+    r.rss_mb = peak_rss / (1024.0 * 1024.0);
+    return r;
+}
+
+static void print_result(const AllocResult& r) {
+    printf("%-8s %-9s %7llu %9.2f %8.0f %8.0f %8.0f %8.1f %8.1f\n", r.dist.c_str(), r.alloc.c_str(),
+           (unsigned long long)r.threads, r.mops, r.p50_ns, r.p99_ns, r.p999_ns, r.free_ns, r.rss_mb);
+}
+
+static bool write_json(const char* path, const std::vector<AllocResult>& results, const BenchOptions& opt) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    fprintf(f, "{\n  \"counter_hz\": %.0f,\n  \"trials\": %llu,\n  \"batch\": %llu,\n  \"batches\": %llu,\n"
+               "  \"results\": [\n",
+            bench_cycles_per_sec(), (unsigned long long)opt.trials, (unsigned long long)opt.batch,
+            (unsigned long long)opt.batches);
+    for (ui64 i = 0; i < results.size(); ++i) {
+        const AllocResult& r = results[i];
+        fprintf(f, "    {\"dist\": \"%s\", \"alloc\": \"%s\", \"threads\": %llu, \"allocs\": %llu, "
+                   "\"mops\": %.3f, \"p50_ns\": %.1f, \"p99_ns\": %.1f, \"p999_ns\": %.1f, "
+                   "\"free_ns\": %.2f, \"rss_mb\": %.1f}%s\n",
+                r.dist.c_str(), r.alloc.c_str(), (unsigned long long)r.threads, (unsigned long long)r.allocs,
+                r.mops, r.p50_ns, r.p99_ns, r.p999_ns, r.free_ns, r.rss_mb,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    return true;
+}
+
+static bool parse_args(int argc, char** argv, BenchOptions& opt) {
+    opt.json_path = nullptr;
+    opt.only_dist = nullptr;
+    opt.only_alloc = nullptr;
+    opt.max_threads = MAX(std::thread::hardware_concurrency(), 1u);
+    opt.trials = 5;
+    opt.warmup = 1;
+    opt.batch = 1000;
+    opt.batches = 100;
+    for (int i = 1; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--json") && has_value) {
+            opt.json_path = argv[++i];
+        } else if (!strcmp(argv[i], "--threads") && has_value) {
+            opt.max_threads = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--trials") && has_value) {
+            opt.trials = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--warmup") && has_value) {
+            opt.warmup = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--batch") && has_value) {
+            opt.batch = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--batches") && has_value) {
+            opt.batches = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--dist") && has_value) {
+            opt.only_dist = argv[++i];
+        } else if (!strcmp(argv[i], "--alloc") && has_value) {
+            opt.only_alloc = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--json out.json] [--threads N] [--trials T] [--warmup W]\n"
+                            "       [--batch K] [--batches B] [--dist name] [--alloc name]\n",
+                    argv[0]);
+            return false;
+        }
+    }
+    if (opt.max_threads == 0) opt.max_threads = 1;
+    if (opt.trials == 0) opt.trials = 1;
+    if (opt.batch == 0) opt.batch = 1;
+    if (opt.batches == 0) opt.batches = 1;
+    return true;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions opt;
+    if (!parse_args(argc, argv, opt)) return 1;
+
+    // 1, 2, 4, ... and always max_threads itself
+    std::vector<ui64> thread_counts;
+    for (ui64 t = 1; t < opt.max_threads; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(opt.max_threads);
+
+    std::vector<AllocResult> results;
+    printf("counter %.2f GHz, %llu x %llu allocs/thread, %llu warmup + %llu trials\n\n",
+           bench_cycles_per_sec() / 1e9, (unsigned long long)opt.batches, (unsigned long long)opt.batch,
+           (unsigned long long)opt.warmup, (unsigned long long)opt.trials);
+    printf("%-8s %-9s %7s %9s %8s %8s %8s %8s %8s\n", "dist", "alloc", "threads", "Mallocs/s", "p50 ns",
+           "p99 ns", "p999 ns", "free ns", "rss MB");
+
+    for (const SizeDist& dist : DISTRIBUTIONS) {
+        if (opt.only_dist && strcmp(opt.only_dist, dist.name) != 0) continue;
+        for (ui64 threads : thread_counts) {
+            for (const AllocOps& ops : ALLOCATORS) {
+                if (opt.only_alloc && strcmp(opt.only_alloc, ops.name) != 0) continue;
+                results.push_back(measure(dist, ops, threads, opt));
+                print_result(results.back());
+            }
+        }
+        printf("\n");
+    }
+
+    if (opt.json_path && !write_json(opt.json_path, results, opt)) return 1;
+    return 0;
+}
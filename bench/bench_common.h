@@ -0,0 +1,101 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#define PSAPI_VERSION 2
+#include <psapi.h>
+#elif defined(__linux__)
+#include <cstdio>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#include <x86intrin.h>
+#define BENCH_HAVE_TSC 1
+#else
+#define BENCH_HAVE_TSC 0
+#endif
+
+typedef uint64_t ui64;
+
+typedef std::chrono::steady_clock bench_clock;
+
+// raw cycle counter (tsc), or nanoseconds where there isn't one
+static inline ui64 bench_cycles() {
+#if BENCH_HAVE_TSC
+    return __rdtsc();
+#else
+    return (ui64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        bench_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// counter ticks per second, measured once against the steady clock
+static inline double bench_cycles_per_sec() {
+    static double hz = [] {
+#if BENCH_HAVE_TSC
+        auto t0 = bench_clock::now();
+        ui64 c0 = bench_cycles();
+        while (bench_clock::now() - t0 < std::chrono::milliseconds(50)) {
+        }
+        ui64 c1 = bench_cycles();
+        double secs = std::chrono::duration<double>(bench_clock::now() - t0).count();
+        return (c1 - c0) / secs;
+#else
+        return 1e9;
+#endif
+    }();
+    return hz;
+}
+
+struct BenchStats {
+    double median;
+    double p99;
+    double p999;
+    double mean;
+};
+
+// percentiles over per-call samples (in cycles)
+static inline BenchStats bench_stats(std::vector<ui64>& samples) {
+    BenchStats s = {0, 0, 0, 0};
+    if (samples.empty()) return s;
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (ui64 v : samples) sum += (double)v;
+    s.mean = sum / samples.size();
+    s.median = (double)samples[samples.size() / 2];
+    s.p99 = (double)samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+    s.p999 = (double)samples[std::min(samples.size() - 1, samples.size() * 999 / 1000)];
+    return s;
+}
+
+// resident set of the whole process, 0 where we can't tell
+static inline ui64 bench_rss_bytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (K32GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return pmc.WorkingSetSize;
+    return 0;
+#elif defined(__linux__)
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long long total = 0, resident = 0;
+    int n = fscanf(f, "%llu %llu", &total, &resident);
+    fclose(f);
+    return n == 2 ? resident * (ui64)sysconf(_SC_PAGESIZE) : 0;
+#else
+    return 0;
+#endif
+}
+
+#endif // BENCH_COMMON_H
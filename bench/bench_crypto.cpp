@@ -0,0 +1,291 @@
+// crypto micro-benchmarks: cycles/byte, MB/s and per-call p50/p99 for the
+// SimpleCrypto primitives, aes-256-gcm and the Message layer, 16 B to 16 MiB,
+// then room fan-out (one short message sealed for 32 sessions) done one
+// seal at a time vs through the batch path.
+//
+//   bench_crypto [--json out.json] [--max-size bytes] [--budget MiB] [--op name]
+//
+// every call is timed on its own, so small sizes include the call and
+// counter overhead (~20-40 cycles) just like real per-message use does.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include "../include/arena.h"
+#include "../include/slab.h"
+#include "../include/crypto.h"
+#include "../include/message.h"
+#include "../include/session.h"
+#include "bench_common.h"
+
+#define BENCH_MIN_SIZE 16
+#define BENCH_MAX_SIZE (16ull << 20)
+#define BENCH_MIN_SAMPLES 15
+#define BENCH_MAX_SAMPLES 20000
+// sessions per fan-out, one batch window
+#define BENCH_FANOUT BATCH_WINDOW
+
+struct CryptoResult {
+    std::string op;
+    ui64 size;
+    ui64 samples;
+    double cycles_per_byte;
+    double mb_per_sec;
+    double p50_ns;
+    double p99_ns;
+};
+
+struct BenchOptions {
+    const char* json_path;
+    const char* only_op;
+    ui64 max_size;
+    ui64 budget_bytes;
+};
+
+static CryptoResult measure(const char* op, ui64 size, const BenchOptions& opt,
+                            const std::function<void()>& call) {
+    ui64 n = opt.budget_bytes / size;
+    if (n < BENCH_MIN_SAMPLES) n = BENCH_MIN_SAMPLES;
+    if (n > BENCH_MAX_SAMPLES) n = BENCH_MAX_SAMPLES;
+
+    call(); // warm caches and lazy tables
+    std::vector<ui64> samples(n);
+    for (ui64 i = 0; i < n; ++i) {
+        ui64 c0 = bench_cycles();
+        call();
+        samples[i] = bench_cycles() - c0;
+    }
+
+    BenchStats s = bench_stats(samples);
+    double hz = bench_cycles_per_sec();
+    CryptoResult r;
+    r.op = op;
+    r.size = size;
+    r.samples = n;
+    r.cycles_per_byte = s.median / size;
+    r.mb_per_sec = size / (s.median / hz) / 1e6;
+    r.p50_ns = s.median / hz * 1e9;
+    r.p99_ns = s.p99 / hz * 1e9;
+    return r;
+}
+
+static void print_result(const CryptoResult& r) {
+    printf("%-18s %10llu %8.2f %10.1f %12.0f %12.0f\n", r.op.c_str(), (unsigned long long)r.size,
+           r.cycles_per_byte, r.mb_per_sec, r.p50_ns, r.p99_ns);
+}
+
+static bool write_json(const char* path, const std::vector<CryptoResult>& results) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    fprintf(f, "{\n  \"counter_hz\": %.0f,\n  \"cipher_kernel\": \"%s\",\n  \"results\": [\n",
+            bench_cycles_per_sec(), CryptoEngine::get_cipher_kernel());
+    for (ui64 i = 0; i < results.size(); ++i) {
+        const CryptoResult& r = results[i];
+        fprintf(f, "    {\"op\": \"%s\", \"size\": %llu, \"samples\": %llu, \"cycles_per_byte\": %.4f, "
+                   "\"mb_per_sec\": %.2f, \"p50_ns\": %.1f, \"p99_ns\": %.1f}%s\n",
+                r.op.c_str(), (unsigned long long)r.size, (unsigned long long)r.samples,
+                r.cycles_per_byte, r.mb_per_sec, r.p50_ns, r.p99_ns,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    return true;
+}
+
+static bool parse_args(int argc, char** argv, BenchOptions& opt) {
+    opt.json_path = nullptr;
+    opt.only_op = nullptr;
+    opt.max_size = BENCH_MAX_SIZE;
+    opt.budget_bytes = 32ull << 20;
+    for (int i = 1; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--json") && has_value) {
+            opt.json_path = argv[++i];
+        } else if (!strcmp(argv[i], "--max-size") && has_value) {
+            opt.max_size = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--budget") && has_value) {
+            opt.budget_bytes = strtoull(argv[++i], nullptr, 10) << 20;
+        } else if (!strcmp(argv[i], "--op") && has_value) {
+            opt.only_op = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--json out.json] [--max-size bytes] [--budget MiB] [--op name]\n",
+                    argv[0]);
+            return false;
+        }
+    }
+    if (opt.max_size < BENCH_MIN_SIZE) opt.max_size = BENCH_MIN_SIZE;
+    if (opt.budget_bytes == 0) opt.budget_bytes = 1;
+    return true;
+}
+
+static bool wants(const BenchOptions& opt, const char* op) {
+    return !opt.only_op || !strcmp(opt.only_op, op);
+}
+
+// the room relay's work: the same plaintext sealed, frame header and all,
+// under BENCH_FANOUT chacha20 sessions. bytes is the whole fan-out.
+static bool run_fanout(const BenchOptions& opt, const ui8* in, MemArena& arena,
+                       std::vector<CryptoResult>& results) {
+    if (!wants(opt, "fanout_seq") && !wants(opt, "fanout_batch")) return true;
+    std::vector<Session> senders(BENCH_FANOUT), receivers(BENCH_FANOUT);
+    for (ui64 i = 0; i < BENCH_FANOUT; ++i) {
+        ui8 a_pk[X25519_KEY_BYTES], a_sk[X25519_KEY_BYTES], b_pk[X25519_KEY_BYTES], b_sk[X25519_KEY_BYTES];
+        X25519::generate(a_pk, a_sk);
+        X25519::generate(b_pk, b_sk);
+        senders[i].derive(b_pk, a_sk, a_pk);
+        receivers[i].derive(a_pk, b_sk, b_pk);
+    }
+    ui64 seq = 0;
+    MessageView views[BENCH_FANOUT];
+    CryptoJob jobs[BENCH_FANOUT];
+    auto batch = [&](ui64 size) {
+        for (ui64 i = 0; i < BENCH_FANOUT; ++i) {
+            MessageView::seal_later(arena, "bench", ConstByteSpan(in, size), senders[i], seq, FRAME_FLAG_NONE,
+                                    views[i], jobs[i]);
+        }
+        SimpleCrypto::seal_batch(jobs, BENCH_FANOUT);
+        ++seq;
+    };
+
+    const ui64 sizes[] = {32, 64, 128, 256};
+    for (ui64 size : sizes) {
+        if (size > opt.max_size) break;
+        // what the batch seals has to open like any other frame
+        {
+            TempArena temp(arena);
+            batch(size);
+            for (ui64 i = 0; i < BENCH_FANOUT; ++i) {
+                if (!views[i].open_in_place(receivers[i]) || memcmp(views[i].body.data, in, size) != 0) {
+                    fprintf(stderr, "fanout: batch-sealed frame %llu did not open\n", (unsigned long long)i);
+                    return false;
+                }
+            }
+        }
+
+        double seq_ns = 0, batch_ns = 0;
+        if (wants(opt, "fanout_seq")) {
+            results.push_back(measure("fanout_seq", size * BENCH_FANOUT, opt, [&] {
+                TempArena temp(arena);
+                for (ui64 i = 0; i < BENCH_FANOUT; ++i) {
+                    MessageView::seal(arena, "bench", ConstByteSpan(in, size), senders[i], seq);
+                }
+                ++seq;
+            }));
+            print_result(results.back());
+            seq_ns = results.back().p50_ns;
+        }
+        if (wants(opt, "fanout_batch")) {
+            results.push_back(measure("fanout_batch", size * BENCH_FANOUT, opt, [&] {
+                TempArena temp(arena);
+                batch(size);
+            }));
+            print_result(results.back());
+            batch_ns = results.back().p50_ns;
+        }
+        if (seq_ns > 0 && batch_ns > 0) {
+            printf("  %llu B x %d: batch %.2fx sequential\n", (unsigned long long)size, BENCH_FANOUT,
+                   seq_ns / batch_ns);
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions opt;
+    if (!parse_args(argc, argv, opt)) return 1;
+
+    SimpleCrypto::init();
+    std::vector<ui8> input(opt.max_size), output(opt.max_size), sealed(opt.max_size), plain(opt.max_size);
+    std::vector<ui8> gcm_sealed(opt.max_size);
+    SimpleCrypto::random_bytes(input.data(), input.size());
+
+    ui8 key[32], nonce[CHACHA_IV_BYTES] = {0};
+    ui8 mac[POLY1305_MAC_BYTES], sealed_mac[POLY1305_MAC_BYTES], gcm_tag[GCM_TAG_BYTES];
+    AesGcmKey gcm_key;
+    SimpleCrypto::random_bytes(key, sizeof(key));
+    AesGcm::expand(gcm_key, key);
+
+    ui8 a_pk[X25519_KEY_BYTES], a_sk[X25519_KEY_BYTES], b_pk[X25519_KEY_BYTES], b_sk[X25519_KEY_BYTES];
+    X25519::generate(a_pk, a_sk);
+    X25519::generate(b_pk, b_sk);
+    Session sender, receiver;
+    sender.derive(b_pk, a_sk, a_pk);
+    receiver.derive(a_pk, b_sk, b_pk);
+
+    MemArena arena(2 * opt.max_size + (1 << 20));
+    std::vector<CryptoResult> results;
+
+    printf("counter %.2f GHz, cipher kernel %s\n\n", bench_cycles_per_sec() / 1e9,
+           CryptoEngine::get_cipher_kernel());
+    printf("%-18s %10s %8s %10s %12s %12s\n", "op", "bytes", "cyc/B", "MB/s", "p50 ns", "p99 ns");
+
+    for (ui64 size = BENCH_MIN_SIZE; size <= opt.max_size; size *= 4) {
+        ui8* in = input.data();
+        ui8* out = output.data();
+        ui8* dec = plain.data();
+        std::string content((const char*)in, size);
+
+        SimpleCrypto::simple_encrypt(out, in, size, key, sizeof(key));
+        SimpleCrypto::seal(sealed.data(), sealed_mac, in, size, nullptr, 0, key, nonce);
+        AesGcm::seal(gcm_sealed.data(), gcm_tag, in, size, nullptr, 0, gcm_key, nonce + 4);
+        arena.clear();
+        Message msg = Message::create_encrypted(arena, "bench", content, sender, 0);
+
+        struct Case {
+            const char* name;
+            std::function<void()> call;
+        } cases[] = {
+            {"simple_encrypt", [&] { SimpleCrypto::simple_encrypt(out, in, size, key, sizeof(key)); }},
+            {"simple_decrypt", [&] { SimpleCrypto::simple_decrypt(dec, out, size, key, sizeof(key)); }},
+            {"compute_auth", [&] { SimpleCrypto::compute_auth(mac, in, size, key); }},
+            {"random_bytes", [&] { SimpleCrypto::random_bytes(out, size); }},
+            {"seal", [&] { SimpleCrypto::seal(out, mac, in, size, nullptr, 0, key, nonce); }},
+            {"open", [&] { SimpleCrypto::open(dec, sealed.data(), size, sealed_mac, nullptr, 0, key, nonce); }},
+            {"gcm_seal", [&] { AesGcm::seal(out, mac, in, size, nullptr, 0, gcm_key, nonce + 4); }},
+            {"gcm_open", [&] {
+                AesGcm::open(dec, gcm_sealed.data(), size, gcm_tag, nullptr, 0, gcm_key, nonce + 4);
+            }},
+            {"create_encrypted", [&] {
+                TempArena temp(arena);
+                Message::create_encrypted(arena, "bench", content, sender, 0);
+            }},
+            {"decrypt_message", [&] { Message::decrypt_message(msg, receiver); }},
+            {"decrypt_into", [&] { Message::decrypt_into(msg, receiver, ByteSpan(dec, size)); }},
+            {"view_seal", [&] {
+                TempArena temp(arena);
+                MessageView::seal(arena, "bench", ConstByteSpan(in, size), sender, 0);
+            }},
+            {"slab_seal", [&] {
+                SlabBuffer wire(MessageView::wire_size(size));
+                MessageView::seal_into(ByteSpan(wire.data(), wire.size()), "bench", ConstByteSpan(in, size), sender, 0);
+            }},
+            // random input: prices the incompressibility check on top of seal
+            {"view_seal_lz4", [&] {
+                TempArena temp(arena);
+                MessageView::seal_compressed(arena, "bench", ConstByteSpan(in, size), sender, 0);
+            }},
+        };
+
+        for (auto& c : cases) {
+            if (opt.only_op && strcmp(opt.only_op, c.name) != 0) continue;
+            results.push_back(measure(c.name, size, opt, c.call));
+            print_result(results.back());
+        }
+        if (size * 4 > opt.max_size && size != opt.max_size) {
+            // always finish on max_size itself
+            size = opt.max_size / 4;
+        }
+        if (!opt.only_op) printf("\n");
+    }
+
+    if (!run_fanout(opt, input.data(), arena, results)) return 1;
+
+    if (opt.json_path && !write_json(opt.json_path, results)) return 1;
+    return 0;
+}
@@ -0,0 +1,84 @@
+// handshakes per second: keygen (single, batch, pooled), x25519 and the
+// full two-sided session derivation a new connection pays for.
+//
+//   bench_handshake [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "../include/session.h"
+#include "../include/x25519.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+static void report(const char* name, ui64 ops, double secs) {
+    printf("%-24s %10.0f ops/s %9.2f us/op\n", name, ops / secs, secs * 1e6 / ops);
+}
+
+int main(int argc, char** argv) {
+    ui64 iterations = argc > 1 ? strtoull(argv[1], nullptr, 10) : 2000;
+    if (iterations == 0) iterations = 1;
+
+    std::vector<ui8> pks(iterations * X25519_KEY_BYTES), sks(iterations * X25519_KEY_BYTES);
+    ui8 (*pk)[X25519_KEY_BYTES] = (ui8 (*)[X25519_KEY_BYTES])pks.data();
+    ui8 (*sk)[X25519_KEY_BYTES] = (ui8 (*)[X25519_KEY_BYTES])sks.data();
+
+    // build the comb table outside the timed region
+    X25519::generate(pk[0], sk[0]);
+
+    auto start = bench_clock::now();
+    for (ui64 i = 0; i < iterations; ++i) {
+        X25519::generate(pk[i], sk[i]);
+    }
+    report("keygen", iterations, seconds_since(start));
+
+    start = bench_clock::now();
+    X25519::generate_batch(pk, sk, iterations);
+    report("keygen (batch)", iterations, seconds_since(start));
+
+    {
+        KeyPairPool pool(iterations);
+        while (pool.available() < iterations) {
+            std::this_thread::yield();
+        }
+        ui8 p[X25519_KEY_BYTES], s[X25519_KEY_BYTES];
+        start = bench_clock::now();
+        for (ui64 i = 0; i < iterations; ++i) {
+            pool.take(p, s);
+        }
+        report("keygen (pool hit)", iterations, seconds_since(start));
+    }
+
+    ui8 shared[X25519_KEY_BYTES];
+    start = bench_clock::now();
+    for (ui64 i = 0; i < iterations; ++i) {
+        X25519::shared(shared, sk[i], pk[(i + 1) % iterations]);
+    }
+    report("x25519 shared", iterations, seconds_since(start));
+
+    // one handshake = both sides generate a keypair and derive a session
+    ui8 a_pk[X25519_KEY_BYTES], a_sk[X25519_KEY_BYTES];
+    ui8 b_pk[X25519_KEY_BYTES], b_sk[X25519_KEY_BYTES];
+    ui64 mismatches = 0;
+    start = bench_clock::now();
+    for (ui64 i = 0; i < iterations; ++i) {
+        X25519::generate(a_pk, a_sk);
+        X25519::generate(b_pk, b_sk);
+        Session a, b;
+        a.derive(b_pk, a_sk, a_pk);
+        b.derive(a_pk, b_sk, b_pk);
+        if (memcmp(a.get_key(), b.get_key(), SESSION_KEY_BYTES) != 0) mismatches++;
+    }
+    report("handshake", iterations, seconds_since(start));
+
+    if (mismatches) {
+        printf("error: %llu handshakes disagreed on the key\n", (unsigned long long)mismatches);
+        return 1;
+    }
+    return 0;
+}
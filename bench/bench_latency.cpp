@@ -0,0 +1,226 @@
+// end-to-end message latency over loopback: a client seals a message, an
+// echo thread reads it with FrameReader, opens it, seals it back, and the
+// client reads and opens the reply. round trips are timed one at a time.
+//
+//   bench_latency [--messages N] [--size bytes] [--mode event|sleep|both]
+//
+// event is the receive path server.exe / client.exe use now: block in
+// wait_readable on the socket and a Waker, recv once it is readable.
+// sleep replays the old loop (recv, then Sleep(10) after every frame) so
+// the two can be compared on the same machine.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+#include "../include/conn.h"
+#include "../include/message_view.h"
+#include "../include/wakeup.h"
+#include "bench_common.h"
+
+#ifndef _WIN32
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
+
+// what the old receive loops slept after every frame
+#define BENCH_LEGACY_SLEEP_MS 10
+#define BENCH_MAX_MESSAGE 1024
+
+enum RecvMode {
+    RECV_EVENT = 0,
+    RECV_SLEEP = 1,
+};
+
+struct BenchOptions {
+    ui64 messages;
+    ui64 size;
+    bool event;
+    bool sleep;
+};
+
+static bool parse_args(int argc, char** argv, BenchOptions& opt) {
+    opt.messages = 0;
+    opt.size = 64;
+    opt.event = opt.sleep = true;
+    for (int i = 1; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--messages") && has_value) {
+            opt.messages = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--size") && has_value) {
+            opt.size = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--mode") && has_value) {
+            const char* mode = argv[++i];
+            opt.event = !strcmp(mode, "event") || !strcmp(mode, "both");
+            opt.sleep = !strcmp(mode, "sleep") || !strcmp(mode, "both");
+            if (!opt.event && !opt.sleep) return false;
+        } else {
+            fprintf(stderr, "usage: %s [--messages N] [--size bytes] [--mode event|sleep|both]\n", argv[0]);
+            return false;
+        }
+    }
+    opt.size = MAX(opt.size, (ui64)1);
+    opt.size = MIN(opt.size, (ui64)BENCH_MAX_MESSAGE);
+    return true;
+}
+
+// one end of the loopback connection
+struct Peer {
+    socket_t sock;
+    Session session;
+    ConnBudget budget;
+    FrameReader reader;
+    ui64 send_seq;
+    ui64 recv_seq;
+
+    Peer() : sock((socket_t)INVALID_SOCKET), session(), budget(), reader(&budget, FRAME_MAX_PAYLOAD), send_seq(0),
+             recv_seq(0) {}
+};
+
+static bool open_pair(Peer& a, Peer& b) {
+    socket_t listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == (socket_t)INVALID_SOCKET) return false;
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    bool ok = bind(listener, (sockaddr*)&addr, sizeof(addr)) == 0 && listen(listener, 1) == 0 &&
+              getsockname(listener, (sockaddr*)&addr, &len) == 0;
+    if (ok) {
+        a.sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        ok = a.sock != (socket_t)INVALID_SOCKET && connect(a.sock, (sockaddr*)&addr, sizeof(addr)) == 0;
+    }
+    if (ok) {
+        b.sock = accept(listener, nullptr, nullptr);
+        ok = b.sock != (socket_t)INVALID_SOCKET;
+    }
+    closesocket(listener);
+    if (!ok) return false;
+    // as in the servers: small frames go out immediately
+    int on = 1;
+    setsockopt(a.sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+    setsockopt(b.sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+
+    ui8 a_pk[X25519_KEY_BYTES], a_sk[X25519_KEY_BYTES];
+    ui8 b_pk[X25519_KEY_BYTES], b_sk[X25519_KEY_BYTES];
+    X25519::generate(a_pk, a_sk);
+    X25519::generate(b_pk, b_sk);
+    a.session.derive(b_pk, a_sk, a_pk);
+    b.session.derive(a_pk, b_sk, b_pk);
+    return true;
+}
+
+// reads one frame and opens it in place, the same way the receive
+// threads do. false on eof, a bad frame, or when the waker fired.
+static bool read_message(Peer& p, RecvMode mode, const Waker& waker) {
+    for (;;) {
+        if (mode == RECV_EVENT && wait_readable(p.sock, waker) != WAIT_READABLE) return false;
+        int n = recv(p.sock, (char*)p.reader.target(), (int)p.reader.missing(), 0);
+        if (n <= 0) return false;
+        ReadStatus status = p.reader.advance((ui32)n);
+        if (status == READ_MORE) continue;
+        if (status != READ_FRAME) return false;
+
+        const FrameHeader& header = p.reader.frame_header();
+        MessageView view = Frame::view(header, p.reader.frame_payload());
+        bool ok = header.seq == p.recv_seq++ && view.open_in_place(p.session);
+        p.reader.next();
+        if (mode == RECV_SLEEP) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(BENCH_LEGACY_SLEEP_MS));
+        }
+        return ok;
+    }
+}
+
+static bool send_message(Peer& p, ConstByteSpan text) {
+    ScratchArena scratch;
+    MessageView view = MessageView::seal(scratch.arena(), "bench", text, p.session, p.send_seq++);
+    return Frame::send(p.sock, view);
+}
+
+static void run(RecvMode mode, ui64 messages, ui64 size) {
+    Peer client, server;
+    if (!open_pair(client, server)) {
+        fprintf(stderr, "cannot open a loopback connection\n");
+        return;
+    }
+    Waker waker;
+    if (!waker.open()) {
+        fprintf(stderr, "cannot open a waker\n");
+        return;
+    }
+    ExitSignal done(&waker);
+
+    // the server side: echo until the client is finished
+    std::thread echo([&] {
+        std::string reply(size, 'r');
+        while (!done.is_set()) {
+            if (!read_message(server, mode, waker)) break;
+            if (!send_message(server, as_bytes(reply))) break;
+        }
+    });
+
+    std::string text(size, 'm');
+    std::vector<ui64> samples;
+    samples.reserve(messages);
+    auto start = bench_clock::now();
+    for (ui64 i = 0; i < messages; ++i) {
+        ui64 t0 = bench_cycles();
+        if (!send_message(client, as_bytes(text)) || !read_message(client, mode, waker)) {
+            fprintf(stderr, "round trip %llu failed\n", (unsigned long long)i);
+            break;
+        }
+        samples.push_back(bench_cycles() - t0);
+    }
+    double secs = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    // wakes the echo thread out of its wait; the sleep loop has no waker
+    // and needs the socket shut to notice
+    done.set();
+    if (mode == RECV_SLEEP) shutdown(client.sock, 2);
+    echo.join();
+    closesocket(client.sock);
+    closesocket(server.sock);
+
+    BenchStats s = bench_stats(samples);
+    double us = 1e6 / bench_cycles_per_sec();
+    printf("%-6s %8llu %10.1f %10.1f %10.1f %10.1f %12.0f\n", mode == RECV_EVENT ? "event" : "sleep",
+           (unsigned long long)samples.size(), s.median * us, s.p99 * us, s.p999 * us, s.mean * us,
+           samples.size() / secs);
+}
+
+int main(int argc, char** argv) {
+    BenchOptions opt;
+    if (!parse_args(argc, argv, opt)) return 1;
+
+#ifdef _WIN32
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) return 1;
+#endif
+    bench_cycles_per_sec();
+
+    printf("round trip of a %llu-byte message (seal, frame, send, read, open, and back)\n\n",
+           (unsigned long long)opt.size);
+    printf("%-6s %8s %10s %10s %10s %10s %12s\n", "recv", "msgs", "p50 us", "p99 us", "p999 us", "mean us",
+           "round trip/s");
+    // the sleep loop costs 2 x 10 ms per round trip, keep its run short
+    if (opt.event) run(RECV_EVENT, opt.messages != 0 ? opt.messages : 20000, opt.size);
+    if (opt.sleep) run(RECV_SLEEP, opt.messages != 0 ? opt.messages : 100, opt.size);
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return 0;
+}
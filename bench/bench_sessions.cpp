@@ -0,0 +1,215 @@
+// idle-session footprint: opens N loopback connections, gives each the
+// server-side Connection a session keeps, and reports resident memory per
+// session while idle and again after one frame has gone through every
+// session (its buffers are back in the pool by then).
+//
+//   bench_sessions [--sessions N] [--soft bytes] [--hard bytes]
+//
+// one client keypair is shared by every connection so keygen does not
+// dominate; each server-side session still runs its own key agreement.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#endif
+#include "../include/conn.h"
+#include "../include/message_view.h"
+#include "bench_common.h"
+
+#ifndef _WIN32
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
+
+#define BENCH_SPARE_FDS 32
+
+struct BenchOptions {
+    ui64 sessions;
+    ui64 soft_bytes;
+    ui64 hard_bytes;
+};
+
+static bool parse_args(int argc, char** argv, BenchOptions& opt) {
+    opt.sessions = 10000;
+    opt.soft_bytes = CONN_DEFAULT_SOFT_BYTES;
+    opt.hard_bytes = CONN_DEFAULT_HARD_BYTES;
+    for (int i = 1; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--sessions") && has_value) {
+            opt.sessions = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--soft") && has_value) {
+            opt.soft_bytes = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--hard") && has_value) {
+            opt.hard_bytes = strtoull(argv[++i], nullptr, 10);
+        } else {
+            fprintf(stderr, "usage: %s [--sessions N] [--soft bytes] [--hard bytes]\n", argv[0]);
+            return false;
+        }
+    }
+    if (opt.sessions == 0) opt.sessions = 1;
+    return true;
+}
+
+// two sockets per session live in this process; ask for as many
+// descriptors as allowed and return how many sessions fit, keeping a few
+// for the listener, stdio and reading rss
+static ui64 raise_fd_limit(ui64 wanted) {
+#ifndef _WIN32
+    rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) != 0) return wanted;
+    if (lim.rlim_cur < lim.rlim_max) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+        getrlimit(RLIMIT_NOFILE, &lim);
+    }
+    if (lim.rlim_cur != RLIM_INFINITY && lim.rlim_cur < 2 * wanted + BENCH_SPARE_FDS) {
+        ui64 fit = lim.rlim_cur > BENCH_SPARE_FDS ? (lim.rlim_cur - BENCH_SPARE_FDS) / 2 : 0;
+        printf("descriptor limit %llu: %llu sessions instead of %llu\n", (unsigned long long)lim.rlim_cur,
+               (unsigned long long)fit, (unsigned long long)wanted);
+        return fit;
+    }
+#endif
+    return wanted;
+}
+
+static socket_t open_listener(sockaddr_in& addr) {
+    socket_t sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock == (socket_t)INVALID_SOCKET) return sock;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (bind(sock, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(sock, SOMAXCONN) != 0 ||
+        getsockname(sock, (sockaddr*)&addr, &len) != 0) {
+        closesocket(sock);
+        return (socket_t)INVALID_SOCKET;
+    }
+    return sock;
+}
+
+// blocking read of one whole frame through the connection's reader
+static bool read_frame(Connection& conn) {
+    for (;;) {
+        int n = recv(conn.sock, (char*)conn.reader.target(), (int)conn.reader.missing(), 0);
+        if (n <= 0) return false;
+        ReadStatus status = conn.reader.advance((ui32)n);
+        if (status == READ_FRAME) return true;
+        if (status != READ_MORE) return false;
+    }
+}
+
+static void report(const char* phase, ui64 rss, ui64 base, ui64 sessions) {
+    double per = rss > base ? (double)(rss - base) / sessions : 0.0;
+    printf("%-22s %10.1f MB %10.2f KiB/session\n", phase, rss / (1024.0 * 1024.0), per / 1024.0);
+}
+
+int main(int argc, char** argv) {
+    BenchOptions opt;
+    if (!parse_args(argc, argv, opt)) return 1;
+
+#ifdef _WIN32
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) return 1;
+#endif
+    opt.sessions = raise_fd_limit(opt.sessions);
+
+    sockaddr_in addr;
+    socket_t listener = open_listener(addr);
+    if (listener == (socket_t)INVALID_SOCKET) {
+        fprintf(stderr, "cannot listen on loopback\n");
+        return 1;
+    }
+
+    ui8 server_pk[X25519_KEY_BYTES], server_sk[X25519_KEY_BYTES];
+    ui8 client_pk[X25519_KEY_BYTES], client_sk[X25519_KEY_BYTES];
+    X25519::generate(server_pk, server_sk);
+    X25519::generate(client_pk, client_sk);
+    Session client_session;
+    client_session.derive(server_pk, client_sk, client_pk);
+
+    // warm the slab classes and the scratch arena before the baseline
+    {
+        ScratchArena scratch;
+        SlabBuffer warm(FRAME_HEADER_BYTES);
+        MessageView::seal(scratch.arena(), "bench", as_bytes("warm"), client_session, 0);
+    }
+
+    MemBudget total;
+    ConnBudgetConfig config(opt.soft_bytes, opt.hard_bytes);
+    std::vector<Connection*> conns;
+    std::vector<socket_t> clients;
+    conns.reserve(opt.sessions);
+    clients.reserve(opt.sessions);
+    ui64 base = bench_rss_bytes();
+
+    auto start = bench_clock::now();
+    for (ui64 i = 0; i < opt.sessions; ++i) {
+        socket_t c = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (c == (socket_t)INVALID_SOCKET) break;
+        if (connect(c, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            closesocket(c);
+            break;
+        }
+        socket_t s = accept(listener, nullptr, nullptr);
+        if (s == (socket_t)INVALID_SOCKET) {
+            closesocket(c);
+            break;
+        }
+        Connection* conn = new Connection(s, config, &total);
+        memcpy(conn->peer_public_key, client_pk, X25519_KEY_BYTES);
+        conn->session.derive(conn->peer_public_key, server_sk, server_pk);
+        conns.push_back(conn);
+        clients.push_back(c);
+    }
+    double open_secs = std::chrono::duration<double>(bench_clock::now() - start).count();
+    ui64 n = conns.size();
+    if (n == 0) {
+        fprintf(stderr, "could not open any session\n");
+        return 1;
+    }
+    if (n < opt.sessions) {
+        printf("stopped at %llu sessions (port or kernel limit)\n", (unsigned long long)n);
+    }
+
+    printf("%llu sessions opened in %.2f s, Connection is %llu bytes\n\n", (unsigned long long)n, open_secs,
+           (unsigned long long)sizeof(Connection));
+    report("baseline", base, base, n);
+    report("idle", bench_rss_bytes(), base, n);
+
+    // one short message per session, read and opened on the server side
+    ui64 delivered = 0;
+    for (ui64 i = 0; i < n; ++i) {
+        ScratchArena scratch;
+        MessageView view = MessageView::seal(scratch.arena(), "bench", as_bytes("hello from an idle session"),
+                                             client_session, 0);
+        if (!Frame::send(clients[i], view)) continue;
+        Connection& conn = *conns[i];
+        if (!read_frame(conn)) continue;
+        MessageView in = Frame::view(conn.reader.frame_header(), conn.reader.frame_payload());
+        if (in.open_in_place(conn.session)) ++delivered;
+        conn.reader.next();
+    }
+    report("after one frame each", bench_rss_bytes(), base, n);
+    printf("%-22s %10llu of %llu, budget peak %llu bytes, now %llu\n", "delivered", (unsigned long long)delivered,
+           (unsigned long long)n, (unsigned long long)total.get_peak(), (unsigned long long)total.get_used());
+
+    for (ui64 i = 0; i < n; ++i) {
+        closesocket(conns[i]->sock);
+        closesocket(clients[i]);
+        delete conns[i];
+    }
+    closesocket(listener);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return 0;
+}
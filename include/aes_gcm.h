@@ -0,0 +1,494 @@
+#ifndef AES_GCM_H
+#define AES_GCM_H
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define AES_X86_NI 1
+#define AES_TARGET __attribute__((target("aes,pclmul,ssse3,sse4.1")))
+// the 8-way loops only pipeline once unrolled, -O2 alone won't do it
+#define AES_UNROLL _Pragma("GCC unroll 16")
+#else
+#define AES_X86_NI 0
+#define AES_TARGET
+#define AES_UNROLL
+#endif
+
+typedef uint8_t ui8;
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+#define AES256_KEY_BYTES 32
+#define AES256_ROUNDS 14
+#define AES_BLOCK_BYTES 16
+#define GCM_IV_BYTES 12
+#define GCM_TAG_BYTES 16
+// blocks per aes-ni pass; also the number of cached powers of H
+#define GCM_STRIDE 8
+
+// expanded per-key state: round keys plus the ghash key. built once per
+// session (Session keeps it next to the chacha schedule).
+struct AesGcmKey {
+    alignas(16) ui8 round_keys[(AES256_ROUNDS + 1) * AES_BLOCK_BYTES];
+    // pclmul path: byte-reflected H^1..H^8. portable path: H in [0] only.
+    alignas(16) ui8 h_powers[GCM_STRIDE][AES_BLOCK_BYTES];
+    bool hardware;
+};
+
+// aes-256-gcm (nist sp 800-38d) with 96-bit ivs. aes-ni + pclmulqdq when
+// the cpu has them: 8 counter blocks per pass and one ghash reduction per
+// 8 blocks. otherwise a portable byte-oriented aes and a bitwise
+// constant-time ghash. the portable aes uses an s-box table, so it is not
+// cache-timing safe; it exists for correctness on cpus without aes-ni.
+class AesGcm {
+public:
+    static bool hardware() {
+#if AES_X86_NI
+        static bool has = __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul") &&
+                          __builtin_cpu_supports("sse4.1");
+        return has;
+#else
+        return false;
+#endif
+    }
+
+    // allow_hardware = false pins this key to the portable path (tests,
+    // benches). the hardware path never touches the s-box table, not even
+    // for the key schedule or H.
+    static void expand(AesGcmKey& k, const ui8 key[AES256_KEY_BYTES], bool allow_hardware = true) {
+        memset(k.h_powers, 0, sizeof(k.h_powers));
+        k.hardware = allow_hardware && hardware();
+#if AES_X86_NI
+        if (k.hardware) {
+            expand_ni(k, key);
+            return;
+        }
+#endif
+        expand_key(k.round_keys, key);
+        ui8 zero[AES_BLOCK_BYTES] = {0}, h[AES_BLOCK_BYTES];
+        encrypt_block_soft(k.round_keys, zero, h);
+        memcpy(k.h_powers[0], h, sizeof(h));
+        memset(h, 0, sizeof(h));
+    }
+
+    static void seal(ui8* ciphertext, ui8* tag, const ui8* plaintext, ui64 len,
+                     const ui8* aad, ui64 aad_len, const AesGcmKey& k, const ui8 iv[GCM_IV_BYTES]) {
+        crypt(ciphertext, tag, plaintext, len, aad, aad_len, k, iv, true);
+    }
+
+    // returns false (and wipes the output) if the tag does not match
+    static bool open(ui8* plaintext, const ui8* ciphertext, ui64 len, const ui8* tag,
+                     const ui8* aad, ui64 aad_len, const AesGcmKey& k, const ui8 iv[GCM_IV_BYTES]) {
+        ui8 expected[GCM_TAG_BYTES];
+        crypt(plaintext, expected, ciphertext, len, aad, aad_len, k, iv, false);
+        ui8 diff = 0;
+        for (int i = 0; i < GCM_TAG_BYTES; ++i) {
+            diff |= expected[i] ^ tag[i];
+        }
+        memset(expected, 0, sizeof(expected));
+        if (diff != 0) {
+            memset(plaintext, 0, len);
+            return false;
+        }
+        return true;
+    }
+
+    // one-shot forms that expand the key every call
+    static void seal(ui8* ciphertext, ui8* tag, const ui8* plaintext, ui64 len,
+                     const ui8* aad, ui64 aad_len, const ui8* key, const ui8 iv[GCM_IV_BYTES]) {
+        AesGcmKey k;
+        expand(k, key);
+        seal(ciphertext, tag, plaintext, len, aad, aad_len, k, iv);
+        memset(&k, 0, sizeof(k));
+    }
+
+    static bool open(ui8* plaintext, const ui8* ciphertext, ui64 len, const ui8* tag,
+                     const ui8* aad, ui64 aad_len, const ui8* key, const ui8 iv[GCM_IV_BYTES]) {
+        AesGcmKey k;
+        expand(k, key);
+        bool ok = open(plaintext, ciphertext, len, tag, aad, aad_len, k, iv);
+        memset(&k, 0, sizeof(k));
+        return ok;
+    }
+
+private:
+    // ---- portable aes ----
+
+    static const ui8* sbox() {
+        static const ui8 table[256] = {
+            0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+            0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+            0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+            0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+            0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+            0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+            0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+            0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+            0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+            0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+            0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+            0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+            0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+            0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+            0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+            0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+        };
+        return table;
+    }
+
+    static inline ui8 xtime(ui8 x) {
+        return (ui8)((x << 1) ^ (0x1b & (0 - (x >> 7))));
+    }
+
+    // fips-197 byte order, which is also what aesenc expects
+    static void expand_key(ui8* rk, const ui8 key[AES256_KEY_BYTES]) {
+        const ui8* s = sbox();
+        memcpy(rk, key, AES256_KEY_BYTES);
+        ui8 rcon = 1;
+        for (int i = 8; i < 4 * (AES256_ROUNDS + 1); ++i) {
+            ui8 t[4];
+            memcpy(t, rk + 4 * (i - 1), 4);
+            if (i % 8 == 0) {
+                ui8 first = t[0];
+                t[0] = (ui8)(s[t[1]] ^ rcon);
+                t[1] = s[t[2]];
+                t[2] = s[t[3]];
+                t[3] = s[first];
+                rcon = xtime(rcon);
+            } else if (i % 8 == 4) {
+                for (int j = 0; j < 4; ++j) t[j] = s[t[j]];
+            }
+            for (int j = 0; j < 4; ++j) {
+                rk[4 * i + j] = rk[4 * (i - 8) + j] ^ t[j];
+            }
+        }
+    }
+
+    static void encrypt_block_soft(const ui8* rk, const ui8 in[AES_BLOCK_BYTES], ui8 out[AES_BLOCK_BYTES]) {
+        const ui8* s = sbox();
+        ui8 st[16], tmp[16];
+        for (int i = 0; i < 16; ++i) st[i] = in[i] ^ rk[i];
+        for (int round = 1; round <= AES256_ROUNDS; ++round) {
+            // sub bytes + shift rows
+            for (int c = 0; c < 4; ++c) {
+                for (int r = 0; r < 4; ++r) {
+                    tmp[4 * c + r] = s[st[4 * ((c + r) & 3) + r]];
+                }
+            }
+            if (round != AES256_ROUNDS) {
+                for (int c = 0; c < 4; ++c) {
+                    ui8* col = tmp + 4 * c;
+                    ui8 a0 = col[0], a1 = col[1], a2 = col[2], a3 = col[3];
+                    ui8 all = a0 ^ a1 ^ a2 ^ a3;
+                    col[0] ^= all ^ xtime(a0 ^ a1);
+                    col[1] ^= all ^ xtime(a1 ^ a2);
+                    col[2] ^= all ^ xtime(a2 ^ a3);
+                    col[3] ^= all ^ xtime(a3 ^ a0);
+                }
+            }
+            const ui8* k = rk + AES_BLOCK_BYTES * round;
+            for (int i = 0; i < 16; ++i) st[i] = tmp[i] ^ k[i];
+        }
+        memcpy(out, st, sizeof(st));
+        memset(st, 0, sizeof(st));
+        memset(tmp, 0, sizeof(tmp));
+    }
+
+    // ---- portable ghash (gcm bit order, big-endian halves) ----
+
+    static ui64 load_be64(const ui8* p) {
+        ui64 v = 0;
+        for (int i = 0; i < 8; ++i) v = (v << 8) | p[i];
+        return v;
+    }
+
+    static void store_be64(ui8* p, ui64 v) {
+        for (int i = 7; i >= 0; --i) {
+            p[i] = (ui8)v;
+            v >>= 8;
+        }
+    }
+
+    // x = x * h in gf(2^128), no data-dependent branches
+    static void gf_mul_soft(ui64 x[2], const ui8 h[AES_BLOCK_BYTES]) {
+        ui64 vh = load_be64(h), vl = load_be64(h + 8);
+        ui64 zh = 0, zl = 0;
+        for (int i = 0; i < 128; ++i) {
+            ui64 word = i < 64 ? x[0] : x[1];
+            ui64 bit = (word >> (63 - (i & 63))) & 1;
+            ui64 mask = 0 - bit;
+            zh ^= vh & mask;
+            zl ^= vl & mask;
+            ui64 lsb = 0 - (vl & 1);
+            vl = (vl >> 1) | (vh << 63);
+            vh = (vh >> 1) ^ (0xe100000000000000ULL & lsb);
+        }
+        x[0] = zh;
+        x[1] = zl;
+    }
+
+    static void ghash_soft(ui64 x[2], const ui8* data, ui64 len, const ui8* h) {
+        while (len > 0) {
+            ui8 block[AES_BLOCK_BYTES] = {0};
+            ui64 n = len < AES_BLOCK_BYTES ? len : AES_BLOCK_BYTES;
+            memcpy(block, data, n);
+            x[0] ^= load_be64(block);
+            x[1] ^= load_be64(block + 8);
+            gf_mul_soft(x, h);
+            data += n;
+            len -= n;
+        }
+    }
+
+    static void crypt_soft(ui8* out, ui8* tag, const ui8* in, ui64 len, const ui8* aad, ui64 aad_len,
+                           const AesGcmKey& k, const ui8 iv[GCM_IV_BYTES], bool sealing) {
+        const ui8* h = k.h_powers[0];
+        ui64 x[2] = {0, 0};
+        ghash_soft(x, aad, aad_len, h);
+
+        ui8 ctr[AES_BLOCK_BYTES], ks[AES_BLOCK_BYTES];
+        memcpy(ctr, iv, GCM_IV_BYTES);
+        ui32 counter = 2;
+        for (ui64 off = 0; off < len; off += AES_BLOCK_BYTES) {
+            ui64 n = len - off < AES_BLOCK_BYTES ? len - off : AES_BLOCK_BYTES;
+            if (!sealing) ghash_soft(x, in + off, n, h);
+            ctr[12] = (ui8)(counter >> 24);
+            ctr[13] = (ui8)(counter >> 16);
+            ctr[14] = (ui8)(counter >> 8);
+            ctr[15] = (ui8)counter;
+            counter++;
+            encrypt_block_soft(k.round_keys, ctr, ks);
+            for (ui64 i = 0; i < n; ++i) out[off + i] = in[off + i] ^ ks[i];
+            if (sealing) ghash_soft(x, out + off, n, h);
+        }
+
+        ui8 lengths[AES_BLOCK_BYTES];
+        store_be64(lengths, aad_len * 8);
+        store_be64(lengths + 8, len * 8);
+        ghash_soft(x, lengths, sizeof(lengths), h);
+
+        ctr[12] = ctr[13] = ctr[14] = 0;
+        ctr[15] = 1;
+        encrypt_block_soft(k.round_keys, ctr, ks);
+        store_be64(tag, x[0]);
+        store_be64(tag + 8, x[1]);
+        for (int i = 0; i < GCM_TAG_BYTES; ++i) tag[i] ^= ks[i];
+        memset(ks, 0, sizeof(ks));
+    }
+
+    static void crypt(ui8* out, ui8* tag, const ui8* in, ui64 len, const ui8* aad, ui64 aad_len,
+                      const AesGcmKey& k, const ui8 iv[GCM_IV_BYTES], bool sealing) {
+#if AES_X86_NI
+        if (k.hardware) {
+            crypt_ni(out, tag, in, len, aad, aad_len, k, iv, sealing);
+            return;
+        }
+#endif
+        crypt_soft(out, tag, in, len, aad, aad_len, k, iv, sealing);
+    }
+
+#if AES_X86_NI
+    // ---- aes-ni + pclmulqdq ----
+    // ghash runs on byte-reflected blocks; the extra shift-by-one of the
+    // reflected product is folded into reduce().
+
+    AES_TARGET
+    static inline __m128i reflect(__m128i v) {
+        return _mm_shuffle_epi8(v, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    }
+
+    // 256-bit carry-less product, accumulated into lo/hi
+    AES_TARGET
+    static inline void clmul_acc(__m128i a, __m128i b, __m128i& lo, __m128i& mid, __m128i& hi) {
+        lo = _mm_xor_si128(lo, _mm_clmulepi64_si128(a, b, 0x00));
+        mid = _mm_xor_si128(mid, _mm_clmulepi64_si128(a, b, 0x10));
+        mid = _mm_xor_si128(mid, _mm_clmulepi64_si128(a, b, 0x01));
+        hi = _mm_xor_si128(hi, _mm_clmulepi64_si128(a, b, 0x11));
+    }
+
+    AES_TARGET
+    static inline __m128i reduce(__m128i lo, __m128i mid, __m128i hi) {
+        lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+        hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+        // shift the 256-bit product left by one
+        __m128i c_lo = _mm_srli_epi32(lo, 31);
+        __m128i c_hi = _mm_srli_epi32(hi, 31);
+        lo = _mm_slli_epi32(lo, 1);
+        hi = _mm_slli_epi32(hi, 1);
+        __m128i top = _mm_srli_si128(c_lo, 12);
+        c_hi = _mm_slli_si128(c_hi, 4);
+        c_lo = _mm_slli_si128(c_lo, 4);
+        lo = _mm_or_si128(lo, c_lo);
+        hi = _mm_or_si128(hi, c_hi);
+        hi = _mm_or_si128(hi, top);
+
+        // reduce mod x^128 + x^7 + x^2 + x + 1
+        __m128i a = _mm_slli_epi32(lo, 31);
+        __m128i b = _mm_slli_epi32(lo, 30);
+        __m128i c = _mm_slli_epi32(lo, 25);
+        a = _mm_xor_si128(a, _mm_xor_si128(b, c));
+        b = _mm_srli_si128(a, 4);
+        a = _mm_slli_si128(a, 12);
+        lo = _mm_xor_si128(lo, a);
+        __m128i d = _mm_srli_epi32(lo, 1);
+        __m128i e = _mm_srli_epi32(lo, 2);
+        __m128i f = _mm_srli_epi32(lo, 7);
+        d = _mm_xor_si128(d, _mm_xor_si128(e, _mm_xor_si128(f, b)));
+        lo = _mm_xor_si128(lo, d);
+        return _mm_xor_si128(hi, lo);
+    }
+
+    AES_TARGET
+    static inline __m128i gf_mul(__m128i a, __m128i b) {
+        __m128i lo = _mm_setzero_si128(), mid = _mm_setzero_si128(), hi = _mm_setzero_si128();
+        clmul_acc(a, b, lo, mid, hi);
+        return reduce(lo, mid, hi);
+    }
+
+    // x ^ x<<32 ^ x<<64 ^ x<<96: each word xored with the ones before it
+    AES_TARGET
+    static inline __m128i key_mix(__m128i x) {
+        x = _mm_xor_si128(x, _mm_slli_si128(x, 4));
+        return _mm_xor_si128(x, _mm_slli_si128(x, 8));
+    }
+
+    // the next two round keys from the previous two (fips-197 5.2, nk = 8)
+    template <int Rcon>
+    AES_TARGET
+    static inline void expand_step(__m128i& a, __m128i& b) {
+        a = _mm_xor_si128(key_mix(a), _mm_shuffle_epi32(_mm_aeskeygenassist_si128(b, Rcon), 0xff));
+        b = _mm_xor_si128(key_mix(b), _mm_shuffle_epi32(_mm_aeskeygenassist_si128(a, 0), 0xaa));
+    }
+
+    // same schedule as expand_key, H = E(K, 0^128) and its powers
+    AES_TARGET
+    static void expand_ni(AesGcmKey& k, const ui8 key[AES256_KEY_BYTES]) {
+        __m128i rk[AES256_ROUNDS + 1];
+        __m128i a = _mm_loadu_si128((const __m128i*)key);
+        __m128i b = _mm_loadu_si128((const __m128i*)(key + AES_BLOCK_BYTES));
+        rk[0] = a;
+        rk[1] = b;
+        expand_step<0x01>(a, b); rk[2] = a; rk[3] = b;
+        expand_step<0x02>(a, b); rk[4] = a; rk[5] = b;
+        expand_step<0x04>(a, b); rk[6] = a; rk[7] = b;
+        expand_step<0x08>(a, b); rk[8] = a; rk[9] = b;
+        expand_step<0x10>(a, b); rk[10] = a; rk[11] = b;
+        expand_step<0x20>(a, b); rk[12] = a; rk[13] = b;
+        rk[14] = _mm_xor_si128(key_mix(a), _mm_shuffle_epi32(_mm_aeskeygenassist_si128(b, 0x40), 0xff));
+
+        // the zero block xored with round key 0 is round key 0
+        __m128i h = rk[0];
+        for (int r = 1; r < AES256_ROUNDS; ++r) h = _mm_aesenc_si128(h, rk[r]);
+        h = _mm_aesenclast_si128(h, rk[AES256_ROUNDS]);
+
+        for (int r = 0; r <= AES256_ROUNDS; ++r) {
+            _mm_store_si128((__m128i*)(k.round_keys + AES_BLOCK_BYTES * r), rk[r]);
+            rk[r] = _mm_setzero_si128();
+        }
+        __m128i h1 = reflect(h);
+        __m128i p = h1;
+        for (int i = 0; i < GCM_STRIDE; ++i) {
+            _mm_store_si128((__m128i*)k.h_powers[i], p);
+            p = gf_mul(p, h1);
+        }
+    }
+
+    // x = (x ^ block) * H for up to 16 bytes, zero padded
+    AES_TARGET
+    static __m128i ghash_tail(__m128i x, const ui8* data, ui64 len, __m128i h1) {
+        while (len > 0) {
+            ui8 block[AES_BLOCK_BYTES] = {0};
+            ui64 n = len < AES_BLOCK_BYTES ? len : AES_BLOCK_BYTES;
+            memcpy(block, data, n);
+            x = gf_mul(_mm_xor_si128(x, reflect(_mm_loadu_si128((const __m128i*)block))), h1);
+            data += n;
+            len -= n;
+        }
+        return x;
+    }
+
+    // 8 blocks into the hash with one reduction: sum c_i * H^(8-i)
+    AES_TARGET
+    static inline __m128i ghash8(__m128i x, const __m128i* blocks, const AesGcmKey& k) {
+        __m128i lo = _mm_setzero_si128(), mid = _mm_setzero_si128(), hi = _mm_setzero_si128();
+        AES_UNROLL
+        for (int i = 0; i < GCM_STRIDE; ++i) {
+            __m128i c = reflect(_mm_loadu_si128(blocks + i));
+            if (i == 0) c = _mm_xor_si128(c, x);
+            clmul_acc(c, _mm_load_si128((const __m128i*)k.h_powers[GCM_STRIDE - 1 - i]), lo, mid, hi);
+        }
+        return reduce(lo, mid, hi);
+    }
+
+    AES_TARGET
+    static void crypt_ni(ui8* out, ui8* tag, const ui8* in, ui64 len, const ui8* aad, ui64 aad_len,
+                         const AesGcmKey& k, const ui8 iv[GCM_IV_BYTES], bool sealing) {
+        __m128i rk[AES256_ROUNDS + 1];
+        for (int r = 0; r <= AES256_ROUNDS; ++r) {
+            rk[r] = _mm_load_si128((const __m128i*)(k.round_keys + AES_BLOCK_BYTES * r));
+        }
+        const __m128i h1 = _mm_load_si128((const __m128i*)k.h_powers[0]);
+
+        __m128i x = ghash_tail(_mm_setzero_si128(), aad, aad_len, h1);
+
+        ui8 ivb[AES_BLOCK_BYTES] = {0};
+        memcpy(ivb, iv, GCM_IV_BYTES);
+        const __m128i base = _mm_loadu_si128((const __m128i*)ivb);
+        ui32 counter = 2;
+
+        ui64 off = 0;
+        for (; off + GCM_STRIDE * AES_BLOCK_BYTES <= len; off += GCM_STRIDE * AES_BLOCK_BYTES) {
+            const __m128i* src = (const __m128i*)(in + off);
+            __m128i* dst = (__m128i*)(out + off);
+            if (!sealing) x = ghash8(x, src, k);
+
+            __m128i b[GCM_STRIDE];
+            AES_UNROLL
+            for (int i = 0; i < GCM_STRIDE; ++i) {
+                b[i] = _mm_xor_si128(_mm_insert_epi32(base, (int)__builtin_bswap32(counter + i), 3), rk[0]);
+            }
+            AES_UNROLL
+            for (int r = 1; r < AES256_ROUNDS; ++r) {
+                AES_UNROLL
+                for (int i = 0; i < GCM_STRIDE; ++i) b[i] = _mm_aesenc_si128(b[i], rk[r]);
+            }
+            AES_UNROLL
+            for (int i = 0; i < GCM_STRIDE; ++i) {
+                b[i] = _mm_aesenclast_si128(b[i], rk[AES256_ROUNDS]);
+                _mm_storeu_si128(dst + i, _mm_xor_si128(b[i], _mm_loadu_si128(src + i)));
+            }
+            counter += GCM_STRIDE;
+
+            if (sealing) x = ghash8(x, dst, k);
+        }
+
+        for (; off < len; off += AES_BLOCK_BYTES) {
+            ui64 n = len - off < AES_BLOCK_BYTES ? len - off : AES_BLOCK_BYTES;
+            if (!sealing) x = ghash_tail(x, in + off, n, h1);
+            __m128i b = _mm_xor_si128(_mm_insert_epi32(base, (int)__builtin_bswap32(counter), 3), rk[0]);
+            for (int r = 1; r < AES256_ROUNDS; ++r) b = _mm_aesenc_si128(b, rk[r]);
+            b = _mm_aesenclast_si128(b, rk[AES256_ROUNDS]);
+            counter++;
+            ui8 ks[AES_BLOCK_BYTES];
+            _mm_storeu_si128((__m128i*)ks, b);
+            for (ui64 i = 0; i < n; ++i) out[off + i] = in[off + i] ^ ks[i];
+            if (sealing) x = ghash_tail(x, out + off, n, h1);
+        }
+
+        ui8 lengths[AES_BLOCK_BYTES];
+        store_be64(lengths, aad_len * 8);
+        store_be64(lengths + 8, len * 8);
+        x = ghash_tail(x, lengths, sizeof(lengths), h1);
+
+        __m128i j0 = _mm_xor_si128(_mm_insert_epi32(base, (int)__builtin_bswap32(1), 3), rk[0]);
+        for (int r = 1; r < AES256_ROUNDS; ++r) j0 = _mm_aesenc_si128(j0, rk[r]);
+        j0 = _mm_aesenclast_si128(j0, rk[AES256_ROUNDS]);
+        _mm_storeu_si128((__m128i*)tag, _mm_xor_si128(reflect(x), j0));
+    }
+#endif
+};
+
+#endif // AES_GCM_H
@@ -6,54 +6,175 @@
 #include <iostream>
 #include <vector>
 #include <stdexcept>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
 
 typedef uint64_t ui64;
 typedef uint8_t ui8;
 typedef int32_t i32;
 
+#define KiB(n) ((ui64)(n) << 10)
+#define MiB(n) ((ui64)(n) << 20)
+#define GiB(n) ((ui64)(n) << 30)
+
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
 #define ALIGN_UP_POW2(n, p) (((ui64)(n) + ((ui64)(p) - 1)) & (~((ui64)(p) - 1)))
-#define ARENA_BASE_POS (sizeof(MemArena))
+#define ARENA_BASE_POS ALIGN_UP_POW2(sizeof(ArenaBlock), ARENA_ALIGN)
 #define ARENA_ALIGN (sizeof(void*))
+// default address space per block, only committed as it is used
+#define ARENA_DEFAULT_RESERVE MiB(64)
+// commit step, also what clear() keeps committed
+#define ARENA_COMMIT_GRANULE KiB(64)
+// nesting depth before checkpoint() has to grow its stack
+#define ARENA_CHECKPOINT_RESERVE 16
+// per-thread scratch arenas; two so a scratch never aliases the caller's
+#define ARENA_SCRATCH_COUNT 2
+
+// page reserve / commit on top of VirtualAlloc or mmap
+class VirtualMemory {
+public:
+    // address space only, nothing is backed yet. nullptr on failure.
+    static void* reserve(ui64 size) {
+#ifdef _WIN32
+        return VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+        void* p = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        return p == MAP_FAILED ? nullptr : p;
+#endif
+    }
+
+    // freshly committed pages read as zero
+    static bool commit(void* ptr, ui64 size) {
+#ifdef _WIN32
+        return VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+        return mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+    }
+
+    // hands the pages back to the os, the range stays reserved
+    static void decommit(void* ptr, ui64 size) {
+#ifdef _WIN32
+        VirtualFree(ptr, size, MEM_DECOMMIT);
+#else
+        madvise(ptr, size, MADV_DONTNEED);
+        mprotect(ptr, size, PROT_NONE);
+#endif
+    }
+
+    static void release(void* ptr, ui64 size) {
+#ifdef _WIN32
+        (void)size;
+        VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+        munmap(ptr, size);
+#endif
+    }
+};
 
-// fixed-size pool allocator
+// header at the start of every reserved range. base_pos is the arena
+// position the block starts at, so positions keep growing across blocks.
+struct ArenaBlock {
+    ArenaBlock* prev;
+    ui64 reserved;
+    ui64 committed;
+    ui64 base_pos;
+};
+
+// growable stack allocator. each block reserves address space up front and
+// commits it in ARENA_COMMIT_GRANULE steps as push advances; a full block
+// chains a new one instead of overflowing. pop walks back across blocks and
+// clear() returns committed pages to the os.
 class MemArena {
 private:
-    ui8* buffer;
-    ui64 capacity;
+    ArenaBlock* current;
+    ui64 block_reserve;
     ui64 pos;
     std::vector<ui64> checkpoints;
 
-public:
-    // allocate the pool
-    MemArena(ui64 capacity_) : capacity(capacity_), pos(ARENA_BASE_POS), checkpoints() {
-        buffer = (ui8*)malloc(capacity);
-        if (buffer == nullptr) {
-            throw std::runtime_error("Failed to allocate arena buffer!");
+    static ArenaBlock* create_block(ui64 reserve_size, ui64 base_pos) {
+        reserve_size = ALIGN_UP_POW2(reserve_size, ARENA_COMMIT_GRANULE);
+        ui8* base = (ui8*)VirtualMemory::reserve(reserve_size);
+        if (base == nullptr) {
+            throw std::runtime_error("Failed to reserve arena memory!");
         }
-        memset(buffer, 0, capacity);
+        ui64 initial = MIN(ARENA_COMMIT_GRANULE, reserve_size);
+        if (!VirtualMemory::commit(base, initial)) {
+            VirtualMemory::release(base, reserve_size);
+            throw std::runtime_error("Failed to commit arena memory!");
+        }
+        ArenaBlock* block = (ArenaBlock*)base;
+        block->prev = nullptr;
+        block->reserved = reserve_size;
+        block->committed = initial;
+        block->base_pos = base_pos;
+        return block;
+    }
+
+    static void release_block(ArenaBlock* block) {
+        VirtualMemory::release(block, block->reserved);
+    }
+
+    // back `end` bytes of the block with memory
+    static void commit_to(ArenaBlock* block, ui64 end) {
+        ui64 target = MIN(ALIGN_UP_POW2(end, ARENA_COMMIT_GRANULE), block->reserved);
+        if (!VirtualMemory::commit((ui8*)block + block->committed, target - block->committed)) {
+            throw std::overflow_error("Arena commit failed!");
+        }
+        block->committed = target;
+    }
+
+public:
+    // reserve_size is address space per block, not memory in use
+    MemArena(ui64 reserve_size = ARENA_DEFAULT_RESERVE)
+        : current(nullptr), block_reserve(MAX(reserve_size, ARENA_COMMIT_GRANULE)),
+          pos(ARENA_BASE_POS), checkpoints() {
+        checkpoints.reserve(ARENA_CHECKPOINT_RESERVE);
+        current = create_block(block_reserve, 0);
     }
 
     // cleanup
     ~MemArena() {
-        if (buffer != nullptr) {
-            free(buffer);
-            buffer = nullptr;
+        while (current != nullptr) {
+            ArenaBlock* prev = current->prev;
+            release_block(current);
+            current = prev;
         }
         checkpoints.clear();
     }
 
+    MemArena(const MemArena&) = delete;
+    MemArena& operator=(const MemArena&) = delete;
+
     // push--data--onto--stack
     void* push(ui64 size, i32 non_zero = 0) {
-        ui64 pos_aligned = ALIGN_UP_POW2(pos, ARENA_ALIGN);
-        ui64 new_pos = pos_aligned + size;
+        ui64 local = ALIGN_UP_POW2(pos - current->base_pos, ARENA_ALIGN);
+        ui64 end = local + size;
 
-        if (new_pos > capacity) {
-            throw std::overflow_error("Arena overflow!");
+        if (end > current->reserved) {
+            // chain a block big enough for this push
+            ArenaBlock* block = create_block(MAX(block_reserve, ARENA_BASE_POS + size), pos);
+            block->prev = current;
+            current = block;
+            local = ARENA_BASE_POS;
+            end = local + size;
+        }
+        if (end > current->committed) {
+            commit_to(current, end);
         }
 
-        pos = new_pos;
-        ui8* out = buffer + pos_aligned;
+        pos = current->base_pos + end;
+        ui8* out = (ui8*)current + local;
 
         if (!non_zero) {
             memset(out, 0, size);
@@ -62,18 +183,55 @@ public:
         return out;
     }
 
-    // undo allocation
+    // undo allocation, releasing any block popped past
     void pop(ui64 size) {
         size = MIN(size, pos - ARENA_BASE_POS);
-        pos -= size;
+        ui64 target = pos - size;
+        while (current->prev != nullptr && target < current->base_pos + ARENA_BASE_POS) {
+            ArenaBlock* prev = current->prev;
+            release_block(current);
+            current = prev;
+        }
+        pos = target;
+    }
+
+    // remember the current position; restore() rolls back to it. nests,
+    // restores must come in reverse order.
+    void checkpoint() {
+        checkpoints.push_back(pos);
+    }
+
+    void restore() {
+        if (checkpoints.empty()) {
+            throw std::logic_error("Arena restore without checkpoint!");
+        }
+        ui64 mark = checkpoints.back();
+        checkpoints.pop_back();
+        if (pos > mark) {
+            pop(pos - mark);
+        }
+    }
+
+    ui64 get_checkpoint_depth() const {
+        return checkpoints.size();
     }
 
     ui64 get_pos() const {
         return pos;
     }
 
+    // address space reserved across all blocks
     ui64 get_capacity() const {
-        return capacity;
+        ui64 total = 0;
+        for (ArenaBlock* b = current; b != nullptr; b = b->prev) total += b->reserved;
+        return total;
+    }
+
+    // memory actually backed across all blocks
+    ui64 get_committed() const {
+        ui64 total = 0;
+        for (ArenaBlock* b = current; b != nullptr; b = b->prev) total += b->committed;
+        return total;
     }
 
     // how much we used
@@ -81,15 +239,61 @@ public:
         return pos - ARENA_BASE_POS;
     }
 
+    // room left before the next block gets chained
     ui64 get_available() const {
-        return capacity - pos;
+        return current->reserved - (pos - current->base_pos);
     }
 
-    // reset everything
+    // reset everything: drops chained blocks, decommits all but the first
+    // granule of the first one
     void clear() {
-        pos = ARENA_BASE_POS;
+        pop(pos - ARENA_BASE_POS);
+        if (current->committed > ARENA_COMMIT_GRANULE) {
+            VirtualMemory::decommit((ui8*)current + ARENA_COMMIT_GRANULE,
+                                    current->committed - ARENA_COMMIT_GRANULE);
+            current->committed = ARENA_COMMIT_GRANULE;
+        }
         checkpoints.clear();
     }
 };
 
+// checkpoint for the lifetime of the scope: everything pushed inside is
+// popped again on exit, so per-message work runs in constant memory
+class TempArena {
+private:
+    MemArena& target;
+
+public:
+    explicit TempArena(MemArena& arena_) : target(arena_) {
+        target.checkpoint();
+    }
+
+    ~TempArena() {
+        target.restore();
+    }
+
+    TempArena(const TempArena&) = delete;
+    TempArena& operator=(const TempArena&) = delete;
+
+    MemArena& arena() const {
+        return target;
+    }
+};
+
+// this thread's scratch arena, never the one passed as conflict (the arena
+// the caller is building its result in). created on first use.
+inline MemArena& scratch_arena(const MemArena* conflict = nullptr) {
+    thread_local MemArena arenas[ARENA_SCRATCH_COUNT];
+    for (int i = 0; i < ARENA_SCRATCH_COUNT; ++i) {
+        if (&arenas[i] != conflict) return arenas[i];
+    }
+    return arenas[0];
+}
+
+// temp scope over this thread's scratch arena, threads never share one
+class ScratchArena : public TempArena {
+public:
+    explicit ScratchArena(const MemArena* conflict = nullptr) : TempArena(scratch_arena(conflict)) {}
+};
+
 #endif // ARENA_H
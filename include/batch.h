@@ -0,0 +1,184 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "chacha.h"
+#include "poly1305.h"
+
+typedef uint8_t ui8;
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+#define BATCH_CHACHA_LANES 8
+#define BATCH_MAC_LANES 4
+// jobs handled per window, bounds the stack scratch below
+#define BATCH_WINDOW 32
+
+// one (plaintext, key, nonce) tuple for the batch api. seal writes output +
+// mac, open checks mac and sets ok. key may be null when a pre-expanded
+// schedule (Session) is given instead. aad (a frame header, see
+// MessageView::aad) is authenticated, not encrypted.
+struct CryptoJob {
+    const ui8* input;
+    ui8* output;
+    ui64 len;
+    ui8* mac;
+    const ui8* key;
+    const ui32* schedule;
+    const ui8* nonce;
+    const ui8* aad;
+    ui64 aad_len;
+    bool ok;
+
+    CryptoJob() : input(nullptr), output(nullptr), len(0), mac(nullptr), key(nullptr),
+                  schedule(nullptr), nonce(nullptr), aad(nullptr), aad_len(0), ok(false) {}
+};
+
+// multi-buffer chacha20-poly1305. short messages leave most of a simd
+// register idle, so blocks from different messages are packed into the
+// lanes instead: 8 keystream blocks and 4 macs per pass, across jobs.
+class BatchCrypto {
+public:
+    static void seal(CryptoJob* jobs, ui64 count) {
+        for (ui64 i = 0; i < count; i += BATCH_WINDOW) {
+            ui64 n = count - i < BATCH_WINDOW ? count - i : BATCH_WINDOW;
+            run(jobs + i, n, true);
+        }
+    }
+
+    // returns how many jobs failed authentication (their output is untouched)
+    static ui64 open(CryptoJob* jobs, ui64 count) {
+        ui64 failed = 0;
+        for (ui64 i = 0; i < count; i += BATCH_WINDOW) {
+            ui64 n = count - i < BATCH_WINDOW ? count - i : BATCH_WINDOW;
+            run(jobs + i, n, false);
+            for (ui64 j = i; j < i + n; ++j) {
+                if (!jobs[j].ok) failed++;
+            }
+        }
+        return failed;
+    }
+
+private:
+    struct Lane {
+        ui32 job;
+        ui32 block;
+    };
+
+    static void run(CryptoJob* jobs, ui64 n, bool sealing) {
+        ui32 base[BATCH_WINDOW][16];
+        ui8 otk[BATCH_WINDOW][CHACHA_BLOCK_BYTES];
+        for (ui64 j = 0; j < n; ++j) {
+            if (jobs[j].schedule) {
+                memcpy(base[j], jobs[j].schedule, sizeof(base[j]));
+                ChaCha20::set_iv(base[j], jobs[j].nonce);
+            } else {
+                ChaCha20::init_state(base[j], jobs[j].key, jobs[j].nonce);
+            }
+            jobs[j].ok = true;
+        }
+
+        // block 0 of every job is its poly1305 key
+        ui32 lane_states[BATCH_CHACHA_LANES][16];
+        ui8 ks[BATCH_CHACHA_LANES * CHACHA_BLOCK_BYTES];
+        for (ui64 j = 0; j < n; j += BATCH_CHACHA_LANES) {
+            int lanes = (int)(n - j < BATCH_CHACHA_LANES ? n - j : BATCH_CHACHA_LANES);
+            for (int k = 0; k < lanes; ++k) {
+                memcpy(lane_states[k], base[j + k], sizeof(lane_states[k]));
+            }
+            ChaCha20::multi_block(ks, lane_states, lanes);
+            for (int k = 0; k < lanes; ++k) {
+                memcpy(otk[j + k], ks + CHACHA_BLOCK_BYTES * k, CHACHA_BLOCK_BYTES);
+            }
+        }
+
+        if (!sealing) {
+            macs(jobs, n, otk, false);
+        }
+        payload(jobs, n, base, lane_states, ks);
+        if (sealing) {
+            macs(jobs, n, otk, true);
+        }
+
+        memset(base, 0, sizeof(base));
+        memset(otk, 0, sizeof(otk));
+        memset(lane_states, 0, sizeof(lane_states));
+        memset(ks, 0, sizeof(ks));
+    }
+
+    // payload blocks 1..n of all jobs, flattened and packed 8 to a pass
+    static void payload(CryptoJob* jobs, ui64 n, ui32 base[][16],
+                        ui32 lane_states[][16], ui8* ks) {
+        Lane lane[BATCH_CHACHA_LANES];
+        int used = 0;
+        for (ui64 j = 0; j < n; ++j) {
+            if (!jobs[j].ok) continue;
+            ui64 blocks = (jobs[j].len + CHACHA_BLOCK_BYTES - 1) / CHACHA_BLOCK_BYTES;
+            for (ui64 b = 1; b <= blocks; ++b) {
+                memcpy(lane_states[used], base[j], 16 * sizeof(ui32));
+                lane_states[used][12] += (ui32)b;
+                lane[used].job = (ui32)j;
+                lane[used].block = (ui32)b;
+                if (++used == BATCH_CHACHA_LANES) {
+                    apply(jobs, lane, used, lane_states, ks);
+                    used = 0;
+                }
+            }
+        }
+        if (used) {
+            apply(jobs, lane, used, lane_states, ks);
+        }
+    }
+
+    static void apply(CryptoJob* jobs, const Lane* lane, int used,
+                      ui32 lane_states[][16], ui8* ks) {
+        ChaCha20::multi_block(ks, lane_states, used);
+        for (int k = 0; k < used; ++k) {
+            CryptoJob& job = jobs[lane[k].job];
+            ui64 off = (ui64)(lane[k].block - 1) * CHACHA_BLOCK_BYTES;
+            ui64 len = job.len - off < CHACHA_BLOCK_BYTES ? job.len - off : CHACHA_BLOCK_BYTES;
+            const ui8* src = ks + CHACHA_BLOCK_BYTES * k;
+            for (ui64 i = 0; i < len; ++i) {
+                job.output[off + i] = job.input[off + i] ^ src[i];
+            }
+        }
+    }
+
+    // sorted by length so lanes sharing a mac pass finish close together
+    static void macs(CryptoJob* jobs, ui64 n, ui8 otk[][CHACHA_BLOCK_BYTES], bool sealing) {
+        ui32 order[BATCH_WINDOW];
+        for (ui64 j = 0; j < n; ++j) order[j] = (ui32)j;
+        std::sort(order, order + n, [jobs](ui32 a, ui32 b) { return jobs[a].len < jobs[b].len; });
+
+        ui8 tags[BATCH_MAC_LANES][POLY1305_MAC_BYTES];
+        for (ui64 i = 0; i < n; i += BATCH_MAC_LANES) {
+            int lanes = (int)(n - i < BATCH_MAC_LANES ? n - i : BATCH_MAC_LANES);
+            ui8* out[BATCH_MAC_LANES];
+            const ui8* keys[BATCH_MAC_LANES];
+            const ui8* aads[BATCH_MAC_LANES];
+            ui64 aad_lens[BATCH_MAC_LANES];
+            const ui8* cts[BATCH_MAC_LANES];
+            ui64 lens[BATCH_MAC_LANES];
+            for (int k = 0; k < lanes; ++k) {
+                CryptoJob& job = jobs[order[i + k]];
+                out[k] = sealing ? job.mac : tags[k];
+                keys[k] = otk[order[i + k]];
+                aads[k] = job.aad;
+                aad_lens[k] = job.aad_len;
+                cts[k] = sealing ? job.output : job.input;
+                lens[k] = job.len;
+            }
+            Poly1305::aead_tags_x4(out, keys, aads, aad_lens, cts, lens, lanes);
+            if (!sealing) {
+                for (int k = 0; k < lanes; ++k) {
+                    jobs[order[i + k]].ok = Poly1305::verify(tags[k], jobs[order[i + k]].mac);
+                }
+            }
+        }
+        memset(tags, 0, sizeof(tags));
+    }
+};
+
+#endif // BATCH_H
@@ -0,0 +1,397 @@
+#ifndef CHACHA_H
+#define CHACHA_H
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CHACHA_X86_SIMD 1
+#define CHACHA_TARGET(t) __attribute__((target(t)))
+#else
+#define CHACHA_X86_SIMD 0
+#define CHACHA_TARGET(t)
+#endif
+
+typedef uint8_t ui8;
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+#define CHACHA_BLOCK_BYTES 64
+#define CHACHA_KEY_BYTES 32
+// iv = le32 block counter || 96-bit nonce (rfc 8439 words 12..15)
+#define CHACHA_IV_BYTES 16
+
+enum ChaChaKernel {
+    CHACHA_KERNEL_SCALAR = 0,
+    CHACHA_KERNEL_SSE2 = 1,
+    CHACHA_KERNEL_AVX2 = 2,
+};
+
+// processes `blocks` whole blocks starting at state[12], advances state[12].
+// in == nullptr writes raw keystream instead of xoring.
+typedef void (*ChaChaBlocksFn)(ui8* out, const ui8* in, ui64 blocks, ui32 state[16]);
+
+// counter-mode chacha20 keystream with scalar/sse2/avx2 kernels
+class ChaCha20 {
+public:
+    static inline ui32 load32(const ui8* p) {
+        return (ui32)p[0] | ((ui32)p[1] << 8) | ((ui32)p[2] << 16) | ((ui32)p[3] << 24);
+    }
+
+    static inline void store32(ui8* p, ui32 v) {
+        p[0] = (ui8)v;
+        p[1] = (ui8)(v >> 8);
+        p[2] = (ui8)(v >> 16);
+        p[3] = (ui8)(v >> 24);
+    }
+
+    static inline ui32 rotl32(ui32 v, int n) {
+        return (v << n) | (v >> (32 - n));
+    }
+
+    // expand key + iv into the 16-word input block
+    static void init_state(ui32 state[16], const ui8* key, const ui8* iv) {
+        state[0] = 0x61707865;
+        state[1] = 0x3320646e;
+        state[2] = 0x79622d32;
+        state[3] = 0x6b206574;
+        for (int i = 0; i < 8; ++i) {
+            state[4 + i] = load32(key + 4 * i);
+        }
+        set_iv(state, iv);
+    }
+
+    static void set_iv(ui32 state[16], const ui8* iv) {
+        for (int i = 0; i < 4; ++i) {
+            state[12 + i] = load32(iv + 4 * i);
+        }
+    }
+
+    // one block of keystream from an arbitrary input state
+    static void block(ui8 out[CHACHA_BLOCK_BYTES], const ui32 state[16]) {
+        ui32 x[16];
+        memcpy(x, state, sizeof(x));
+        rounds(x);
+        for (int i = 0; i < 16; ++i) {
+            store32(out + 4 * i, x[i] + state[i]);
+        }
+    }
+
+    // hchacha20: 32-byte subkey from a key and 16 bytes of input. used to
+    // turn a raw dh output into a uniform session key.
+    static void hchacha(ui8 out[CHACHA_KEY_BYTES], const ui8* key, const ui8 in[16]) {
+        ui32 x[16];
+        init_state(x, key, in);
+        rounds(x);
+        for (int i = 0; i < 4; ++i) {
+            store32(out + 4 * i, x[i]);
+            store32(out + 16 + 4 * i, x[12 + i]);
+        }
+        memset(x, 0, sizeof(x));
+    }
+
+    // encrypt == decrypt. state[12] is the first block counter and is advanced.
+    static void xor_stream(ui8* out, const ui8* in, ui64 len, ui32 state[16]) {
+        ui64 blocks = len / CHACHA_BLOCK_BYTES;
+        if (blocks) {
+            blocks_fn()(out, in, blocks, state);
+            ui64 done = blocks * CHACHA_BLOCK_BYTES;
+            out += done;
+            if (in) in += done;
+            len -= done;
+        }
+        if (len) {
+            ui8 ks[CHACHA_BLOCK_BYTES];
+            block(ks, state);
+            state[12]++;
+            for (ui64 i = 0; i < len; ++i) {
+                out[i] = in ? (ui8)(in[i] ^ ks[i]) : ks[i];
+            }
+            memset(ks, 0, sizeof(ks));
+        }
+    }
+
+    static void xor_stream(ui8* out, const ui8* in, ui64 len, const ui8* key, const ui8* iv) {
+        ui32 state[16];
+        init_state(state, key, iv);
+        xor_stream(out, in, len, state);
+        memset(state, 0, sizeof(state));
+    }
+
+    // one block from each of up to 8 unrelated input states (batch api).
+    // out must have room for 8 blocks; lane k lands at out + 64 * k.
+    static void multi_block(ui8* out, const ui32 (*states)[16], int lanes) {
+#if CHACHA_X86_SIMD
+        if (lanes > 1 && active_kernel() == CHACHA_KERNEL_AVX2) {
+            multi_block_avx2(out, states, lanes);
+            return;
+        }
+#endif
+        for (int k = 0; k < lanes; ++k) {
+            block(out + CHACHA_BLOCK_BYTES * k, states[k]);
+        }
+    }
+
+    static ChaChaKernel detect_kernel() {
+#if CHACHA_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return CHACHA_KERNEL_AVX2;
+        if (__builtin_cpu_supports("sse2")) return CHACHA_KERNEL_SSE2;
+#endif
+        return CHACHA_KERNEL_SCALAR;
+    }
+
+    static ChaChaBlocksFn kernel_fn(ChaChaKernel k) {
+        switch (k) {
+#if CHACHA_X86_SIMD
+        case CHACHA_KERNEL_AVX2: return blocks_avx2;
+        case CHACHA_KERNEL_SSE2: return blocks_sse2;
+#endif
+        default: return blocks_scalar;
+        }
+    }
+
+    static ChaChaKernel& active_kernel() {
+        static ChaChaKernel kernel = detect_kernel();
+        return kernel;
+    }
+
+    // pin a kernel (benchmarks / tests). falls back to scalar if unsupported.
+    static void force_kernel(ChaChaKernel k) {
+        active_kernel() = (k <= detect_kernel()) ? k : CHACHA_KERNEL_SCALAR;
+        blocks_fn() = kernel_fn(active_kernel());
+    }
+
+    static const char* kernel_name(ChaChaKernel k) {
+        switch (k) {
+        case CHACHA_KERNEL_AVX2: return "avx2";
+        case CHACHA_KERNEL_SSE2: return "sse2";
+        default: return "scalar";
+        }
+    }
+
+    static ChaChaBlocksFn& blocks_fn() {
+        static ChaChaBlocksFn fn = kernel_fn(active_kernel());
+        return fn;
+    }
+
+    static void blocks_scalar(ui8* out, const ui8* in, ui64 blocks, ui32 state[16]) {
+        ui8 ks[CHACHA_BLOCK_BYTES];
+        for (ui64 b = 0; b < blocks; ++b) {
+            block(ks, state);
+            state[12]++;
+            if (in) {
+                for (int i = 0; i < CHACHA_BLOCK_BYTES; ++i) {
+                    out[i] = in[i] ^ ks[i];
+                }
+                in += CHACHA_BLOCK_BYTES;
+            } else {
+                memcpy(out, ks, CHACHA_BLOCK_BYTES);
+            }
+            out += CHACHA_BLOCK_BYTES;
+        }
+        memset(ks, 0, sizeof(ks));
+    }
+
+#if CHACHA_X86_SIMD
+    // 4 blocks per iteration, one block per 32-bit lane
+    CHACHA_TARGET("sse2")
+    static void blocks_sse2(ui8* out, const ui8* in, ui64 blocks, ui32 state[16]) {
+        while (blocks >= 4) {
+            __m128i s[16], x[16];
+            for (int i = 0; i < 16; ++i) {
+                s[i] = _mm_set1_epi32((int)state[i]);
+            }
+            s[12] = _mm_add_epi32(s[12], _mm_set_epi32(3, 2, 1, 0));
+            for (int i = 0; i < 16; ++i) x[i] = s[i];
+
+            for (int r = 0; r < 10; ++r) {
+                sse_quarter_round(x[0], x[4], x[8], x[12]);
+                sse_quarter_round(x[1], x[5], x[9], x[13]);
+                sse_quarter_round(x[2], x[6], x[10], x[14]);
+                sse_quarter_round(x[3], x[7], x[11], x[15]);
+                sse_quarter_round(x[0], x[5], x[10], x[15]);
+                sse_quarter_round(x[1], x[6], x[11], x[12]);
+                sse_quarter_round(x[2], x[7], x[8], x[13]);
+                sse_quarter_round(x[3], x[4], x[9], x[14]);
+            }
+            for (int i = 0; i < 16; ++i) x[i] = _mm_add_epi32(x[i], s[i]);
+
+            // transpose 4x4 word groups so each lane becomes a contiguous block
+            for (int g = 0; g < 16; g += 4) {
+                __m128i a0 = _mm_unpacklo_epi32(x[g], x[g + 1]);
+                __m128i a1 = _mm_unpackhi_epi32(x[g], x[g + 1]);
+                __m128i a2 = _mm_unpacklo_epi32(x[g + 2], x[g + 3]);
+                __m128i a3 = _mm_unpackhi_epi32(x[g + 2], x[g + 3]);
+                __m128i b[4];
+                b[0] = _mm_unpacklo_epi64(a0, a2);
+                b[1] = _mm_unpackhi_epi64(a0, a2);
+                b[2] = _mm_unpacklo_epi64(a1, a3);
+                b[3] = _mm_unpackhi_epi64(a1, a3);
+                for (int k = 0; k < 4; ++k) {
+                    ui64 off = 64 * k + 4 * g;
+                    if (in) {
+                        b[k] = _mm_xor_si128(b[k], _mm_loadu_si128((const __m128i*)(in + off)));
+                    }
+                    _mm_storeu_si128((__m128i*)(out + off), b[k]);
+                }
+            }
+
+            state[12] += 4;
+            out += 4 * CHACHA_BLOCK_BYTES;
+            if (in) in += 4 * CHACHA_BLOCK_BYTES;
+            blocks -= 4;
+        }
+        blocks_scalar(out, in, blocks, state);
+    }
+
+    // 8 blocks per iteration, one block per 32-bit lane
+    CHACHA_TARGET("avx2")
+    static void blocks_avx2(ui8* out, const ui8* in, ui64 blocks, ui32 state[16]) {
+        while (blocks >= 8) {
+            __m256i s[16], x[16];
+            for (int i = 0; i < 16; ++i) {
+                s[i] = _mm256_set1_epi32((int)state[i]);
+            }
+            s[12] = _mm256_add_epi32(s[12], _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+            for (int i = 0; i < 16; ++i) x[i] = s[i];
+
+            for (int r = 0; r < 10; ++r) {
+                avx2_quarter_round(x[0], x[4], x[8], x[12]);
+                avx2_quarter_round(x[1], x[5], x[9], x[13]);
+                avx2_quarter_round(x[2], x[6], x[10], x[14]);
+                avx2_quarter_round(x[3], x[7], x[11], x[15]);
+                avx2_quarter_round(x[0], x[5], x[10], x[15]);
+                avx2_quarter_round(x[1], x[6], x[11], x[12]);
+                avx2_quarter_round(x[2], x[7], x[8], x[13]);
+                avx2_quarter_round(x[3], x[4], x[9], x[14]);
+            }
+            for (int i = 0; i < 16; ++i) x[i] = _mm256_add_epi32(x[i], s[i]);
+
+            store_lanes_avx2(out, in, x);
+
+            state[12] += 8;
+            out += 8 * CHACHA_BLOCK_BYTES;
+            if (in) in += 8 * CHACHA_BLOCK_BYTES;
+            blocks -= 8;
+        }
+        blocks_sse2(out, in, blocks, state);
+    }
+
+    CHACHA_TARGET("avx2")
+    static void multi_block_avx2(ui8* out, const ui32 (*states)[16], int lanes) {
+        const ui32* st[8];
+        for (int k = 0; k < 8; ++k) {
+            st[k] = states[k < lanes ? k : 0];
+        }
+        __m256i s[16], x[16];
+        for (int w = 0; w < 16; ++w) {
+            s[w] = _mm256_setr_epi32((int)st[0][w], (int)st[1][w], (int)st[2][w], (int)st[3][w],
+                                     (int)st[4][w], (int)st[5][w], (int)st[6][w], (int)st[7][w]);
+            x[w] = s[w];
+        }
+        for (int r = 0; r < 10; ++r) {
+            avx2_quarter_round(x[0], x[4], x[8], x[12]);
+            avx2_quarter_round(x[1], x[5], x[9], x[13]);
+            avx2_quarter_round(x[2], x[6], x[10], x[14]);
+            avx2_quarter_round(x[3], x[7], x[11], x[15]);
+            avx2_quarter_round(x[0], x[5], x[10], x[15]);
+            avx2_quarter_round(x[1], x[6], x[11], x[12]);
+            avx2_quarter_round(x[2], x[7], x[8], x[13]);
+            avx2_quarter_round(x[3], x[4], x[9], x[14]);
+        }
+        for (int w = 0; w < 16; ++w) x[w] = _mm256_add_epi32(x[w], s[w]);
+        store_lanes_avx2(out, nullptr, x);
+    }
+
+    // x[w] holds word w of 8 independent blocks; writes lane k to out + 64*k
+    CHACHA_TARGET("avx2")
+    static void store_lanes_avx2(ui8* out, const ui8* in, const __m256i x[16]) {
+        __m256i b[4][4];
+        for (int g = 0; g < 4; ++g) {
+            __m256i a0 = _mm256_unpacklo_epi32(x[4 * g], x[4 * g + 1]);
+            __m256i a1 = _mm256_unpackhi_epi32(x[4 * g], x[4 * g + 1]);
+            __m256i a2 = _mm256_unpacklo_epi32(x[4 * g + 2], x[4 * g + 3]);
+            __m256i a3 = _mm256_unpackhi_epi32(x[4 * g + 2], x[4 * g + 3]);
+            // b[g][k]: words 4g..4g+3 of lane k (low half) and lane k+4 (high half)
+            b[g][0] = _mm256_unpacklo_epi64(a0, a2);
+            b[g][1] = _mm256_unpackhi_epi64(a0, a2);
+            b[g][2] = _mm256_unpacklo_epi64(a1, a3);
+            b[g][3] = _mm256_unpackhi_epi64(a1, a3);
+        }
+        for (int k = 0; k < 4; ++k) {
+            __m256i lo_k = _mm256_permute2x128_si256(b[0][k], b[1][k], 0x20);
+            __m256i hi_k = _mm256_permute2x128_si256(b[2][k], b[3][k], 0x20);
+            __m256i lo_k4 = _mm256_permute2x128_si256(b[0][k], b[1][k], 0x31);
+            __m256i hi_k4 = _mm256_permute2x128_si256(b[2][k], b[3][k], 0x31);
+            ui8* o = out + 64 * k;
+            ui8* o4 = out + 64 * (k + 4);
+            if (in) {
+                const ui8* p = in + 64 * k;
+                const ui8* p4 = in + 64 * (k + 4);
+                lo_k = _mm256_xor_si256(lo_k, _mm256_loadu_si256((const __m256i*)p));
+                hi_k = _mm256_xor_si256(hi_k, _mm256_loadu_si256((const __m256i*)(p + 32)));
+                lo_k4 = _mm256_xor_si256(lo_k4, _mm256_loadu_si256((const __m256i*)p4));
+                hi_k4 = _mm256_xor_si256(hi_k4, _mm256_loadu_si256((const __m256i*)(p4 + 32)));
+            }
+            _mm256_storeu_si256((__m256i*)o, lo_k);
+            _mm256_storeu_si256((__m256i*)(o + 32), hi_k);
+            _mm256_storeu_si256((__m256i*)o4, lo_k4);
+            _mm256_storeu_si256((__m256i*)(o4 + 32), hi_k4);
+        }
+    }
+#endif
+
+private:
+    static inline void quarter_round(ui32& a, ui32& b, ui32& c, ui32& d) {
+        a += b; d ^= a; d = rotl32(d, 16);
+        c += d; b ^= c; b = rotl32(b, 12);
+        a += b; d ^= a; d = rotl32(d, 8);
+        c += d; b ^= c; b = rotl32(b, 7);
+    }
+
+    static inline void rounds(ui32 x[16]) {
+        for (int r = 0; r < 10; ++r) {
+            quarter_round(x[0], x[4], x[8], x[12]);
+            quarter_round(x[1], x[5], x[9], x[13]);
+            quarter_round(x[2], x[6], x[10], x[14]);
+            quarter_round(x[3], x[7], x[11], x[15]);
+            quarter_round(x[0], x[5], x[10], x[15]);
+            quarter_round(x[1], x[6], x[11], x[12]);
+            quarter_round(x[2], x[7], x[8], x[13]);
+            quarter_round(x[3], x[4], x[9], x[14]);
+        }
+    }
+
+#if CHACHA_X86_SIMD
+    CHACHA_TARGET("sse2")
+    static inline __m128i sse_rotl(__m128i v, int n) {
+        return _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - n));
+    }
+
+    CHACHA_TARGET("sse2")
+    static inline void sse_quarter_round(__m128i& a, __m128i& b, __m128i& c, __m128i& d) {
+        a = _mm_add_epi32(a, b); d = sse_rotl(_mm_xor_si128(d, a), 16);
+        c = _mm_add_epi32(c, d); b = sse_rotl(_mm_xor_si128(b, c), 12);
+        a = _mm_add_epi32(a, b); d = sse_rotl(_mm_xor_si128(d, a), 8);
+        c = _mm_add_epi32(c, d); b = sse_rotl(_mm_xor_si128(b, c), 7);
+    }
+
+    CHACHA_TARGET("avx2")
+    static inline void avx2_quarter_round(__m256i& a, __m256i& b, __m256i& c, __m256i& d) {
+        const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                               2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+        const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                              3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+        a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot16);
+        c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c);
+        b = _mm256_or_si256(_mm256_slli_epi32(b, 12), _mm256_srli_epi32(b, 20));
+        a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot8);
+        c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c);
+        b = _mm256_or_si256(_mm256_slli_epi32(b, 7), _mm256_srli_epi32(b, 25));
+    }
+#endif
+};
+
+#endif // CHACHA_H
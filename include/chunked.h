@@ -0,0 +1,244 @@
+#ifndef CHUNKED_H
+#define CHUNKED_H
+
+#include <cstdint>
+#include <cstring>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "crypto.h"
+#include "session.h"
+#include "thread_pool.h"
+
+typedef uint8_t ui8;
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+#define CHUNK_DEFAULT_BYTES (64 * 1024)
+#define CHUNK_HEADER_BYTES (CHACHA_IV_BYTES + 4)
+// chunks in flight per worker thread, bounds memory to ~2 * window * chunk
+#define CHUNK_WINDOW_PER_THREAD 2
+
+// large payloads as a stream of independently sealed chunks.
+//
+//   stream  = base nonce (16) | le32 chunk size | chunk* | final chunk
+//   chunk   = ciphertext (chunk size) | tag (16)
+//   final   = ciphertext (< chunk size, may be empty) | tag (16)
+//
+// each stream gets its own subkey (keystream block 0 of the session key at
+// the base nonce). chunk i is sealed under nonce (0 | le64 i | le32 final),
+// so chunks can't be reordered, dropped or the stream cut short undetected.
+// chunks are sealed on a thread pool and written to the sink in order.
+class ChunkedCipher {
+public:
+    // fills up to cap bytes, returns how many; 0 means end of input
+    typedef std::function<ui64(ui8* buf, ui64 cap)> Source;
+    typedef std::function<bool(const ui8* data, ui64 len)> Sink;
+
+private:
+    enum SlotState { SLOT_FREE, SLOT_BUSY, SLOT_DONE };
+
+    struct Slot {
+        std::vector<ui8> in;
+        std::vector<ui8> out;
+        ui64 len;
+        ui64 index;
+        bool final_chunk;
+        bool ok;
+        SlotState state;
+    };
+
+    ThreadPool pool;
+    ui64 chunk_bytes;
+    std::vector<Slot> slots;
+    std::mutex lock;
+    std::condition_variable done;
+
+public:
+    explicit ChunkedCipher(ui32 threads = 0, ui64 chunk_bytes_ = CHUNK_DEFAULT_BYTES)
+        : pool(threads), chunk_bytes(chunk_bytes_) {
+        slots.resize((ui64)pool.size() * CHUNK_WINDOW_PER_THREAD);
+        for (auto& s : slots) {
+            s.in.resize(chunk_bytes + POLY1305_MAC_BYTES);
+            s.out.resize(chunk_bytes + POLY1305_MAC_BYTES);
+            s.state = SLOT_FREE;
+        }
+    }
+
+    bool encrypt(Session& session, const Source& source, const Sink& sink) {
+        ui8 header[CHUNK_HEADER_BYTES];
+        session.next_nonce(header);
+        ChaCha20::store32(header + CHACHA_IV_BYTES, (ui32)chunk_bytes);
+        if (!sink(header, sizeof(header))) return false;
+
+        ui32 stream_schedule[16];
+        derive_stream(stream_schedule, session, header);
+        bool ok = run(stream_schedule, source, sink, true);
+        memset(stream_schedule, 0, sizeof(stream_schedule));
+        return ok;
+    }
+
+    // false on a bad header, truncated stream or failed chunk. chunks before
+    // the failure have already gone to the sink, so callers must discard
+    // everything they got when this returns false.
+    bool decrypt(const Session& session, const Source& source, const Sink& sink) {
+        ui8 header[CHUNK_HEADER_BYTES];
+        if (read_full(source, header, sizeof(header)) != sizeof(header)) return false;
+        if (ChaCha20::load32(header + CHACHA_IV_BYTES) != chunk_bytes) return false;
+
+        ui32 stream_schedule[16];
+        derive_stream(stream_schedule, session, header);
+        bool ok = run(stream_schedule, source, sink, false);
+        memset(stream_schedule, 0, sizeof(stream_schedule));
+        return ok;
+    }
+
+    // in-memory convenience wrappers
+    bool encrypt(Session& session, const ui8* data, ui64 len, const Sink& sink) {
+        return encrypt(session, memory_source(data, len), sink);
+    }
+
+    bool decrypt(const Session& session, const ui8* data, ui64 len, const Sink& sink) {
+        return decrypt(session, memory_source(data, len), sink);
+    }
+
+    static ui64 sealed_size(ui64 len, ui64 chunk_bytes_ = CHUNK_DEFAULT_BYTES) {
+        return CHUNK_HEADER_BYTES + len + (len / chunk_bytes_ + 1) * POLY1305_MAC_BYTES;
+    }
+
+    ui64 get_chunk_bytes() const {
+        return chunk_bytes;
+    }
+
+    ui32 get_threads() const {
+        return pool.size();
+    }
+
+private:
+    static Source memory_source(const ui8* data, ui64 len) {
+        ui64 pos = 0;
+        return [data, len, pos](ui8* buf, ui64 cap) mutable -> ui64 {
+            ui64 n = len - pos < cap ? len - pos : cap;
+            memcpy(buf, data + pos, n);
+            pos += n;
+            return n;
+        };
+    }
+
+    static ui64 read_full(const Source& source, ui8* buf, ui64 cap) {
+        ui64 got = 0;
+        while (got < cap) {
+            ui64 n = source(buf + got, cap - got);
+            if (n == 0) break;
+            got += n;
+        }
+        return got;
+    }
+
+    static void derive_stream(ui32 out[16], const Session& session, const ui8* base_nonce) {
+        ui32 state[16];
+        ui8 block[CHACHA_BLOCK_BYTES];
+        // from the raw session key, so streams work whatever suite the
+        // session negotiated for messages
+        ChaCha20::init_state(state, session.get_key(), base_nonce);
+        ChaCha20::block(block, state);
+        ui8 zero_iv[CHACHA_IV_BYTES] = {0};
+        ChaCha20::init_state(out, block, zero_iv);
+        memset(block, 0, sizeof(block));
+        memset(state, 0, sizeof(state));
+    }
+
+    static void chunk_nonce(ui8 nonce[CHACHA_IV_BYTES], ui64 index, bool final_chunk) {
+        memset(nonce, 0, 4);
+        for (int i = 0; i < 8; ++i) {
+            nonce[4 + i] = (ui8)(index >> (8 * i));
+        }
+        ChaCha20::store32(nonce + 12, final_chunk ? 1 : 0);
+    }
+
+    void process(Slot& slot, const ui32* schedule, bool sealing) {
+        ui8 nonce[CHACHA_IV_BYTES];
+        chunk_nonce(nonce, slot.index, slot.final_chunk);
+        if (sealing) {
+            SimpleCrypto::seal_expanded(slot.out.data(), slot.out.data() + slot.len, slot.in.data(), slot.len,
+                                        nullptr, 0, schedule, nonce);
+            slot.len += POLY1305_MAC_BYTES;
+            slot.ok = true;
+        } else {
+            slot.ok = SimpleCrypto::open_expanded(slot.out.data(), slot.in.data(), slot.len,
+                                                  slot.in.data() + slot.len, nullptr, 0, schedule, nonce);
+        }
+    }
+
+    bool run(const ui32* schedule, const Source& source, const Sink& sink, bool sealing) {
+        const ui64 window = slots.size();
+        const ui64 read_cap = sealing ? chunk_bytes : chunk_bytes + POLY1305_MAC_BYTES;
+        ui64 next_in = 0, next_out = 0;
+        bool input_done = false, ok = true, saw_final = false;
+
+        while (ok && (!input_done || next_out < next_in)) {
+            // keep the window full
+            while (!input_done && next_in - next_out < window) {
+                Slot& slot = slots[next_in % window];
+                ui64 got = read_full(source, slot.in.data(), read_cap);
+                if (!sealing && got < POLY1305_MAC_BYTES) {
+                    // nothing after a full chunk means the final chunk was cut off
+                    ok = false;
+                    input_done = true;
+                    break;
+                }
+                slot.final_chunk = got < read_cap;
+                slot.len = sealing ? got : got - POLY1305_MAC_BYTES;
+                slot.index = next_in;
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    slot.state = SLOT_BUSY;
+                }
+                pool.submit([this, &slot, schedule, sealing] {
+                    process(slot, schedule, sealing);
+                    std::lock_guard<std::mutex> guard(lock);
+                    slot.state = SLOT_DONE;
+                    done.notify_all();
+                });
+                next_in++;
+                if (slot.final_chunk) {
+                    input_done = true;
+                    saw_final = true;
+                    ui8 extra;
+                    if (!sealing && source(&extra, 1) != 0) {
+                        ok = false; // trailing bytes after the final chunk
+                    }
+                }
+            }
+            if (next_out == next_in) break;
+
+            // drain in order
+            Slot& slot = slots[next_out % window];
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                done.wait(guard, [&slot] { return slot.state == SLOT_DONE; });
+                slot.state = SLOT_FREE;
+            }
+            if (!slot.ok || !sink(slot.out.data(), slot.len)) {
+                ok = false;
+            }
+            next_out++;
+        }
+
+        // let in-flight chunks finish before their slots can be reused
+        for (ui64 i = next_out; i < next_in; ++i) {
+            Slot& slot = slots[i % window];
+            std::unique_lock<std::mutex> guard(lock);
+            done.wait(guard, [&slot] { return slot.state == SLOT_DONE; });
+            slot.state = SLOT_FREE;
+        }
+        for (auto& s : slots) {
+            memset(s.in.data(), 0, s.in.size());
+            memset(s.out.data(), 0, s.out.size());
+        }
+        return ok && saw_final;
+    }
+};
+
+#endif // CHUNKED_H
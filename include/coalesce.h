@@ -0,0 +1,188 @@
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "frame.h"
+#include "message_view.h"
+#include "net.h"
+
+typedef uint8_t ui8;
+typedef uint64_t ui64;
+
+#define COALESCE_DEFAULT_FLUSH_BYTES (16 * 1024)
+#define COALESCE_DEFAULT_DEADLINE_US 200
+// a quiet connection keeps at most this much batch buffer around
+#define COALESCE_IDLE_KEEP_BYTES 4096
+
+// deadline_us == 0 turns coalescing off: every frame is its own write
+struct CoalesceConfig {
+    ui64 flush_bytes;
+    ui64 deadline_us;
+
+    CoalesceConfig(ui64 flush_bytes_ = COALESCE_DEFAULT_FLUSH_BYTES,
+                   ui64 deadline_us_ = COALESCE_DEFAULT_DEADLINE_US)
+        : flush_bytes(flush_bytes_), deadline_us(deadline_us_) {}
+};
+
+struct CoalesceStats {
+    ui64 frames;
+    ui64 writes;
+    ui64 bytes;
+    ui64 size_flushes;
+    ui64 deadline_flushes;
+
+    CoalesceStats() : frames(0), writes(0), bytes(0), size_flushes(0), deadline_flushes(0) {}
+
+    // frames per write, 1.0 means no batching happened
+    double ratio() const {
+        return writes ? (double)frames / (double)writes : 0.0;
+    }
+};
+
+// packs encrypted frames bound for one socket into a single buffer and
+// writes it out once it reaches flush_bytes or the oldest pending frame is
+// deadline_us old, whichever comes first. a background thread handles the
+// deadline so a lone frame never waits longer than that.
+class FrameCoalescer {
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    socket_t sock;
+    CoalesceConfig config;
+    std::vector<ui8> pending;
+    Clock::time_point deadline;
+    bool armed;
+    bool stopping;
+    bool failed;
+    CoalesceStats stats;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::thread flusher;
+
+public:
+    explicit FrameCoalescer(CoalesceConfig config_ = CoalesceConfig())
+        : sock((socket_t)0), config(config_), armed(false), stopping(false), failed(false) {}
+
+    ~FrameCoalescer() {
+        stop();
+    }
+
+    FrameCoalescer(const FrameCoalescer&) = delete;
+    FrameCoalescer& operator=(const FrameCoalescer&) = delete;
+
+    // attach to a connected socket and start the deadline thread. the batch
+    // buffer grows with the first frames, not up front.
+    void start(socket_t sock_) {
+        sock = sock_;
+        if (!enabled()) return;
+        flusher = std::thread([this] { flush_loop(); });
+    }
+
+    // flushes whatever is pending and stops the deadline thread
+    void stop() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (stopping) return;
+            stopping = true;
+            flush_locked();
+        }
+        wake.notify_all();
+        if (flusher.joinable()) {
+            flusher.join();
+        }
+    }
+
+    bool enabled() const {
+        return config.deadline_us != 0;
+    }
+
+    // queues header + ciphertext. false once a write to the socket failed.
+    bool push(const MessageView& view) {
+        if (!enabled()) {
+            bool ok = Frame::send(sock, view);
+            std::lock_guard<std::mutex> guard(lock);
+            ++stats.frames;
+            ++stats.writes;
+            stats.bytes += FRAME_HEADER_BYTES + view.body.len;
+            return ok;
+        }
+
+        bool notify = false;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (failed) return false;
+
+            ui64 off = pending.size();
+            pending.resize(off + FRAME_HEADER_BYTES + view.body.len);
+            Frame::encode(pending.data() + off, view);
+            memcpy(pending.data() + off + FRAME_HEADER_BYTES, view.body.data, view.body.len);
+            ++stats.frames;
+
+            if (pending.size() >= config.flush_bytes) {
+                ++stats.size_flushes;
+                flush_locked();
+            } else if (!armed) {
+                deadline = Clock::now() + std::chrono::microseconds(config.deadline_us);
+                armed = true;
+                notify = true;
+            }
+            if (failed) return false;
+        }
+        if (notify) {
+            wake.notify_one();
+        }
+        return true;
+    }
+
+    // writes out whatever is pending right now
+    bool flush() {
+        std::lock_guard<std::mutex> guard(lock);
+        flush_locked();
+        return !failed;
+    }
+
+    CoalesceStats get_stats() {
+        std::lock_guard<std::mutex> guard(lock);
+        return stats;
+    }
+
+private:
+    void flush_locked() {
+        armed = false;
+        if (pending.empty() || failed) return;
+        IoSlice slice = {pending.data(), pending.size()};
+        if (!send_gather(sock, &slice, 1)) {
+            failed = true;
+        }
+        ++stats.writes;
+        stats.bytes += pending.size();
+        pending.clear();
+    }
+
+    void flush_loop() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (!stopping) {
+            if (!armed) {
+                wake.wait(guard, [this] { return stopping || armed; });
+                continue;
+            }
+            if (wake.wait_until(guard, deadline, [this] { return stopping || !armed; })) {
+                continue;
+            }
+            ++stats.deadline_flushes;
+            flush_locked();
+            // the deadline fired, so traffic is light: give a grown buffer back
+            if (pending.capacity() > COALESCE_IDLE_KEEP_BYTES) {
+                std::vector<ui8>().swap(pending);
+            }
+        }
+    }
+};
+
+#endif // COALESCE_H
@@ -0,0 +1,233 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+typedef uint8_t ui8;
+typedef uint16_t ui16;
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_HASH_LOG 12
+#define LZ4_MAX_OFFSET 65535
+// the block format wants the last match to start 12 bytes before the end
+// and the final 5 bytes to be literals
+#define LZ4_MFLIMIT 12
+#define LZ4_LAST_LITERALS 5
+
+// packed bodies carry the original length up front
+#define COMPRESS_HEADER_BYTES 4
+// below this a match can't pay for the header
+#define COMPRESS_MIN_BYTES 64
+#define COMPRESS_SAMPLE_BYTES 1024
+// sampled collision entropy above this fraction of the most the sample
+// could show (8 bits/byte, less for short samples) reads as random /
+// already compressed / encrypted, so we don't bother
+#define COMPRESS_MAX_ENTROPY_RATIO 0.875
+
+// lz4 block format compressor: greedy single-probe hash table, literal
+// runs skipped with growing strides. decompression bounds-checks every
+// length and offset, the input is attacker controlled.
+class Compressor {
+private:
+    static ui32 read32(const ui8* p) {
+        ui32 v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+
+    static ui32 hash(ui32 seq) {
+        return (seq * 2654435761u) >> (32 - LZ4_HASH_LOG);
+    }
+
+    static ui8* put_length(ui8* op, ui64 len) {
+        while (len >= 255) {
+            *op++ = 255;
+            len -= 255;
+        }
+        *op++ = (ui8)len;
+        return op;
+    }
+
+    static bool get_length(const ui8*& ip, const ui8* iend, ui64& len) {
+        ui8 b;
+        do {
+            if (ip >= iend) return false;
+            b = *ip++;
+            len += b;
+        } while (b == 255);
+        return true;
+    }
+
+    // token + literal run (+ offset and match length if has_match)
+    static ui8* emit(ui8* op, ui8* oend, const ui8* literals, ui64 lit_len,
+                     bool has_match, ui16 offset, ui64 match_len) {
+        ui64 need = 1 + lit_len + lit_len / 255 + 1 + (has_match ? 2 + match_len / 255 + 1 : 0);
+        if (need > (ui64)(oend - op)) return nullptr;
+
+        ui8* token = op++;
+        *token = (ui8)((lit_len >= 15 ? 15 : lit_len) << 4);
+        if (lit_len >= 15) op = put_length(op, lit_len - 15);
+        memcpy(op, literals, lit_len);
+        op += lit_len;
+
+        if (has_match) {
+            *op++ = (ui8)offset;
+            *op++ = (ui8)(offset >> 8);
+            *token |= (ui8)(match_len >= 15 ? 15 : match_len);
+            if (match_len >= 15) op = put_length(op, match_len - 15);
+        }
+        return op;
+    }
+
+public:
+    // worst case output for len input bytes
+    static constexpr ui64 bound(ui64 len) {
+        return len + len / 255 + 16;
+    }
+
+    // returns the compressed size, 0 if it does not fit in cap
+    static ui64 compress(ui8* dst, ui64 cap, const ui8* src, ui64 len) {
+        ui8* op = dst;
+        ui8* oend = dst + cap;
+        const ui8* ip = src;
+        const ui8* anchor = src;
+        const ui8* iend = src + len;
+
+        if (len >= LZ4_MFLIMIT + 1) {
+            const ui8* mflimit = iend - LZ4_MFLIMIT;
+            const ui8* matchlimit = iend - LZ4_LAST_LITERALS;
+            ui32 table[1u << LZ4_HASH_LOG];
+            memset(table, 0, sizeof(table));
+
+            ++ip;
+            while (ip < mflimit) {
+                ui32 seq = read32(ip);
+                ui32 h = hash(seq);
+                const ui8* ref = src + table[h];
+                table[h] = (ui32)(ip - src);
+
+                if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || read32(ref) != seq) {
+                    ip += 1 + ((ip - anchor) >> 6);
+                    continue;
+                }
+
+                while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                    --ip;
+                    --ref;
+                }
+                const ui8* mp = ip + LZ4_MIN_MATCH;
+                const ui8* rp = ref + LZ4_MIN_MATCH;
+                while (mp < matchlimit && *mp == *rp) {
+                    ++mp;
+                    ++rp;
+                }
+
+                op = emit(op, oend, anchor, (ui64)(ip - anchor), true, (ui16)(ip - ref),
+                          (ui64)(mp - ip - LZ4_MIN_MATCH));
+                if (op == nullptr) return 0;
+                ip = mp;
+                anchor = ip;
+            }
+        }
+
+        op = emit(op, oend, anchor, (ui64)(iend - anchor), false, 0, 0);
+        if (op == nullptr) return 0;
+        return (ui64)(op - dst);
+    }
+
+    // false unless src decodes to exactly dst_len bytes
+    static bool decompress(ui8* dst, ui64 dst_len, const ui8* src, ui64 src_len) {
+        const ui8* ip = src;
+        const ui8* iend = src + src_len;
+        ui8* op = dst;
+        ui8* oend = dst + dst_len;
+
+        while (ip < iend) {
+            ui8 token = *ip++;
+            ui64 lit_len = token >> 4;
+            if (lit_len == 15 && !get_length(ip, iend, lit_len)) return false;
+            if (lit_len > (ui64)(iend - ip) || lit_len > (ui64)(oend - op)) return false;
+            memcpy(op, ip, lit_len);
+            op += lit_len;
+            ip += lit_len;
+            if (ip == iend) break;
+
+            if (iend - ip < 2) return false;
+            ui64 offset = (ui64)ip[0] | ((ui64)ip[1] << 8);
+            ip += 2;
+            if (offset == 0 || offset > (ui64)(op - dst)) return false;
+
+            ui64 match_len = token & 15;
+            if (match_len == 15 && !get_length(ip, iend, match_len)) return false;
+            match_len += LZ4_MIN_MATCH;
+            if (match_len > (ui64)(oend - op)) return false;
+
+            const ui8* ref = op - offset;
+            if (offset >= match_len) {
+                memcpy(op, ref, match_len);
+            } else {
+                // overlapping copy repeats the last `offset` bytes
+                for (ui64 i = 0; i < match_len; ++i) op[i] = ref[i];
+            }
+            op += match_len;
+        }
+        return op == oend;
+    }
+
+    // collision (order-2 renyi) entropy over a few windows spread across
+    // the payload: one log per call instead of one per symbol
+    static bool looks_compressible(const ui8* src, ui64 len) {
+        if (len < COMPRESS_MIN_BYTES) return false;
+
+        ui32 counts[256] = {0};
+        ui64 sampled = 0;
+        if (len <= COMPRESS_SAMPLE_BYTES) {
+            for (ui64 i = 0; i < len; ++i) ++counts[src[i]];
+            sampled = len;
+        } else {
+            const ui64 windows = 4;
+            const ui64 window = COMPRESS_SAMPLE_BYTES / windows;
+            ui64 stride = (len - window) / (windows - 1);
+            for (ui64 w = 0; w < windows; ++w) {
+                const ui8* p = src + w * stride;
+                for (ui64 i = 0; i < window; ++i) ++counts[p[i]];
+            }
+            sampled = windows * window;
+        }
+
+        ui64 collisions = 0;
+        for (int i = 0; i < 256; ++i) {
+            collisions += (ui64)counts[i] * counts[i];
+        }
+        double entropy = std::log2((double)sampled * (double)sampled / (double)collisions);
+        double ceiling = std::log2((double)(sampled < 256 ? sampled : 256));
+        return entropy <= COMPRESS_MAX_ENTROPY_RATIO * ceiling;
+    }
+
+    // [orig_len (4, le) | lz4 block] into dst. 0 when it would not come out
+    // smaller than the input, the caller then sends it raw.
+    static ui64 pack(ui8* dst, ui64 cap, const ui8* src, ui64 len) {
+        if (cap <= COMPRESS_HEADER_BYTES || len > 0xffffffffull) return 0;
+        ui64 n = compress(dst + COMPRESS_HEADER_BYTES, cap - COMPRESS_HEADER_BYTES, src, len);
+        if (n == 0 || n + COMPRESS_HEADER_BYTES >= len) return 0;
+        for (int i = 0; i < 4; ++i) dst[i] = (ui8)(len >> (8 * i));
+        return n + COMPRESS_HEADER_BYTES;
+    }
+
+    // inverse of pack; false if the body is malformed or larger than cap
+    static bool unpack(ui8* dst, ui64 cap, ui64& out_len, const ui8* src, ui64 len) {
+        if (len < COMPRESS_HEADER_BYTES) return false;
+        ui64 orig = 0;
+        for (int i = 0; i < 4; ++i) orig |= (ui64)src[i] << (8 * i);
+        if (orig > cap) return false;
+        if (!decompress(dst, orig, src + COMPRESS_HEADER_BYTES, len - COMPRESS_HEADER_BYTES)) return false;
+        out_len = orig;
+        return true;
+    }
+};
+
+#endif // COMPRESS_H
@@ -0,0 +1,428 @@
+#ifndef CONN_H
+#define CONN_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "arena.h"
+#include "frame.h"
+#include "message_view.h"
+#include "net.h"
+#include "session.h"
+#include "slab.h"
+
+typedef uint8_t ui8;
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+// a connection at or above soft stops being read until buffers come back;
+// one that would go past hard is shed
+#define CONN_DEFAULT_SOFT_BYTES KiB(64)
+#define CONN_DEFAULT_HARD_BYTES KiB(256)
+// address space for what a session keeps on its arena (keys). only the
+// pages actually touched become resident.
+#define CONN_ARENA_RESERVE KiB(64)
+// a drained send queue keeps at most this much buffer
+#define CONN_IDLE_KEEP_BYTES KiB(4)
+
+enum BudgetVerdict {
+    BUDGET_OK = 0,
+    // charged, but the connection is over its soft limit
+    BUDGET_BACKPRESSURE = 1,
+    // refused, nothing was charged
+    BUDGET_SHED = 2,
+};
+
+struct ConnBudgetConfig {
+    ui64 soft_bytes;
+    ui64 hard_bytes;
+
+    ConnBudgetConfig(ui64 soft_bytes_ = CONN_DEFAULT_SOFT_BYTES, ui64 hard_bytes_ = CONN_DEFAULT_HARD_BYTES)
+        : soft_bytes(soft_bytes_), hard_bytes(hard_bytes_) {}
+};
+
+// bytes in use across every connection of the process. limit 0 means no
+// process-wide cap, only the per-connection ones.
+class MemBudget {
+private:
+    std::atomic<ui64> used;
+    std::atomic<ui64> peak;
+    ui64 limit;
+
+public:
+    explicit MemBudget(ui64 limit_ = 0) : used(0), peak(0), limit(limit_) {}
+
+    MemBudget(const MemBudget&) = delete;
+    MemBudget& operator=(const MemBudget&) = delete;
+
+    bool charge(ui64 n) {
+        ui64 old = used.load(std::memory_order_relaxed);
+        do {
+            if (limit != 0 && old + n > limit) return false;
+        } while (!used.compare_exchange_weak(old, old + n, std::memory_order_relaxed));
+
+        ui64 seen = peak.load(std::memory_order_relaxed);
+        while (old + n > seen && !peak.compare_exchange_weak(seen, old + n, std::memory_order_relaxed)) {
+        }
+        return true;
+    }
+
+    void refund(ui64 n) {
+        used.fetch_sub(n, std::memory_order_relaxed);
+    }
+
+    ui64 get_used() const {
+        return used.load(std::memory_order_relaxed);
+    }
+
+    ui64 get_peak() const {
+        return peak.load(std::memory_order_relaxed);
+    }
+
+    ui64 get_limit() const {
+        return limit;
+    }
+};
+
+// what one connection holds in buffers right now. owned by the thread
+// serving the connection, the process-wide total is the only shared part.
+class ConnBudget {
+private:
+    ConnBudgetConfig config;
+    MemBudget* global;
+    ui64 used;
+    ui64 peak;
+
+public:
+    explicit ConnBudget(ConnBudgetConfig config_ = ConnBudgetConfig(), MemBudget* global_ = nullptr)
+        : config(config_), global(global_), used(0), peak(0) {}
+
+    ~ConnBudget() {
+        if (global != nullptr && used != 0) {
+            global->refund(used);
+        }
+    }
+
+    ConnBudget(const ConnBudget&) = delete;
+    ConnBudget& operator=(const ConnBudget&) = delete;
+
+    BudgetVerdict charge(ui64 n) {
+        if (used + n > config.hard_bytes) return BUDGET_SHED;
+        if (global != nullptr && !global->charge(n)) return BUDGET_SHED;
+        used += n;
+        peak = MAX(peak, used);
+        return used >= config.soft_bytes ? BUDGET_BACKPRESSURE : BUDGET_OK;
+    }
+
+    void refund(ui64 n) {
+        n = MIN(n, used);
+        used -= n;
+        if (global != nullptr) {
+            global->refund(n);
+        }
+    }
+
+    // false while the connection should not be read from
+    bool accepts_more() const {
+        return used < config.soft_bytes;
+    }
+
+    ui64 get_used() const {
+        return used;
+    }
+
+    ui64 get_peak() const {
+        return peak;
+    }
+
+    const ConnBudgetConfig& get_config() const {
+        return config;
+    }
+};
+
+// slab block charged to a connection for as long as it is held. empty
+// costs nothing, so idle connections keep no buffer at all.
+class ConnBuffer {
+private:
+    SlabBuffer block;
+    ConnBudget* budget;
+
+public:
+    ConnBuffer() : block(), budget(nullptr) {}
+
+    ~ConnBuffer() {
+        release();
+    }
+
+    ConnBuffer(ConnBuffer&& other) : block(std::move(other.block)), budget(other.budget) {
+        other.budget = nullptr;
+    }
+
+    ConnBuffer& operator=(ConnBuffer&& other) {
+        if (this != &other) {
+            release();
+            block = std::move(other.block);
+            budget = other.budget;
+            other.budget = nullptr;
+        }
+        return *this;
+    }
+
+    ConnBuffer(const ConnBuffer&) = delete;
+    ConnBuffer& operator=(const ConnBuffer&) = delete;
+
+    // drops what was held, then allocates len bytes. on BUDGET_SHED the
+    // buffer stays empty.
+    BudgetVerdict acquire(ConnBudget* budget_, ui64 len) {
+        release();
+        BudgetVerdict verdict = budget_ != nullptr ? budget_->charge(len) : BUDGET_OK;
+        if (verdict == BUDGET_SHED) return verdict;
+        try {
+            block = SlabBuffer(len);
+        } catch (...) {
+            if (budget_ != nullptr) budget_->refund(len);
+            throw;
+        }
+        budget = budget_;
+        return verdict;
+    }
+
+    void release() {
+        if (budget != nullptr) {
+            budget->refund(block.size());
+            budget = nullptr;
+        }
+        block = SlabBuffer();
+    }
+
+    ui8* data() const {
+        return block.data();
+    }
+
+    ui64 size() const {
+        return block.size();
+    }
+};
+
+enum ReadStatus {
+    // keep reading into target()
+    READ_MORE = 0,
+    // a whole frame is in: frame_header() / frame_payload(), then next()
+    READ_FRAME = 1,
+    READ_BAD_HEADER = 2,
+    // the payload does not fit the budget, shed the connection
+    READ_OVER_BUDGET = 3,
+};
+
+// reassembles frames from a byte stream, for blocking and non-blocking
+// sockets alike: read up to missing() bytes into target(), report them
+// with advance(). between frames only the 48 header bytes are held; the
+// payload buffer is sized per frame and charged to the budget.
+class FrameReader {
+private:
+    ui8 header_bytes[FRAME_HEADER_BYTES];
+    FrameHeader header;
+    ConnBuffer payload;
+    ConnBudget* budget;
+    ui32 max_payload;
+    ui32 received;
+    bool have_header;
+
+public:
+    explicit FrameReader(ConnBudget* budget_ = nullptr, ui32 max_payload_ = FRAME_MAX_PAYLOAD)
+        : header(), payload(), budget(budget_), max_payload(max_payload_), received(0), have_header(false) {}
+
+    FrameReader(const FrameReader&) = delete;
+    FrameReader& operator=(const FrameReader&) = delete;
+
+    ui8* target() const {
+        return (have_header ? payload.data() : (ui8*)header_bytes) + received;
+    }
+
+    ui32 missing() const {
+        return (have_header ? header.payload_len : FRAME_HEADER_BYTES) - received;
+    }
+
+    ReadStatus advance(ui32 n) {
+        received += n;
+        if (received < (have_header ? header.payload_len : FRAME_HEADER_BYTES)) return READ_MORE;
+        if (have_header) return READ_FRAME;
+
+        if (!Frame::decode(header_bytes, header, max_payload)) return READ_BAD_HEADER;
+        if (payload.acquire(budget, header.payload_len) == BUDGET_SHED) return READ_OVER_BUDGET;
+        have_header = true;
+        received = 0;
+        return header.payload_len == 0 ? READ_FRAME : READ_MORE;
+    }
+
+    // header of the frame being read, valid from the first READ_MORE after it
+    const FrameHeader& frame_header() const {
+        return header;
+    }
+
+    ui8* frame_payload() const {
+        return payload.data();
+    }
+
+    // done with the frame: the payload goes back, wait for the next header
+    void next() {
+        payload.release();
+        received = 0;
+        have_header = false;
+    }
+
+    // backpressure: don't read while the connection is over its soft limit
+    bool wants_read() const {
+        return budget == nullptr || budget->accepts_more();
+    }
+};
+
+enum SendStatus {
+    // written, or queued with the connection under its soft limit
+    SEND_OK = 0,
+    // queued and over the soft limit: stop reading from this peer until
+    // the queue drains
+    SEND_BACKPRESSURE = 1,
+    // socket error, or the queue would pass the hard limit: drop the peer
+    SEND_FAILED = 2,
+};
+
+// outbound bytes for a non-blocking socket. writes go straight to the
+// kernel while the queue is empty; only what it doesn't take is copied
+// here and charged to the budget until it is written.
+class SendQueue {
+private:
+    std::vector<ui8> pending;
+    ui64 sent;
+    ConnBudget* budget;
+
+    SendStatus status() const {
+        return budget == nullptr || budget->accepts_more() ? SEND_OK : SEND_BACKPRESSURE;
+    }
+
+    bool append(const ui8* data, ui64 len) {
+        if (len == 0) return true;
+        if (budget != nullptr && budget->charge(len) == BUDGET_SHED) return false;
+        pending.insert(pending.end(), data, data + len);
+        return true;
+    }
+
+public:
+    explicit SendQueue(ConnBudget* budget_ = nullptr) : pending(), sent(0), budget(budget_) {}
+
+    ~SendQueue() {
+        if (budget != nullptr) {
+            budget->refund(size());
+        }
+    }
+
+    SendQueue(const SendQueue&) = delete;
+    SendQueue& operator=(const SendQueue&) = delete;
+
+    ui64 size() const {
+        return pending.size() - sent;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // everything in slices goes out in order behind what is already queued
+    SendStatus push(socket_t sock, const IoSlice* slices, int count) {
+        ui64 taken = 0;
+        if (empty()) {
+            i64 n = send_gather_some(sock, slices, count);
+            if (n < 0) return SEND_FAILED;
+            taken = (ui64)n;
+        }
+        for (int i = 0; i < count; ++i) {
+            ui64 skip = MIN(taken, slices[i].len);
+            taken -= skip;
+            if (!append(slices[i].data + skip, slices[i].len - skip)) return SEND_FAILED;
+        }
+        return status();
+    }
+
+    // writes queued bytes until the socket would block
+    SendStatus flush(socket_t sock) {
+        while (!empty()) {
+            IoSlice slice = {pending.data() + sent, size()};
+            i64 n = send_gather_some(sock, &slice, 1);
+            if (n < 0) return SEND_FAILED;
+            if (n == 0) return status();
+            consume((ui64)n);
+        }
+        return SEND_OK;
+    }
+
+    // for completion-based transports that write from their own buffers:
+    // queue without writing, copy out of front(), then consume()
+    SendStatus queue(const IoSlice* slices, int count) {
+        for (int i = 0; i < count; ++i) {
+            if (!append(slices[i].data, slices[i].len)) return SEND_FAILED;
+        }
+        return status();
+    }
+
+    ConstByteSpan front() const {
+        return ConstByteSpan(pending.data() + sent, size());
+    }
+
+    // n bytes left the queue. a drained queue gives back a grown buffer.
+    void consume(ui64 n) {
+        n = MIN(n, size());
+        sent += n;
+        if (budget != nullptr) budget->refund(n);
+        if (!empty()) return;
+        sent = 0;
+        pending.clear();
+        if (pending.capacity() > CONN_IDLE_KEEP_BYTES) {
+            std::vector<ui8>().swap(pending);
+        }
+    }
+};
+
+enum ConnPhase {
+    // waiting for the peer's public key + chosen suite
+    CONN_HELLO = 0,
+    CONN_OPEN = 1,
+};
+
+// everything one server-side session keeps: a few hundred bytes plus the
+// kernel socket. buffers exist only while a frame is in flight or a write
+// is backed up.
+struct Connection {
+    socket_t sock;
+    ui64 id;
+    ConnPhase phase;
+    ui32 hello_received;
+    ui8 hello[HANDSHAKE_HELLO_BYTES];
+    ui8 peer_public_key[X25519_KEY_BYTES];
+    Session session;
+    ui64 send_seq;
+    ui64 recv_seq;
+    ConnBudget budget;
+    FrameReader reader;
+    SendQueue outbox;
+    // room id (0 for none) and index in its member list, see room.h
+    ui32 room;
+    ui32 room_slot;
+    // set once the connection is being torn down, events still in flight
+    // for it are skipped
+    bool closing;
+
+    Connection(socket_t sock_, ConnBudgetConfig config = ConnBudgetConfig(), MemBudget* global = nullptr,
+               ui32 max_payload = FRAME_MAX_PAYLOAD)
+        : sock(sock_), id(0), phase(CONN_HELLO), hello_received(0), session(), send_seq(0), recv_seq(0),
+          budget(config, global), reader(&budget, max_payload), outbox(&budget), room(0), room_slot(0),
+          closing(false) {
+        memset(hello, 0, sizeof(hello));
+        memset(peer_public_key, 0, sizeof(peer_public_key));
+    }
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+};
+
+#endif // CONN_H
@@ -5,6 +5,10 @@
 #include <cstring>
 #include <random>
 #include <iostream>
+#include "chacha.h"
+#include "poly1305.h"
+#include "csprng.h"
+#include "batch.h"
 
 typedef uint8_t ui8;
 typedef uint16_t ui16;
@@ -12,36 +16,44 @@ typedef uint32_t ui32;
 typedef uint64_t ui64;
 typedef int32_t i32;
 
+// cipher suite ids, carried with every message
+enum CipherSuite : ui8 {
+    SUITE_LEGACY_XOR_CHAIN = 0, // serial xor chain, kept for old peers
+    SUITE_CHACHA20 = 1,         // chacha20-poly1305 aead
+    SUITE_AES256_GCM = 2,       // aes-256-gcm aead (aes-ni when available)
+};
+
+// encrypt/mac tile size for the fused aead loop, small enough to stay in L1
+#define AEAD_TILE_BYTES 1024
+
 // XOR chaining
 class SimpleCrypto {
 private:
-    static std::mt19937_64 rng;
     static bool initialized;
 
 public:
+    // seeds the calling thread's generator up front, other threads seed lazily
     static void init() {
         if (!initialized) {
-            std::random_device rd;
-            rng.seed(rd());
+            ThreadRng::local();
             initialized = true;
         }
     }
 
-    //-faster
+    // copies out of the per-thread buffered chacha20 generator
     static void random_bytes(ui8* buffer, ui64 len) {
-        std::uniform_int_distribution<int> dist(0, 255);
-        for (ui64 i = 0; i < len; ++i) {
-            buffer[i] = dist(rng);
-        }
+        ThreadRng::local().fill(buffer, len);
     }
 
     // encrypt with state chaining
     static void simple_encrypt(ui8* ciphertext, const ui8* plaintext, ui64 len,
                                const ui8* key, ui64 key_len) {
         ui8 state = 0;
+        ui64 k = 0;
         for (ui64 i = 0; i < len; ++i) {
-            state = (state + key[i % key_len]) ^ plaintext[i];
+            state = (state + key[k]) ^ plaintext[i];
             ciphertext[i] = state;
+            if (++k == key_len) k = 0;
         }
     }
 
@@ -49,32 +61,134 @@ public:
     static void simple_decrypt(ui8* plaintext, const ui8* ciphertext, ui64 len,
                                const ui8* key, ui64 key_len) {
         ui8 state = 0;
+        ui64 k = 0;
         for (ui64 i = 0; i < len; ++i) {
             ui8 temp = ciphertext[i];
-            plaintext[i] = (state + key[i % key_len]) ^ temp;
+            plaintext[i] = (state + key[k]) ^ temp;
             state = temp;
+            if (++k == key_len) k = 0;
         }
     }
 
-    //mac imp
+    // counter-mode keystream, nonce is the 16-byte initial counter block.
+    // blocks are independent so this runs on the simd kernels.
+    static void stream_encrypt(ui8* ciphertext, const ui8* plaintext, ui64 len,
+                               const ui8* key, const ui8* nonce) {
+        ChaCha20::xor_stream(ciphertext, plaintext, len, key, nonce);
+    }
+
+    static void stream_decrypt(ui8* plaintext, const ui8* ciphertext, ui64 len,
+                               const ui8* key, const ui8* nonce) {
+        ChaCha20::xor_stream(plaintext, ciphertext, len, key, nonce);
+    }
+
+    //mac imp - poly1305, key must be single use
     static void compute_auth(ui8* mac, const ui8* data, ui64 data_len, const ui8* key) {
-        memset(mac, 0, 16);
-        ui64 hash = 5381;
-        for (ui64 i = 0; i < data_len; ++i) {
-            hash = ((hash << 5) + hash) ^ data[i];
+        Poly1305::auth(mac, data, data_len, key);
+    }
+
+    // constant time
+    static bool verify_auth(const ui8* mac, const ui8* data, ui64 data_len, const ui8* key) {
+        ui8 expected[POLY1305_MAC_BYTES];
+        compute_auth(expected, data, data_len, key);
+        bool ok = Poly1305::verify(expected, mac);
+        memset(expected, 0, sizeof(expected));
+        return ok;
+    }
+
+    // chacha20-poly1305 (rfc 8439 layout). block nonce[0..3] derives the mac
+    // key, the payload starts at the next block. each tile is encrypted and
+    // then mac'd while still hot, so the data is only streamed once.
+    static void seal(ui8* ciphertext, ui8* mac, const ui8* plaintext, ui64 len,
+                     const ui8* aad, ui64 aad_len, const ui8* key, const ui8* nonce) {
+        ui32 schedule[16];
+        ChaCha20::init_state(schedule, key, nonce);
+        seal_expanded(ciphertext, mac, plaintext, len, aad, aad_len, schedule, nonce);
+        memset(schedule, 0, sizeof(schedule));
+    }
+
+    // returns false (and wipes the output) if the tag does not match
+    static bool open(ui8* plaintext, const ui8* ciphertext, ui64 len, const ui8* mac,
+                     const ui8* aad, ui64 aad_len, const ui8* key, const ui8* nonce) {
+        ui32 schedule[16];
+        ChaCha20::init_state(schedule, key, nonce);
+        bool ok = open_expanded(plaintext, ciphertext, len, mac, aad, aad_len, schedule, nonce);
+        memset(schedule, 0, sizeof(schedule));
+        return ok;
+    }
+
+    // same as seal/open but with a key schedule expanded ahead of time
+    // (see Session). only the nonce words of the schedule are replaced.
+    static void seal_expanded(ui8* ciphertext, ui8* mac, const ui8* plaintext, ui64 len,
+                              const ui8* aad, ui64 aad_len, const ui32 schedule[16], const ui8* nonce) {
+        ui32 state[16];
+        Poly1305 poly;
+        aead_begin(poly, state, aad, aad_len, schedule, nonce);
+        for (ui64 off = 0; off < len; off += AEAD_TILE_BYTES) {
+            ui64 n = (len - off < AEAD_TILE_BYTES) ? len - off : AEAD_TILE_BYTES;
+            ChaCha20::xor_stream(ciphertext + off, plaintext + off, n, state);
+            poly.update(ciphertext + off, n);
         }
-        for (int i = 0; i < 32; ++i) {
-            hash = ((hash << 5) + hash) ^ key[i];
+        aead_finish(poly, mac, aad_len, len);
+        memset(state, 0, sizeof(state));
+    }
+
+    static bool open_expanded(ui8* plaintext, const ui8* ciphertext, ui64 len, const ui8* mac,
+                              const ui8* aad, ui64 aad_len, const ui32 schedule[16], const ui8* nonce) {
+        ui32 state[16];
+        Poly1305 poly;
+        aead_begin(poly, state, aad, aad_len, schedule, nonce);
+        for (ui64 off = 0; off < len; off += AEAD_TILE_BYTES) {
+            ui64 n = (len - off < AEAD_TILE_BYTES) ? len - off : AEAD_TILE_BYTES;
+            poly.update(ciphertext + off, n);
+            ChaCha20::xor_stream(plaintext + off, ciphertext + off, n, state);
         }
-        ui8* hash_bytes = (ui8*)&hash;
-        for (int i = 0; i < 16; ++i) {
-            mac[i] = hash_bytes[i % 8];
+        ui8 expected[POLY1305_MAC_BYTES];
+        aead_finish(poly, expected, aad_len, len);
+        memset(state, 0, sizeof(state));
+
+        bool ok = Poly1305::verify(expected, mac);
+        if (!ok) {
+            memset(plaintext, 0, len);
         }
+        return ok;
     }
 
-    // stub for now
-    static bool verify_auth(const ui8* mac, const ui8* data, ui64 data_len, const ui8* key) {
-        return true;
+    // many short messages at once, lanes packed across messages (batch.h)
+    static void seal_batch(CryptoJob* jobs, ui64 count) {
+        BatchCrypto::seal(jobs, count);
+    }
+
+    // returns the number of jobs that failed authentication
+    static ui64 open_batch(CryptoJob* jobs, ui64 count) {
+        return BatchCrypto::open(jobs, count);
+    }
+
+private:
+    static void aead_begin(Poly1305& poly, ui32 state[16], const ui8* aad, ui64 aad_len,
+                           const ui32 schedule[16], const ui8* nonce) {
+        ui8 otk[CHACHA_BLOCK_BYTES];
+        memcpy(state, schedule, 16 * sizeof(ui32));
+        ChaCha20::set_iv(state, nonce);
+        ChaCha20::block(otk, state);
+        state[12]++;
+        poly.init(otk);
+        memset(otk, 0, sizeof(otk));
+        if (aad_len) {
+            poly.update(aad, aad_len);
+            poly.pad16();
+        }
+    }
+
+    static void aead_finish(Poly1305& poly, ui8* mac, ui64 aad_len, ui64 len) {
+        ui8 lens[16];
+        poly.pad16();
+        for (int i = 0; i < 8; ++i) {
+            lens[i] = (ui8)(aad_len >> (8 * i));
+            lens[8 + i] = (ui8)(len >> (8 * i));
+        }
+        poly.update(lens, sizeof(lens));
+        poly.finish(mac);
     }
 };
 
@@ -88,11 +202,19 @@ public:
 
     ~CryptoEngine() {}
 
-    static ui64 get_public_key_bytes() { return 32; }
-    static ui64 get_secret_key_bytes() { return 32; }
-    static ui64 get_nonce_bytes() { return 16; }
-    static ui64 get_mac_bytes() { return 16; }
-    static ui64 get_box_mac_bytes() { return 16; }
+    static constexpr ui64 get_public_key_bytes() { return 32; }
+    static constexpr ui64 get_secret_key_bytes() { return 32; }
+    static constexpr ui64 get_nonce_bytes() { return CHACHA_IV_BYTES; }
+    static constexpr ui64 get_mac_bytes() { return POLY1305_MAC_BYTES; }
+    static constexpr ui64 get_box_mac_bytes() { return POLY1305_MAC_BYTES; }
+
+    static ui64 get_batch_lanes() {
+        return ChaCha20::active_kernel() == CHACHA_KERNEL_AVX2 ? BATCH_CHACHA_LANES : 1;
+    }
+
+    static const char* get_cipher_kernel() {
+        return ChaCha20::kernel_name(ChaCha20::active_kernel());
+    }
 };
 
 #endif // CRYPTO_H
@@ -0,0 +1,195 @@
+#ifndef CSPRNG_H
+#define CSPRNG_H
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <random>
+#include <stdexcept>
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+#include "chacha.h"
+
+typedef uint8_t ui8;
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+#define CSPRNG_BUFFER_BYTES (8 * 1024)
+#define CSPRNG_SEED_BYTES 32
+
+// per-thread chacha20 generator with fast key erasure: each refill expands
+// the current key into a buffer of keystream and the first 32 bytes become
+// the next key, so handed-out bytes can't be recomputed after the fact
+class ThreadRng {
+private:
+    ui32 state[16];
+    ui8 buffer[CSPRNG_BUFFER_BYTES];
+    ui64 pos;
+
+public:
+    ThreadRng() : pos(CSPRNG_BUFFER_BYTES) {
+        ui8 seed[CSPRNG_SEED_BYTES];
+        os_entropy(seed, sizeof(seed));
+        rekey(seed);
+        memset(seed, 0, sizeof(seed));
+    }
+
+    ~ThreadRng() {
+        memset(state, 0, sizeof(state));
+        memset(buffer, 0, sizeof(buffer));
+    }
+
+    ThreadRng(const ThreadRng&) = delete;
+    ThreadRng& operator=(const ThreadRng&) = delete;
+
+    static ThreadRng& local() {
+        thread_local ThreadRng rng;
+        return rng;
+    }
+
+    void fill(ui8* out, ui64 len) {
+        while (len) {
+            if (pos == CSPRNG_BUFFER_BYTES) {
+                refill();
+            }
+            ui64 n = CSPRNG_BUFFER_BYTES - pos;
+            if (n > len) n = len;
+            memcpy(out, buffer + pos, n);
+            // never hand the same bytes out twice
+            memset(buffer + pos, 0, n);
+            pos += n;
+            out += n;
+            len -= n;
+        }
+    }
+
+    ui64 next_u64() {
+        ui8 b[8];
+        fill(b, sizeof(b));
+        ui64 v = 0;
+        for (int i = 7; i >= 0; --i) v = (v << 8) | b[i];
+        return v;
+    }
+
+    static void os_entropy(ui8* out, ui64 len) {
+#ifdef __linux__
+        while (len) {
+            ssize_t n = getrandom(out, len, 0);
+            if (n <= 0) {
+                throw std::runtime_error("getrandom failed!");
+            }
+            out += n;
+            len -= (ui64)n;
+        }
+#else
+        std::random_device rd;
+        for (ui64 i = 0; i < len; i += 4) {
+            ui32 v = rd();
+            for (ui64 j = 0; j < 4 && i + j < len; ++j) {
+                out[i + j] = (ui8)(v >> (8 * j));
+            }
+        }
+#endif
+    }
+
+private:
+    void rekey(const ui8 key[CSPRNG_SEED_BYTES]) {
+        ui8 iv[CHACHA_IV_BYTES] = {0};
+        ChaCha20::init_state(state, key, iv);
+    }
+
+    void refill() {
+        state[12] = 0;
+        ChaCha20::xor_stream(buffer, nullptr, CSPRNG_BUFFER_BYTES, state);
+        rekey(buffer);
+        memset(buffer, 0, CSPRNG_SEED_BYTES);
+        pos = CSPRNG_SEED_BYTES;
+    }
+};
+
+// unique nonces for one key: le32 block counter (always 0) || 4-byte prefix
+// (random, or role byte + 3 random) || le64 sequence number. the sequence
+// never repeats, so neither do nonces drawn from the same NonceSequence.
+class NonceSequence {
+private:
+    ui8 prefix[4];
+    std::atomic<ui64> counter;
+
+public:
+    NonceSequence() : counter(0) {
+        ThreadRng::local().fill(prefix, sizeof(prefix));
+    }
+
+    NonceSequence(const NonceSequence&) = delete;
+    NonceSequence& operator=(const NonceSequence&) = delete;
+
+    // both ends of a connection share one key, so each side sets a
+    // different role and their nonces can never collide
+    void set_role(ui8 role) {
+        prefix[0] = role;
+    }
+
+    void next(ui8 nonce[CHACHA_IV_BYTES]) {
+        ui64 seq = counter.fetch_add(1, std::memory_order_relaxed);
+        if (seq == ~(ui64)0) {
+            throw std::overflow_error("Nonce sequence exhausted!");
+        }
+        memset(nonce, 0, 4);
+        memcpy(nonce + 4, prefix, 4);
+        for (int i = 0; i < 8; ++i) {
+            nonce[8 + i] = (ui8)(seq >> (8 * i));
+        }
+    }
+
+    ui64 issued() const {
+        return counter.load(std::memory_order_relaxed);
+    }
+};
+
+// the receiving end of a peer's NonceSequence. the first accepted nonce
+// pins the peer's prefix, and every later one must carry that prefix and
+// a larger counter, so a captured message never opens a second time.
+class NonceWindow {
+private:
+    ui8 prefix[4];
+    ui64 next;
+    bool pinned;
+    // the role byte the peer must use, -1 until known
+    int role;
+
+    static ui64 counter_of(const ui8 nonce[CHACHA_IV_BYTES]) {
+        ui64 seq = 0;
+        for (int i = 0; i < 8; ++i) seq |= (ui64)nonce[8 + i] << (8 * i);
+        return seq;
+    }
+
+public:
+    NonceWindow() : next(0), pinned(false), role(-1) {
+        memset(prefix, 0, sizeof(prefix));
+    }
+
+    void reset(int peer_role = -1) {
+        memset(prefix, 0, sizeof(prefix));
+        next = 0;
+        pinned = false;
+        role = peer_role;
+    }
+
+    // check only, mark_used() once the message has authenticated
+    bool fresh(const ui8 nonce[CHACHA_IV_BYTES]) const {
+        static const ui8 zero[4] = {0, 0, 0, 0};
+        if (memcmp(nonce, zero, 4) != 0) return false;
+        if (role >= 0 && nonce[4] != (ui8)role) return false;
+        if (!pinned) return true;
+        return memcmp(nonce + 4, prefix, 4) == 0 && counter_of(nonce) >= next;
+    }
+
+    void mark_used(const ui8 nonce[CHACHA_IV_BYTES]) {
+        memcpy(prefix, nonce + 4, 4);
+        next = counter_of(nonce) + 1;
+        pinned = true;
+    }
+};
+
+#endif // CSPRNG_H
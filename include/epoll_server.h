@@ -0,0 +1,241 @@
+#ifndef EPOLL_SERVER_H
+#define EPOLL_SERVER_H
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "conn.h"
+#include "net.h"
+#include "server_core.h"
+
+typedef uint8_t ui8;
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+#define EPOLL_MAX_EVENTS 256
+
+// many clients on one thread: non-blocking sockets on an edge-triggered
+// epoll set. every readable socket is drained until EAGAIN, frames are
+// reassembled per connection by its FrameReader, and writes the kernel
+// does not take right away wait in the connection's SendQueue until
+// EPOLLOUT. same handshake and frame format as the one-to-one server, so
+// existing clients connect unchanged. stop() may be called from any
+// thread or a signal handler.
+class EpollServer : public ServerCore<EpollServer> {
+    friend class ServerCore<EpollServer>;
+
+private:
+    socket_t listener;
+    int epoll_fd;
+    int wake_fd;
+    // out of descriptors with clients still queued on the listener. its
+    // edge won't fire again for them, so accept once a connection is freed
+    bool accept_paused;
+    bool accept_resume;
+
+    // epoll tags for the fds that are not connections
+    void* listener_tag() {
+        return &listener;
+    }
+
+    void* wake_tag() {
+        return &wake_fd;
+    }
+
+    void* stdin_tag() {
+        return &stdin_pending;
+    }
+
+public:
+    explicit EpollServer(const ServerConfig& config_ = ServerConfig())
+        : ServerCore<EpollServer>(config_), listener(-1), epoll_fd(-1), wake_fd(-1), accept_paused(false),
+          accept_resume(false) {}
+
+    ~EpollServer() {
+        free_all();
+        if (listener >= 0) close(listener);
+        if (wake_fd >= 0) close(wake_fd);
+        if (epoll_fd >= 0) close(epoll_fd);
+    }
+
+    bool start() {
+        listener = open_listener();
+        if (listener < 0) return false;
+
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epoll_fd < 0 || wake_fd < 0) {
+            std::cerr << "[Server] epoll setup failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        if (!watch(listener, EPOLLIN | EPOLLET, listener_tag()) || !watch(wake_fd, EPOLLIN, wake_tag())) {
+            return false;
+        }
+        // a redirected regular file can't be polled; then there is no console
+        if (config.read_stdin && !watch(STDIN_FILENO, EPOLLIN, stdin_tag(), false)) {
+            config.read_stdin = false;
+        }
+
+        announce("epoll");
+        return true;
+    }
+
+    // serves until stop() or "exit" on stdin
+    void run() {
+        epoll_event events[EPOLL_MAX_EVENTS];
+        while (!stopping.load(std::memory_order_acquire)) {
+            int n = epoll_wait(epoll_fd, events, EPOLL_MAX_EVENTS, -1);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                std::cerr << "[Server] epoll_wait failed: " << strerror(errno) << std::endl;
+                break;
+            }
+            for (int i = 0; i < n; ++i) {
+                void* tag = events[i].data.ptr;
+                if (tag == listener_tag()) {
+                    accept_all();
+                } else if (tag == wake_tag()) {
+                    ui64 drained;
+                    while (read(wake_fd, &drained, sizeof(drained)) > 0) {
+                    }
+                } else if (tag == stdin_tag()) {
+                    if (!read_console()) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, STDIN_FILENO, nullptr);
+                } else {
+                    on_event((Connection*)tag, events[i].events);
+                }
+            }
+            end_round();
+            if (accept_resume) {
+                accept_resume = false;
+                accept_all();
+            }
+        }
+        print_stats();
+    }
+
+private:
+    // transport hooks for ServerCore
+
+    Connection* make_connection(socket_t fd) {
+        return new Connection(fd, config.budget, &total, config.max_message);
+    }
+
+    SendStatus transmit(Connection* c, const IoSlice* slices, int count) {
+        return c->outbox.push(c->sock, slices, count);
+    }
+
+    // unregisters and closes now; events already returned for c in this
+    // batch see c->closing and are skipped
+    void detach(Connection* c) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->sock, nullptr);
+        close(c->sock);
+    }
+
+    bool can_free(Connection*) {
+        return true;
+    }
+
+    void free_connection(Connection* c) {
+        if (!c->closing) close(c->sock);
+        delete c;
+        // not from here: reap() is still walking its list
+        if (accept_paused) accept_resume = true;
+    }
+
+    void wake() {
+        ui64 one = 1;
+        if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0) {
+            // the counter is already non-zero, the loop wakes up anyway
+        }
+    }
+
+    bool watch(int fd, ui32 events, void* tag, bool report = true) {
+        epoll_event ev;
+        ev.events = events;
+        ev.data.ptr = tag;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            if (report) std::cerr << "[Server] epoll_ctl failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void accept_all() {
+        for (;;) {
+            socket_t fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                if (errno == EMFILE || errno == ENFILE) {
+                    if (!accept_paused) {
+                        std::cerr << "[Server] Out of file descriptors, " << conns.size() << " clients connected"
+                                  << std::endl;
+                    }
+                    accept_paused = true;
+                    return;
+                }
+                accept_paused = false;
+                return;
+            }
+            Connection* c = admit(fd);
+            if (c == nullptr) continue;
+            if (!watch(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, c)) {
+                drop(c, nullptr);
+                continue;
+            }
+            greet(c);
+        }
+    }
+
+    void on_event(Connection* c, ui32 events) {
+        if (c->closing) return;
+        if (events & EPOLLERR) {
+            drop(c, "socket error");
+            return;
+        }
+        if (events & EPOLLOUT) {
+            bool was_paused = !c->reader.wants_read();
+            if (c->outbox.flush(c->sock) == SEND_FAILED) {
+                drop(c, "send failed");
+                return;
+            }
+            // edge-triggered: input that arrived while paused raises no new
+            // event, so pick it up now
+            if (was_paused && c->reader.wants_read()) {
+                read_ready(c);
+                return;
+            }
+        }
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+            read_ready(c);
+        }
+    }
+
+    // drains the socket until EAGAIN or until the connection is over its
+    // soft budget; in the second case EPOLLOUT resumes it
+    void read_ready(Connection* c) {
+        while (!c->closing && c->reader.wants_read()) {
+            ssize_t n = recv(c->sock, read_target(c), read_missing(c), 0);
+            if (n == 0) {
+                drop(c, "disconnected");
+                return;
+            }
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) drop(c, "recv error");
+                return;
+            }
+            received(c, (ui32)n);
+        }
+    }
+};
+
+#endif // __linux__
+
+#endif // EPOLL_SERVER_H
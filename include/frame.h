@@ -0,0 +1,97 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <cstdint>
+#include <cstring>
+#include "crypto.h"
+#include "message_view.h"
+#include "net.h"
+
+typedef uint8_t ui8;
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+#define FRAME_HEADER_BYTES 48
+// largest ciphertext a peer may announce
+#define FRAME_MAX_PAYLOAD (1u << 20)
+
+// every frame on the wire, all integers little-endian:
+//
+//   version (1) | flags (1) | suite (1) | reserved (1) | payload_len (4)
+//   seq (8) | nonce (16) | mac (16) | payload (payload_len)
+//
+// payload is the ciphertext alone; nonce and mac live in the header so the
+// payload can go straight from the arena without being reassembled. the
+// first FRAME_AAD_BYTES are authenticated by the mac (MessageView::aad),
+// so a frame re-sent with other flags, seq or length fails to open.
+struct FrameHeader {
+    ui8 version;
+    ui8 flags;
+    CipherSuite suite;
+    ui32 payload_len;
+    ui64 seq;
+    ui8* nonce;
+    ui8* mac;
+};
+
+static_assert(FRAME_HEADER_BYTES == FRAME_AAD_BYTES + CHACHA_IV_BYTES + POLY1305_MAC_BYTES, "frame header layout");
+
+class Frame {
+private:
+    static ui32 load32(const ui8* p) {
+        ui32 v = 0;
+        for (int i = 0; i < 4; ++i) v |= (ui32)p[i] << (8 * i);
+        return v;
+    }
+
+    static ui64 load64(const ui8* p) {
+        ui64 v = 0;
+        for (int i = 0; i < 8; ++i) v |= (ui64)p[i] << (8 * i);
+        return v;
+    }
+
+public:
+    // header for a sealed view, with the flags and seq it was sealed
+    // for; the payload is view.body as is
+    static void encode(ui8 out[FRAME_HEADER_BYTES], const MessageView& view) {
+        view.aad(out);
+        memcpy(out + FRAME_AAD_BYTES, view.nonce, CHACHA_IV_BYTES);
+        memcpy(out + FRAME_AAD_BYTES + CHACHA_IV_BYTES, view.mac, POLY1305_MAC_BYTES);
+    }
+
+    // nonce and mac point back into `in`, nothing is copied. false on an
+    // unknown version or flag, or a payload larger than max_payload.
+    static bool decode(ui8 in[FRAME_HEADER_BYTES], FrameHeader& out, ui32 max_payload = FRAME_MAX_PAYLOAD) {
+        out.version = in[0];
+        out.flags = in[1];
+        out.suite = (CipherSuite)in[2];
+        out.payload_len = load32(in + 4);
+        out.seq = load64(in + 8);
+        out.nonce = in + 16;
+        out.mac = in + 16 + CHACHA_IV_BYTES;
+        return out.version == FRAME_VERSION && (out.flags & ~FRAME_FLAG_MASK) == 0 &&
+               out.payload_len <= max_payload;
+    }
+
+    // view over a received frame, ready for open_in_place
+    static MessageView view(const FrameHeader& header, ui8* payload) {
+        MessageView view;
+        view.nonce = header.nonce;
+        view.body = ByteSpan(payload, header.payload_len);
+        view.mac = header.mac;
+        view.suite = header.suite;
+        view.flags = header.flags;
+        view.seq = header.seq;
+        return view;
+    }
+
+    // header + payload in a single gathered send
+    static bool send(socket_t sock, const MessageView& view) {
+        ui8 header[FRAME_HEADER_BYTES];
+        encode(header, view);
+        IoSlice slices[2] = {{header, FRAME_HEADER_BYTES}, {view.body.data, view.body.len}};
+        return send_gather(sock, slices, 2);
+    }
+};
+
+#endif // FRAME_H
@@ -2,12 +2,15 @@
 #define MESSAGE_H
 
 #include <string>
+#include <string_view>
 #include <cstdint>
 #include <cstring>
 #include <sstream>
 #include <iomanip>
 #include "arena.h"
 #include "crypto.h"
+#include "session.h"
+#include "message_view.h"
 
 typedef uint8_t ui8;
 typedef uint64_t ui64;
@@ -19,13 +22,20 @@ struct KeyPair {
 
     KeyPair() : public_key(nullptr), secret_key(nullptr) {}
 
-    // gen random keys
+    // fresh x25519 keypair
     void generate(MemArena& arena) {
         public_key = (ui8*)arena.push(CryptoEngine::get_public_key_bytes(), 0);
         secret_key = (ui8*)arena.push(CryptoEngine::get_secret_key_bytes(), 0);
-        
-        SimpleCrypto::random_bytes(public_key, CryptoEngine::get_public_key_bytes());
-        SimpleCrypto::random_bytes(secret_key, CryptoEngine::get_secret_key_bytes());
+
+        X25519::generate(public_key, secret_key);
+    }
+
+    // same, but from keys pre-generated in the background
+    void generate(MemArena& arena, KeyPairPool& pool) {
+        public_key = (ui8*)arena.push(CryptoEngine::get_public_key_bytes(), 0);
+        secret_key = (ui8*)arena.push(CryptoEngine::get_secret_key_bytes(), 0);
+
+        pool.take(public_key, secret_key);
     }
 
     bool is_valid() const {
@@ -33,72 +43,108 @@ struct KeyPair {
     }
 };
 
-// encrypted message + metadata
+// encrypted message + metadata. the plaintext is not kept; see MessageView
+// for the fully non-owning form. sealed exactly like a MessageView (the mac
+// covers the frame header fields, flags and seq included), so as_view() /
+// from_view() convert both ways and a Message can go out with Frame::send.
 struct Message {
     std::string sender;
-    std::string content;
     ui8* encrypted_data;
     ui64 encrypted_len;
     ui8* nonce;
     ui64 nonce_len;
     ui8* mac;
     ui64 mac_len;
+    CipherSuite suite;
+    ui8 flags;
+    // the frame sequence number this message is sealed for
+    ui64 seq;
+
+    Message() : encrypted_data(nullptr), encrypted_len(0), nonce(nullptr), nonce_len(0), mac(nullptr), mac_len(0),
+                suite(SUITE_CHACHA20), flags(FRAME_FLAG_NONE), seq(0) {}
+
+    // encrypt with a per-peer session (key schedule already expanded) for
+    // frame seq. nonce | ciphertext | mac stay on the arena; open a
+    // TempArena around per-message work to get them back.
+    static Message create_encrypted(MemArena& arena,
+                                   std::string_view sender_name,
+                                   std::string_view msg_content,
+                                   Session& session,
+                                   ui64 seq) {
+        return from_view(MessageView::seal(arena, sender_name, as_bytes(msg_content), session, seq));
+    }
 
-    Message() : encrypted_data(nullptr), encrypted_len(0), nonce(nullptr), nonce_len(0), mac(nullptr), mac_len(0) {}
-
-    // key--derivation
-    static Message create_encrypted(MemArena& arena, 
-                                   const std::string& sender_name,
-                                   const std::string& msg_content,
+    // one-off: derives a throwaway session, random nonce
+    static Message create_encrypted(MemArena& arena,
+                                   std::string_view sender_name,
+                                   std::string_view msg_content,
                                    ui8* recipient_pk,
-                                   ui8* sender_sk) {
-        Message msg;
-        msg.sender = sender_name;
-        msg.content = msg_content;
-
-        msg.nonce = (ui8*)arena.push(CryptoEngine::get_nonce_bytes(), 0);
-        msg.nonce_len = CryptoEngine::get_nonce_bytes();
-        SimpleCrypto::random_bytes(msg.nonce, msg.nonce_len);
+                                   ui8* sender_sk,
+                                   CipherSuite suite = SUITE_CHACHA20) {
+        Session session(recipient_pk, sender_sk, suite);
+        MessageView view = MessageView::reserve(arena, msg_content.size(), suite);
+        view.sender = sender_name;
+        SimpleCrypto::random_bytes(view.nonce, CryptoEngine::get_nonce_bytes());
+        // first word is the block counter, start every message at block 0
+        memset(view.nonce, 0, 4);
+        ui8 header[FRAME_AAD_BYTES];
+        view.aad(header);
+        session.encrypt(view.body.data, view.mac, (const ui8*)msg_content.data(), msg_content.size(), view.nonce,
+                        header, sizeof(header));
+        return from_view(view);
+    }
 
-        msg.encrypted_len = msg_content.length() + CryptoEngine::get_box_mac_bytes();
-        msg.encrypted_data = (ui8*)arena.push(msg.encrypted_len, 0);
+    ui64 plaintext_len() const {
+        return encrypted_len - CryptoEngine::get_box_mac_bytes();
+    }
 
-        ui8 shared_key[32];
-        for (int i = 0; i < 32; ++i) {
-            shared_key[i] = recipient_pk[i] ^ sender_sk[i];
+    // verify + decrypt into the caller's buffer, returns the plaintext
+    // length (the body as sealed: still packed if flags say compressed).
+    // nothing is allocated and embedded NULs survive. throws if out is too
+    // small or the mac does not match (out is wiped in that case). the
+    // session's replay window is not consulted; frames off the wire go
+    // through MessageView::open_in_place instead.
+    static ui64 decrypt_into(const Message& encrypted_msg, const Session& session, ByteSpan out) {
+        ui64 len = encrypted_msg.plaintext_len();
+        if (out.len < len) {
+            throw std::length_error("Decrypt buffer too small!");
         }
+        MessageView view = encrypted_msg.as_view();
+        ui8 header[FRAME_AAD_BYTES];
+        view.aad(header);
+        if (!session.decrypt(out.data, view.body.data, len, view.mac, view.nonce, header, sizeof(header))) {
+            throw std::runtime_error("Message authentication failed!");
+        }
+        return len;
+    }
 
-        SimpleCrypto::simple_encrypt(msg.encrypted_data, 
-                                    (const ui8*)msg_content.c_str(), 
-                                    msg_content.length(), 
-                                    shared_key, 32);
+    // same, plaintext lands in the arena
+    static ByteSpan decrypt_into(MemArena& arena, const Message& encrypted_msg, const Session& session) {
+        ByteSpan out((ui8*)arena.push(encrypted_msg.plaintext_len(), 1), encrypted_msg.plaintext_len());
+        decrypt_into(encrypted_msg, session, out);
+        return out;
+    }
 
-        msg.mac = (ui8*)arena.push(CryptoEngine::get_mac_bytes(), 0);
-        msg.mac_len = CryptoEngine::get_mac_bytes();
-        SimpleCrypto::compute_auth(msg.mac, msg.encrypted_data, msg.encrypted_len - CryptoEngine::get_box_mac_bytes(), sender_sk);
+    // decrypts over the ciphertext, the returned span aliases encrypted_data.
+    // the message cannot be opened again afterwards.
+    static ByteSpan decrypt_in_place(Message& encrypted_msg, const Session& session) {
+        ByteSpan body(encrypted_msg.encrypted_data, encrypted_msg.plaintext_len());
+        decrypt_into(encrypted_msg, session, body);
+        return body;
+    }
 
-        return msg;
+    // verify + decrypt, throws if the mac does not match
+    static std::string decrypt_message(const Message& encrypted_msg, const Session& session) {
+        std::string result(encrypted_msg.plaintext_len(), '\0');
+        decrypt_into(encrypted_msg, session, ByteSpan((ui8*)&result[0], result.size()));
+        return result;
     }
 
-    // decrypt - just XOR it back
     static std::string decrypt_message(const Message& encrypted_msg,
                                       ui8* sender_pk,
                                       ui8* recipient_sk) {
-        ui64 plaintext_len = encrypted_msg.encrypted_len - CryptoEngine::get_box_mac_bytes();
-        ui8* plaintext = (ui8*)malloc(plaintext_len + 1);
-
-        ui8 shared_key[32];
-        for (int i = 0; i < 32; ++i) {
-            shared_key[i] = sender_pk[i] ^ recipient_sk[i];
-        }
-
-        SimpleCrypto::simple_decrypt(plaintext, encrypted_msg.encrypted_data, plaintext_len, shared_key, 32);
-        plaintext[plaintext_len] = '\0';
-
-        std::string result((const char*)plaintext);
-        free(plaintext);
-
-        return result;
+        Session session(sender_pk, recipient_sk, encrypted_msg.suite);
+        return decrypt_message(encrypted_msg, session);
     }
 
     std::string get_hex_representation() const {
@@ -119,6 +165,34 @@ struct Message {
         }
         return ss.str();
     }
+
+    // same bytes, no copies
+    MessageView as_view() const {
+        MessageView view;
+        view.sender = sender;
+        view.nonce = nonce;
+        view.body = ByteSpan(encrypted_data, plaintext_len());
+        view.mac = mac;
+        view.suite = suite;
+        view.flags = flags;
+        view.seq = seq;
+        return view;
+    }
+
+    static Message from_view(const MessageView& view) {
+        Message msg;
+        msg.sender = std::string(view.sender);
+        msg.suite = view.suite;
+        msg.flags = view.flags;
+        msg.seq = view.seq;
+        msg.nonce = view.nonce;
+        msg.nonce_len = CryptoEngine::get_nonce_bytes();
+        msg.encrypted_data = view.body.data;
+        msg.encrypted_len = view.body.len + CryptoEngine::get_box_mac_bytes();
+        msg.mac = view.mac;
+        msg.mac_len = CryptoEngine::get_mac_bytes();
+        return msg;
+    }
 };
 
 #endif // MESSAGE_H
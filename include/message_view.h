@@ -0,0 +1,268 @@
+#ifndef MESSAGE_VIEW_H
+#define MESSAGE_VIEW_H
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include "arena.h"
+#include "compress.h"
+#include "crypto.h"
+#include "session.h"
+
+typedef uint8_t ui8;
+typedef uint64_t ui64;
+
+// non-owning (pointer, length) view
+template <class T>
+struct Span {
+    T* data;
+    ui64 len;
+
+    constexpr Span() : data(nullptr), len(0) {}
+    constexpr Span(T* data_, ui64 len_) : data(data_), len(len_) {}
+
+    // mutable -> const
+    template <class U>
+    constexpr Span(const Span<U>& other) : data(other.data), len(other.len) {}
+
+    T* begin() const { return data; }
+    T* end() const { return data + len; }
+    bool empty() const { return len == 0; }
+    T& operator[](ui64 i) const { return data[i]; }
+
+    Span sub(ui64 off, ui64 n) const {
+        return Span(data + off, n);
+    }
+};
+
+typedef Span<ui8> ByteSpan;
+typedef Span<const ui8> ConstByteSpan;
+
+inline ConstByteSpan as_bytes(std::string_view s) {
+    return ConstByteSpan((const ui8*)s.data(), s.size());
+}
+
+#define FRAME_VERSION 1
+// leading frame header bytes every seal authenticates (see frame.h)
+#define FRAME_AAD_BYTES 16
+
+// per-message bits, carried in the frame header
+enum FrameFlags : ui8 {
+    FRAME_FLAG_NONE = 0,
+    // body is Compressor::pack output, unpack after opening
+    FRAME_FLAG_COMPRESSED = 1 << 0,
+    FRAME_FLAG_MASK = FRAME_FLAG_COMPRESSED,
+};
+
+// a message as spans over memory someone else owns: the arena for outgoing
+// messages, the receive buffer for incoming ones. nonce, body and mac are
+// one contiguous run, so the wire bytes need no assembly:
+//
+//   nonce (16) | body (len) | mac (16)
+//
+// body holds ciphertext, or plaintext after open_in_place / before
+// seal_in_place. nothing is copied into owning strings; call wipe() once
+// the plaintext has been consumed.
+//
+// the mac also covers the frame header fields in front of the nonce
+// (version, flags, suite, length, seq; see aad()), so flags and seq are
+// fixed when the message is sealed: a frame can't be replayed under
+// another seq or have its compressed bit flipped on the way.
+struct MessageView {
+    std::string_view sender;
+    ui8* nonce;
+    ByteSpan body;
+    ui8* mac;
+    CipherSuite suite;
+    ui8 flags;
+    // the frame sequence number this message is sealed for
+    ui64 seq;
+
+    MessageView() : nonce(nullptr), mac(nullptr), suite(SUITE_CHACHA20), flags(FRAME_FLAG_NONE), seq(0) {}
+
+    static constexpr ui64 overhead() {
+        return CryptoEngine::get_nonce_bytes() + CryptoEngine::get_box_mac_bytes();
+    }
+
+    static constexpr ui64 wire_size(ui64 body_len) {
+        return body_len + overhead();
+    }
+
+    // room for a body_len message in the arena. write the plaintext into
+    // body, then seal_in_place.
+    static MessageView reserve(MemArena& arena, ui64 body_len, CipherSuite suite) {
+        ui8* wire = (ui8*)arena.push(wire_size(body_len), 1);
+        MessageView view;
+        view.bind(wire, body_len, suite);
+        return view;
+    }
+
+    // encrypts straight from the caller's buffer into the arena, the
+    // plaintext itself is never copied. flags describe the plaintext as
+    // given (FRAME_FLAG_COMPRESSED for an already packed body).
+    static MessageView seal(MemArena& arena, std::string_view sender_name,
+                            ConstByteSpan plaintext, Session& session, ui64 seq,
+                            ui8 flags = FRAME_FLAG_NONE) {
+        MessageView view = reserve(arena, plaintext.len, session.get_suite());
+        view.sender = sender_name;
+        view.flags = flags;
+        view.seq = seq;
+        view.encrypt_from(session, plaintext.data);
+        return view;
+    }
+
+    // same, into caller-owned wire memory of exactly wire_size(plaintext.len)
+    // bytes (a slab block, a send buffer)
+    static MessageView seal_into(ByteSpan wire, std::string_view sender_name,
+                                 ConstByteSpan plaintext, Session& session, ui64 seq,
+                                 ui8 flags = FRAME_FLAG_NONE) {
+        MessageView view;
+        view.bind(wire.data, wire.len - overhead(), session.get_suite());
+        view.sender = sender_name;
+        view.flags = flags;
+        view.seq = seq;
+        view.encrypt_from(session, plaintext.data);
+        return view;
+    }
+
+    // same as seal, but a chacha20 session only draws the nonce and fills
+    // job: body and mac are written once a window of jobs goes through
+    // SimpleCrypto::seal_batch. other suites are sealed here. true if job
+    // was filled.
+    static bool seal_later(MemArena& arena, std::string_view sender_name, ConstByteSpan plaintext,
+                           Session& session, ui64 seq, ui8 flags, MessageView& view, CryptoJob& job) {
+        view = reserve(arena, plaintext.len, session.get_suite());
+        view.sender = sender_name;
+        view.flags = flags;
+        view.seq = seq;
+        if (session.get_suite() != SUITE_CHACHA20) {
+            view.encrypt_from(session, plaintext.data);
+            return false;
+        }
+        ui8* header = (ui8*)arena.push(FRAME_AAD_BYTES, 1);
+        view.aad(header);
+        session.next_nonce(view.nonce);
+        job = CryptoJob();
+        job.input = plaintext.data;
+        job.output = view.body.data;
+        job.len = plaintext.len;
+        job.mac = view.mac;
+        job.schedule = session.get_schedule();
+        job.nonce = view.nonce;
+        job.aad = header;
+        job.aad_len = FRAME_AAD_BYTES;
+        return true;
+    }
+
+    // compresses into the arena first when the payload looks compressible
+    // and actually shrinks, so the cipher and the wire see fewer bytes.
+    // otherwise the same as seal.
+    static MessageView seal_compressed(MemArena& arena, std::string_view sender_name,
+                                       ConstByteSpan plaintext, Session& session, ui64 seq) {
+        if (Compressor::looks_compressible(plaintext.data, plaintext.len)) {
+            ui64 cap = COMPRESS_HEADER_BYTES + Compressor::bound(plaintext.len);
+            ui64 arena_mark = arena.get_pos();
+            MessageView view = reserve(arena, cap, session.get_suite());
+            ui64 packed = Compressor::pack(view.body.data, cap, plaintext.data, plaintext.len);
+            if (packed != 0) {
+                // hand back the slack at the end of the allocation
+                arena.pop(cap - packed);
+                view.bind(view.nonce, packed, view.suite);
+                view.sender = sender_name;
+                view.flags = FRAME_FLAG_COMPRESSED;
+                view.seq = seq;
+                view.seal_in_place(session);
+                return view;
+            }
+            arena.pop(arena.get_pos() - arena_mark);
+        }
+        return seal(arena, sender_name, plaintext, session, seq);
+    }
+
+    // view over received wire bytes, false if too short to be a message
+    static bool parse(ByteSpan wire, CipherSuite suite, MessageView& out) {
+        if (wire.len < overhead()) return false;
+        out.bind(wire.data, wire.len - overhead(), suite);
+        return true;
+    }
+
+    // for the frame seq and flags already set on the view
+    void seal_in_place(Session& session) {
+        suite = session.get_suite();
+        encrypt_from(session, body.data);
+    }
+
+    // the frame header fields the mac covers, as frame.h lays them out
+    void aad(ui8 out[FRAME_AAD_BYTES]) const {
+        out[0] = FRAME_VERSION;
+        out[1] = flags;
+        out[2] = (ui8)suite;
+        out[3] = 0;
+        for (int i = 0; i < 4; ++i) out[4 + i] = (ui8)(body.len >> (8 * i));
+        for (int i = 0; i < 8; ++i) out[8 + i] = (ui8)(seq >> (8 * i));
+    }
+
+    // on success body is plaintext. false on a bad mac (body wiped) or a
+    // nonce the peer has used before.
+    bool open_in_place(Session& session) {
+        ui8 header[FRAME_AAD_BYTES];
+        aad(header);
+        return session.open_next(body.data, body.data, body.len, mac, nonce, header, sizeof(header));
+    }
+
+    // plaintext into out (at least body.len bytes), the wire bytes stay
+    // intact. false on a short buffer, a bad mac or a reused nonce.
+    bool open_into(Session& session, ByteSpan out) const {
+        if (out.len < body.len) return false;
+        ui8 header[FRAME_AAD_BYTES];
+        aad(header);
+        return session.open_next(out.data, body.data, body.len, mac, nonce, header, sizeof(header));
+    }
+
+    // after opening: the plaintext, inflated into out if the body is
+    // compressed, else the body itself. empty span on a malformed body.
+    ConstByteSpan payload(ByteSpan out) const {
+        if (!(flags & FRAME_FLAG_COMPRESSED)) return body;
+        ui64 len = 0;
+        if (!Compressor::unpack(out.data, out.len, len, body.data, body.len)) return ConstByteSpan();
+        return ConstByteSpan(out.data, len);
+    }
+
+    // after opening: how big out has to be for payload(), 0 if the body
+    // is not compressed
+    ui64 inflated_len() const {
+        if (!(flags & FRAME_FLAG_COMPRESSED) || body.len < COMPRESS_HEADER_BYTES) return 0;
+        ui64 len = 0;
+        for (int i = 0; i < 4; ++i) len |= (ui64)body.data[i] << (8 * i);
+        return len;
+    }
+
+    ByteSpan wire() const {
+        return ByteSpan(nonce, wire_size(body.len));
+    }
+
+    std::string_view text() const {
+        return std::string_view((const char*)body.data, body.len);
+    }
+
+    void wipe() {
+        memset(body.data, 0, body.len);
+    }
+
+private:
+    void encrypt_from(Session& session, const ui8* plaintext) {
+        ui8 header[FRAME_AAD_BYTES];
+        aad(header);
+        session.next_nonce(nonce);
+        session.encrypt(body.data, mac, plaintext, body.len, nonce, header, sizeof(header));
+    }
+
+    void bind(ui8* wire, ui64 body_len, CipherSuite suite_) {
+        nonce = wire;
+        body = ByteSpan(wire + CryptoEngine::get_nonce_bytes(), body_len);
+        mac = body.data + body_len;
+        suite = suite_;
+    }
+};
+
+#endif // MESSAGE_VIEW_H
@@ -0,0 +1,151 @@
+#ifndef NET_H
+#define NET_H
+
+#include <cstdint>
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#endif
+
+typedef uint8_t ui8;
+typedef uint64_t ui64;
+typedef int64_t i64;
+
+#ifdef _WIN32
+typedef SOCKET socket_t;
+#else
+typedef int socket_t;
+#endif
+
+// max slices per gather call: a frame is header + payload, a room relay
+// batches up to half this many frames into one call
+#define NET_MAX_SLICES 64
+
+// one piece of a gathered send
+struct IoSlice {
+    const ui8* data;
+    ui64 len;
+};
+
+// sends every slice in order with one writev-style call per attempt
+// (WSASend on windows, sendmsg elsewhere). partial writes resume where they
+// stopped. false on a socket error.
+inline bool send_gather(socket_t sock, const IoSlice* slices, int count) {
+    if (count <= 0) return true;
+    if (count > NET_MAX_SLICES) return false;
+
+#ifdef _WIN32
+    WSABUF bufs[NET_MAX_SLICES];
+#else
+    struct iovec bufs[NET_MAX_SLICES];
+#endif
+    for (int i = 0; i < count; ++i) {
+#ifdef _WIN32
+        bufs[i].buf = (CHAR*)slices[i].data;
+        bufs[i].len = (ULONG)slices[i].len;
+#else
+        bufs[i].iov_base = (void*)slices[i].data;
+        bufs[i].iov_len = (size_t)slices[i].len;
+#endif
+    }
+
+    int first = 0;
+    while (first < count) {
+#ifdef _WIN32
+        DWORD sent = 0;
+        if (WSASend(sock, bufs + first, (DWORD)(count - first), &sent, 0, nullptr, nullptr) == SOCKET_ERROR) {
+            int error = WSAGetLastError();
+            if (error == WSAEWOULDBLOCK || error == WSAEINTR) {
+                Sleep(1);
+                continue;
+            }
+            return false;
+        }
+        ui64 left = sent;
+        while (first < count && left >= bufs[first].len) {
+            left -= bufs[first].len;
+            ++first;
+        }
+        if (first < count) {
+            bufs[first].buf += left;
+            bufs[first].len -= (ULONG)left;
+        }
+#else
+        struct msghdr msg = {};
+        msg.msg_iov = bufs + first;
+        msg.msg_iovlen = (size_t)(count - first);
+        ssize_t sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+                usleep(1000);
+                continue;
+            }
+            return false;
+        }
+        ui64 left = (ui64)sent;
+        while (first < count && left >= bufs[first].iov_len) {
+            left -= bufs[first].iov_len;
+            ++first;
+        }
+        if (first < count) {
+            bufs[first].iov_base = (ui8*)bufs[first].iov_base + left;
+            bufs[first].iov_len -= (size_t)left;
+        }
+#endif
+    }
+    return true;
+}
+
+// one gathered write on a non-blocking socket: bytes the kernel took, 0 if
+// it would block, -1 on a socket error. the caller keeps the rest.
+inline i64 send_gather_some(socket_t sock, const IoSlice* slices, int count) {
+    if (count <= 0) return 0;
+    if (count > NET_MAX_SLICES) return -1;
+
+#ifdef _WIN32
+    WSABUF bufs[NET_MAX_SLICES];
+    for (int i = 0; i < count; ++i) {
+        bufs[i].buf = (CHAR*)slices[i].data;
+        bufs[i].len = (ULONG)slices[i].len;
+    }
+    for (;;) {
+        DWORD sent = 0;
+        if (WSASend(sock, bufs, (DWORD)count, &sent, 0, nullptr, nullptr) != SOCKET_ERROR) return (i64)sent;
+        int error = WSAGetLastError();
+        if (error == WSAEINTR) continue;
+        return error == WSAEWOULDBLOCK ? 0 : -1;
+    }
+#else
+    struct iovec bufs[NET_MAX_SLICES];
+    for (int i = 0; i < count; ++i) {
+        bufs[i].iov_base = (void*)slices[i].data;
+        bufs[i].iov_len = (size_t)slices[i].len;
+    }
+    struct msghdr msg = {};
+    msg.msg_iov = bufs;
+    msg.msg_iovlen = (size_t)count;
+    for (;;) {
+        ssize_t sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (sent >= 0) return (i64)sent;
+        if (errno == EINTR) continue;
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+#endif
+}
+
+inline bool set_nonblocking(socket_t sock) {
+#ifdef _WIN32
+    u_long on = 1;
+    return ioctlsocket(sock, FIONBIO, &on) == 0;
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    return flags >= 0 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+#endif // NET_H
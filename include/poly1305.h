@@ -0,0 +1,444 @@
+#ifndef POLY1305_H
+#define POLY1305_H
+
+#include <cstdint>
+#include <cstring>
+#include "chacha.h"
+
+typedef uint8_t ui8;
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+#define POLY1305_KEY_BYTES 32
+#define POLY1305_MAC_BYTES 16
+#define POLY1305_BLOCK_BYTES 16
+// below this many blocks per update the scalar loop wins over the avx2 setup
+#define POLY1305_AVX2_MIN_BLOCKS 16
+
+// one-time authenticator, 26-bit limbs (donna-32 layout) shared by the
+// scalar loop and the 4-lane avx2 multi-block path
+class Poly1305 {
+private:
+    ui32 r[5];
+    ui32 h[5];
+    ui32 pad[4];
+    ui32 rpow[3][5]; // r^2, r^3, r^4 for the avx2 path
+    bool have_powers;
+    ui8 buffer[POLY1305_BLOCK_BYTES];
+    ui64 leftover;
+
+public:
+    Poly1305() : have_powers(false), leftover(0) {
+        memset(r, 0, sizeof(r));
+        memset(h, 0, sizeof(h));
+        memset(pad, 0, sizeof(pad));
+    }
+
+    explicit Poly1305(const ui8* key) : Poly1305() {
+        init(key);
+    }
+
+    ~Poly1305() {
+        wipe();
+    }
+
+    void init(const ui8* key) {
+        load_key(r, pad, key);
+        memset(h, 0, sizeof(h));
+        have_powers = false;
+        leftover = 0;
+    }
+
+    void update(const ui8* data, ui64 len) {
+        if (leftover) {
+            ui64 want = POLY1305_BLOCK_BYTES - leftover;
+            if (want > len) want = len;
+            memcpy(buffer + leftover, data, want);
+            leftover += want;
+            data += want;
+            len -= want;
+            if (leftover < POLY1305_BLOCK_BYTES) return;
+            blocks(buffer, 1, 1u << 24);
+            leftover = 0;
+        }
+
+        ui64 full = len / POLY1305_BLOCK_BYTES;
+#if CHACHA_X86_SIMD
+        if (full >= POLY1305_AVX2_MIN_BLOCKS && ChaCha20::active_kernel() == CHACHA_KERNEL_AVX2) {
+            ui64 vec = full & ~(ui64)3;
+            blocks_avx2(data, vec / 4);
+            data += vec * POLY1305_BLOCK_BYTES;
+            len -= vec * POLY1305_BLOCK_BYTES;
+            full -= vec;
+        }
+#endif
+        if (full) {
+            blocks(data, full, 1u << 24);
+            data += full * POLY1305_BLOCK_BYTES;
+            len -= full * POLY1305_BLOCK_BYTES;
+        }
+
+        if (len) {
+            memcpy(buffer, data, len);
+            leftover = len;
+        }
+    }
+
+    // zero-pad to the next 16-byte boundary (aead framing)
+    void pad16() {
+        if (leftover) {
+            memset(buffer + leftover, 0, POLY1305_BLOCK_BYTES - leftover);
+            blocks(buffer, 1, 1u << 24);
+            leftover = 0;
+        }
+    }
+
+    void finish(ui8 mac[POLY1305_MAC_BYTES]) {
+        if (leftover) {
+            buffer[leftover] = 1;
+            memset(buffer + leftover + 1, 0, POLY1305_BLOCK_BYTES - leftover - 1);
+            blocks(buffer, 1, 0);
+            leftover = 0;
+        }
+
+        emit(mac, h, pad);
+        wipe();
+    }
+
+    static void auth(ui8 mac[POLY1305_MAC_BYTES], const ui8* data, ui64 len, const ui8* key) {
+        Poly1305 st(key);
+        st.update(data, len);
+        st.finish(mac);
+    }
+
+    // constant-time tag comparison
+    static bool verify(const ui8* a, const ui8* b) {
+        ui32 diff = 0;
+        for (int i = 0; i < POLY1305_MAC_BYTES; ++i) {
+            diff |= (ui32)(a[i] ^ b[i]);
+        }
+        return ((diff - 1) >> 8) & 1;
+    }
+
+    // clamp r, split off the s half of a one-time key
+    static void load_key(ui32 r_out[5], ui32 pad_out[4], const ui8* key) {
+        r_out[0] = (ChaCha20::load32(key + 0)) & 0x3ffffff;
+        r_out[1] = (ChaCha20::load32(key + 3) >> 2) & 0x3ffff03;
+        r_out[2] = (ChaCha20::load32(key + 6) >> 4) & 0x3ffc0ff;
+        r_out[3] = (ChaCha20::load32(key + 9) >> 6) & 0x3f03fff;
+        r_out[4] = (ChaCha20::load32(key + 12) >> 8) & 0x00fffff;
+        for (int i = 0; i < 4; ++i) {
+            pad_out[i] = ChaCha20::load32(key + 16 + 4 * i);
+        }
+    }
+
+    // full reduction of the accumulator, + s, serialize
+    static void emit(ui8 mac[POLY1305_MAC_BYTES], const ui32 acc[5], const ui32 pad[4]) {
+        ui32 h0 = acc[0], h1 = acc[1], h2 = acc[2], h3 = acc[3], h4 = acc[4];
+        ui32 c;
+        c = h1 >> 26; h1 &= 0x3ffffff;
+        h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+        h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+        h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+        h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+        h1 += c;
+
+        // g = h + -p, pick h or g without branching
+        ui32 g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+        ui32 g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+        ui32 g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+        ui32 g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+        ui32 g4 = h4 + c - (1u << 26);
+
+        ui32 mask = (g4 >> 31) - 1;
+        g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+        mask = ~mask;
+        h0 = (h0 & mask) | g0;
+        h1 = (h1 & mask) | g1;
+        h2 = (h2 & mask) | g2;
+        h3 = (h3 & mask) | g3;
+        h4 = (h4 & mask) | g4;
+
+        h0 = (h0) | (h1 << 26);
+        h1 = (h1 >> 6) | (h2 << 20);
+        h2 = (h2 >> 12) | (h3 << 14);
+        h3 = (h3 >> 18) | (h4 << 8);
+
+        ui64 f;
+        f = (ui64)h0 + pad[0]; h0 = (ui32)f;
+        f = (ui64)h1 + pad[1] + (f >> 32); h1 = (ui32)f;
+        f = (ui64)h2 + pad[2] + (f >> 32); h2 = (ui32)f;
+        f = (ui64)h3 + pad[3] + (f >> 32); h3 = (ui32)f;
+
+        ChaCha20::store32(mac + 0, h0);
+        ChaCha20::store32(mac + 4, h1);
+        ChaCha20::store32(mac + 8, h2);
+        ChaCha20::store32(mac + 12, h3);
+    }
+
+    // rfc 8439 aead tags for up to 4 unrelated messages at once. lane k
+    // macs aads[k] and cts[k], each zero-padded to 16 bytes, then the
+    // lengths block. aads may be null when no lane has any.
+    static void aead_tags_x4(ui8* const macs[4], const ui8* const keys[4], const ui8* const aads[4],
+                             const ui64 aad_lens[4], const ui8* const cts[4], const ui64 lens[4], int lanes) {
+#if CHACHA_X86_SIMD
+        if (lanes > 1 && ChaCha20::active_kernel() == CHACHA_KERNEL_AVX2) {
+            aead_tags_x4_avx2(macs, keys, aads, aad_lens, cts, lens, lanes);
+            return;
+        }
+#endif
+        for (int k = 0; k < lanes; ++k) {
+            ui8 tail[POLY1305_BLOCK_BYTES];
+            ui64 aad_len = aads != nullptr ? aad_lens[k] : 0;
+            Poly1305 st(keys[k]);
+            if (aad_len) {
+                st.update(aads[k], aad_len);
+                st.pad16();
+            }
+            st.update(cts[k], lens[k]);
+            st.pad16();
+            aead_lengths_block(tail, aad_len, lens[k]);
+            st.update(tail, sizeof(tail));
+            st.finish(macs[k]);
+        }
+    }
+
+    static void aead_lengths_block(ui8 out[POLY1305_BLOCK_BYTES], ui64 aad_len, ui64 len) {
+        for (int i = 0; i < 8; ++i) {
+            out[i] = (ui8)(aad_len >> (8 * i));
+            out[8 + i] = (ui8)(len >> (8 * i));
+        }
+    }
+
+private:
+    void wipe() {
+        volatile ui8* p = (volatile ui8*)this;
+        for (ui64 i = 0; i < sizeof(*this); ++i) p[i] = 0;
+    }
+
+    // out = a * b mod 2^130-5, partially reduced
+    static void mul(ui32 out[5], const ui32 a[5], const ui32 b[5]) {
+        ui32 s1 = b[1] * 5, s2 = b[2] * 5, s3 = b[3] * 5, s4 = b[4] * 5;
+        ui64 d0 = (ui64)a[0] * b[0] + (ui64)a[1] * s4 + (ui64)a[2] * s3 + (ui64)a[3] * s2 + (ui64)a[4] * s1;
+        ui64 d1 = (ui64)a[0] * b[1] + (ui64)a[1] * b[0] + (ui64)a[2] * s4 + (ui64)a[3] * s3 + (ui64)a[4] * s2;
+        ui64 d2 = (ui64)a[0] * b[2] + (ui64)a[1] * b[1] + (ui64)a[2] * b[0] + (ui64)a[3] * s4 + (ui64)a[4] * s3;
+        ui64 d3 = (ui64)a[0] * b[3] + (ui64)a[1] * b[2] + (ui64)a[2] * b[1] + (ui64)a[3] * b[0] + (ui64)a[4] * s4;
+        ui64 d4 = (ui64)a[0] * b[4] + (ui64)a[1] * b[3] + (ui64)a[2] * b[2] + (ui64)a[3] * b[1] + (ui64)a[4] * b[0];
+        ui32 c;
+        c = (ui32)(d0 >> 26); out[0] = (ui32)d0 & 0x3ffffff;
+        d1 += c; c = (ui32)(d1 >> 26); out[1] = (ui32)d1 & 0x3ffffff;
+        d2 += c; c = (ui32)(d2 >> 26); out[2] = (ui32)d2 & 0x3ffffff;
+        d3 += c; c = (ui32)(d3 >> 26); out[3] = (ui32)d3 & 0x3ffffff;
+        d4 += c; c = (ui32)(d4 >> 26); out[4] = (ui32)d4 & 0x3ffffff;
+        out[0] += c * 5; c = out[0] >> 26; out[0] &= 0x3ffffff;
+        out[1] += c;
+    }
+
+    void blocks(const ui8* m, ui64 count, ui32 hibit) {
+        for (ui64 i = 0; i < count; ++i) {
+            h[0] += (ChaCha20::load32(m + 0)) & 0x3ffffff;
+            h[1] += (ChaCha20::load32(m + 3) >> 2) & 0x3ffffff;
+            h[2] += (ChaCha20::load32(m + 6) >> 4) & 0x3ffffff;
+            h[3] += (ChaCha20::load32(m + 9) >> 6) & 0x3ffffff;
+            h[4] += (ChaCha20::load32(m + 12) >> 8) | hibit;
+            mul(h, h, r);
+            m += POLY1305_BLOCK_BYTES;
+        }
+    }
+
+#if CHACHA_X86_SIMD
+    static inline void load_limbs(ui64 out[5], const ui8* m) {
+        ui64 lo, hi;
+        memcpy(&lo, m, 8);
+        memcpy(&hi, m + 8, 8);
+        out[0] = lo & 0x3ffffff;
+        out[1] = (lo >> 26) & 0x3ffffff;
+        out[2] = ((lo >> 52) | (hi << 12)) & 0x3ffffff;
+        out[3] = (hi >> 14) & 0x3ffffff;
+        out[4] = (hi >> 40) | (1u << 24);
+    }
+
+    CHACHA_TARGET("avx2")
+    static inline __m256i load_lane_limb(const ui64 lanes[4][5], int limb) {
+        return _mm256_set_epi64x((long long)lanes[3][limb], (long long)lanes[2][limb],
+                                 (long long)lanes[1][limb], (long long)lanes[0][limb]);
+    }
+
+    CHACHA_TARGET("avx2")
+    static inline void mul_avx2(__m256i x[5], const __m256i b[5], const __m256i s[5]) {
+        __m256i d0 = _mm256_mul_epu32(x[0], b[0]);
+        d0 = _mm256_add_epi64(d0, _mm256_mul_epu32(x[1], s[4]));
+        d0 = _mm256_add_epi64(d0, _mm256_mul_epu32(x[2], s[3]));
+        d0 = _mm256_add_epi64(d0, _mm256_mul_epu32(x[3], s[2]));
+        d0 = _mm256_add_epi64(d0, _mm256_mul_epu32(x[4], s[1]));
+        __m256i d1 = _mm256_mul_epu32(x[0], b[1]);
+        d1 = _mm256_add_epi64(d1, _mm256_mul_epu32(x[1], b[0]));
+        d1 = _mm256_add_epi64(d1, _mm256_mul_epu32(x[2], s[4]));
+        d1 = _mm256_add_epi64(d1, _mm256_mul_epu32(x[3], s[3]));
+        d1 = _mm256_add_epi64(d1, _mm256_mul_epu32(x[4], s[2]));
+        __m256i d2 = _mm256_mul_epu32(x[0], b[2]);
+        d2 = _mm256_add_epi64(d2, _mm256_mul_epu32(x[1], b[1]));
+        d2 = _mm256_add_epi64(d2, _mm256_mul_epu32(x[2], b[0]));
+        d2 = _mm256_add_epi64(d2, _mm256_mul_epu32(x[3], s[4]));
+        d2 = _mm256_add_epi64(d2, _mm256_mul_epu32(x[4], s[3]));
+        __m256i d3 = _mm256_mul_epu32(x[0], b[3]);
+        d3 = _mm256_add_epi64(d3, _mm256_mul_epu32(x[1], b[2]));
+        d3 = _mm256_add_epi64(d3, _mm256_mul_epu32(x[2], b[1]));
+        d3 = _mm256_add_epi64(d3, _mm256_mul_epu32(x[3], b[0]));
+        d3 = _mm256_add_epi64(d3, _mm256_mul_epu32(x[4], s[4]));
+        __m256i d4 = _mm256_mul_epu32(x[0], b[4]);
+        d4 = _mm256_add_epi64(d4, _mm256_mul_epu32(x[1], b[3]));
+        d4 = _mm256_add_epi64(d4, _mm256_mul_epu32(x[2], b[2]));
+        d4 = _mm256_add_epi64(d4, _mm256_mul_epu32(x[3], b[1]));
+        d4 = _mm256_add_epi64(d4, _mm256_mul_epu32(x[4], b[0]));
+
+        const __m256i mask = _mm256_set1_epi64x(0x3ffffff);
+        __m256i c;
+        c = _mm256_srli_epi64(d0, 26); x[0] = _mm256_and_si256(d0, mask);
+        d1 = _mm256_add_epi64(d1, c); c = _mm256_srli_epi64(d1, 26); x[1] = _mm256_and_si256(d1, mask);
+        d2 = _mm256_add_epi64(d2, c); c = _mm256_srli_epi64(d2, 26); x[2] = _mm256_and_si256(d2, mask);
+        d3 = _mm256_add_epi64(d3, c); c = _mm256_srli_epi64(d3, 26); x[3] = _mm256_and_si256(d3, mask);
+        d4 = _mm256_add_epi64(d4, c); c = _mm256_srli_epi64(d4, 26); x[4] = _mm256_and_si256(d4, mask);
+        x[0] = _mm256_add_epi64(x[0], _mm256_add_epi64(c, _mm256_slli_epi64(c, 2)));
+        c = _mm256_srli_epi64(x[0], 26); x[0] = _mm256_and_si256(x[0], mask);
+        x[1] = _mm256_add_epi64(x[1], c);
+    }
+
+    // 4 interleaved accumulators: lane k takes blocks k, k+4, ... and the
+    // last group is multiplied by (r^4, r^3, r^2, r) before folding lanes
+    CHACHA_TARGET("avx2")
+    void blocks_avx2(const ui8* m, ui64 groups) {
+        if (!have_powers) {
+            mul(rpow[0], r, r);
+            mul(rpow[1], rpow[0], r);
+            mul(rpow[2], rpow[1], r);
+            have_powers = true;
+        }
+
+        __m256i r4[5], s4[5], rf[5], sf[5], x[5];
+        for (int i = 0; i < 5; ++i) {
+            r4[i] = _mm256_set1_epi64x(rpow[2][i]);
+            s4[i] = _mm256_set1_epi64x((ui64)rpow[2][i] * 5);
+            rf[i] = _mm256_set_epi64x(r[i], rpow[0][i], rpow[1][i], rpow[2][i]);
+            sf[i] = _mm256_mul_epu32(rf[i], _mm256_set1_epi64x(5));
+            x[i] = _mm256_set_epi64x(0, 0, 0, h[i]);
+        }
+
+        alignas(32) ui64 lanes[4][5];
+        for (ui64 g = 0; g < groups; ++g) {
+            for (int k = 0; k < 4; ++k) {
+                load_limbs(lanes[k], m + POLY1305_BLOCK_BYTES * k);
+            }
+            for (int i = 0; i < 5; ++i) {
+                x[i] = _mm256_add_epi64(x[i], load_lane_limb(lanes, i));
+            }
+            if (g + 1 < groups) {
+                mul_avx2(x, r4, s4);
+            } else {
+                mul_avx2(x, rf, sf);
+            }
+            m += 4 * POLY1305_BLOCK_BYTES;
+        }
+
+        alignas(32) ui64 sum[4];
+        ui64 d[5];
+        for (int i = 0; i < 5; ++i) {
+            _mm256_store_si256((__m256i*)sum, x[i]);
+            d[i] = sum[0] + sum[1] + sum[2] + sum[3];
+        }
+        ui64 c;
+        c = d[0] >> 26; h[0] = (ui32)d[0] & 0x3ffffff;
+        d[1] += c; c = d[1] >> 26; h[1] = (ui32)d[1] & 0x3ffffff;
+        d[2] += c; c = d[2] >> 26; h[2] = (ui32)d[2] & 0x3ffffff;
+        d[3] += c; c = d[3] >> 26; h[3] = (ui32)d[3] & 0x3ffffff;
+        d[4] += c; c = d[4] >> 26; h[4] = (ui32)d[4] & 0x3ffffff;
+        h[0] += (ui32)c * 5; c = h[0] >> 26; h[0] &= 0x3ffffff;
+        h[1] += (ui32)c;
+        memset(lanes, 0, sizeof(lanes));
+    }
+
+    // block i of data zero-padded to whole blocks: a pointer into data, or
+    // a copy of the tail in scratch
+    static const ui8* padded_block(ui8 scratch[POLY1305_BLOCK_BYTES], const ui8* data, ui64 len, ui64 i) {
+        ui64 off = i * POLY1305_BLOCK_BYTES;
+        if (off + POLY1305_BLOCK_BYTES <= len) return data + off;
+        memcpy(scratch, data + off, len - off);
+        memset(scratch + (len - off), 0, POLY1305_BLOCK_BYTES - (len - off));
+        return scratch;
+    }
+
+    static ui64 block_count(ui64 len) {
+        return (len + POLY1305_BLOCK_BYTES - 1) / POLY1305_BLOCK_BYTES;
+    }
+
+    // lanes step through their blocks (aad, ciphertext, lengths) in
+    // lockstep; a lane that has run out multiplies by 1 with a zero block
+    // so its accumulator stays put
+    CHACHA_TARGET("avx2")
+    static void aead_tags_x4_avx2(ui8* const macs[4], const ui8* const keys[4], const ui8* const aads[4],
+                                  const ui64 aad_lens[4], const ui8* const cts[4], const ui64 lens[4],
+                                  int lanes) {
+        ui32 rr[4][5], pp[4][4];
+        ui64 total[4], aad_blocks[4], steps = 0;
+        for (int k = 0; k < 4; ++k) {
+            aad_blocks[k] = 0;
+            if (k < lanes) {
+                load_key(rr[k], pp[k], keys[k]);
+                if (aads != nullptr) aad_blocks[k] = block_count(aad_lens[k]);
+                total[k] = aad_blocks[k] + block_count(lens[k]) + 1;
+            } else {
+                memset(rr[k], 0, sizeof(rr[k]));
+                total[k] = 0;
+            }
+            if (total[k] > steps) steps = total[k];
+        }
+
+        __m256i x[5], b[5], sv[5];
+        for (int i = 0; i < 5; ++i) x[i] = _mm256_setzero_si256();
+
+        alignas(32) ui64 limbs[4][5];
+        ui8 block[POLY1305_BLOCK_BYTES];
+        for (ui64 t = 0; t < steps; ++t) {
+            ui32 mult[4][5];
+            for (int k = 0; k < 4; ++k) {
+                if (t >= total[k]) {
+                    memset(limbs[k], 0, sizeof(limbs[k]));
+                    memset(mult[k], 0, sizeof(mult[k]));
+                    mult[k][0] = 1;
+                    continue;
+                }
+                const ui8* m = block;
+                if (t == total[k] - 1) {
+                    aead_lengths_block(block, aads != nullptr ? aad_lens[k] : 0, lens[k]);
+                } else if (t < aad_blocks[k]) {
+                    m = padded_block(block, aads[k], aad_lens[k], t);
+                } else {
+                    m = padded_block(block, cts[k], lens[k], t - aad_blocks[k]);
+                }
+                load_limbs(limbs[k], m);
+                memcpy(mult[k], rr[k], sizeof(mult[k]));
+            }
+            for (int i = 0; i < 5; ++i) {
+                x[i] = _mm256_add_epi64(x[i], load_lane_limb(limbs, i));
+                b[i] = _mm256_set_epi64x(mult[3][i], mult[2][i], mult[1][i], mult[0][i]);
+                sv[i] = _mm256_mul_epu32(b[i], _mm256_set1_epi64x(5));
+            }
+            mul_avx2(x, b, sv);
+        }
+
+        alignas(32) ui64 out[5][4];
+        for (int i = 0; i < 5; ++i) {
+            _mm256_store_si256((__m256i*)out[i], x[i]);
+        }
+        for (int k = 0; k < lanes; ++k) {
+            ui32 acc[5];
+            for (int i = 0; i < 5; ++i) acc[i] = (ui32)out[i][k];
+            emit(macs[k], acc, pp[k]);
+        }
+        memset(rr, 0, sizeof(rr));
+        memset(pp, 0, sizeof(pp));
+    }
+#endif
+};
+
+#endif // POLY1305_H
@@ -0,0 +1,150 @@
+#ifndef ROOM_H
+#define ROOM_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "conn.h"
+#include "message_view.h"
+
+typedef uint8_t ui8;
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+#define ROOM_MAX_NAME 64
+
+// a message waiting to be relayed at the end of the round: plaintext,
+// already compressed (flags) if that paid off, owned by the round arena
+// (or by a shard batch; from is nullptr then)
+struct RoomMessage {
+    const Connection* from;
+    ConstByteSpan body;
+    ui8 flags;
+};
+
+// one member's sealed copy of a room message, waiting for its write
+struct RoomFrame {
+    Connection* to;
+    MessageView view;
+};
+
+struct Room {
+    std::string name;
+    std::vector<Connection*> members;
+    std::vector<RoomMessage> pending;
+};
+
+// named rooms. a connection is in at most one: it keeps the room id and
+// its index in members, so join and leave are O(1). messages posted
+// during a round are held per room and handed out by drain() once the
+// round is over, so every member gets the whole round in one write.
+// single-threaded, owned by the server loop.
+class RoomDirectory {
+private:
+    std::unordered_map<std::string, ui32> by_name;
+    // node-based: a Room& stays valid while others come and go
+    std::unordered_map<ui32, Room> rooms;
+    // rooms with pending messages, in posting order
+    std::vector<ui32> active;
+    ui32 next_id;
+
+    void erase_if_idle(ui32 id) {
+        auto it = rooms.find(id);
+        if (it == rooms.end() || !it->second.members.empty() || !it->second.pending.empty()) return;
+        by_name.erase(it->second.name);
+        rooms.erase(it);
+    }
+
+public:
+    RoomDirectory() : next_id(0) {}
+
+    RoomDirectory(const RoomDirectory&) = delete;
+    RoomDirectory& operator=(const RoomDirectory&) = delete;
+
+    static bool valid_name(std::string_view name) {
+        return !name.empty() && name.size() <= ROOM_MAX_NAME;
+    }
+
+    // leaves c's current room first. nullptr for an invalid name.
+    Room* join(Connection* c, std::string_view name) {
+        if (!valid_name(name)) return nullptr;
+        leave(c);
+        std::string key(name);
+        auto found = by_name.find(key);
+        ui32 id;
+        if (found == by_name.end()) {
+            id = ++next_id;
+            by_name.emplace(key, id);
+            rooms[id].name = key;
+        } else {
+            id = found->second;
+        }
+        Room& room = rooms[id];
+        c->room = id;
+        c->room_slot = (ui32)room.members.size();
+        room.members.push_back(c);
+        return &room;
+    }
+
+    void leave(Connection* c) {
+        if (c->room == 0) return;
+        ui32 id = c->room;
+        Room& room = rooms[id];
+        Connection* last = room.members.back();
+        room.members[c->room_slot] = last;
+        last->room_slot = c->room_slot;
+        room.members.pop_back();
+        c->room = 0;
+        c->room_slot = 0;
+        erase_if_idle(id);
+    }
+
+    Room* room_of(const Connection* c) {
+        if (c->room == 0) return nullptr;
+        auto it = rooms.find(c->room);
+        return it == rooms.end() ? nullptr : &it->second;
+    }
+
+    void post(const Connection* c, const RoomMessage& message) {
+        Room* room = room_of(c);
+        if (room == nullptr) return;
+        if (room->pending.empty()) active.push_back(c->room);
+        room->pending.push_back(message);
+    }
+
+    // text posted on another shard, for every member here. dropped when
+    // nobody here is in that room.
+    void post_named(std::string_view name, const RoomMessage& message) {
+        auto found = by_name.find(std::string(name));
+        if (found == by_name.end()) return;
+        Room& room = rooms[found->second];
+        if (room.pending.empty()) active.push_back(found->second);
+        room.pending.push_back(message);
+    }
+
+    bool has_pending() const {
+        return !active.empty();
+    }
+
+    // deliver(Room&) for every room with messages this round, then the
+    // round starts over. members may leave during deliver.
+    template <class F>
+    void drain(F&& deliver) {
+        for (ui32 id : active) {
+            auto it = rooms.find(id);
+            if (it == rooms.end()) continue;
+            deliver(it->second);
+            it->second.pending.clear();
+            erase_if_idle(id);
+        }
+        active.clear();
+    }
+
+    ui64 size() const {
+        return rooms.size();
+    }
+};
+
+#endif // ROOM_H
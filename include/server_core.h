@@ -0,0 +1,658 @@
+#ifndef SERVER_CORE_H
+#define SERVER_CORE_H
+
+#ifdef __linux__
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "arena.h"
+#include "conn.h"
+#include "frame.h"
+#include "logger.h"
+#include "message.h"
+#include "message_view.h"
+#include "net.h"
+#include "room.h"
+#include "session.h"
+#include "shard.h"
+
+typedef uint8_t ui8;
+typedef uint16_t ui16;
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+#define SERVER_DEFAULT_PORT 9001
+#define SERVER_DEFAULT_MAX_CONNECTIONS 65536
+// largest message a client may send, same as the one-to-one server
+#define SERVER_MAX_MESSAGE 1024
+#define SERVER_STDIN_CHUNK 4096
+// room text held for the end of the round; past this it goes out early
+#define SERVER_ROUND_FLUSH_BYTES MiB(4)
+
+struct ServerConfig {
+    ui16 port;
+    ui32 max_connections;
+    ui32 max_message;
+    ConnBudgetConfig budget;
+    // cap on buffer bytes across all connections, 0 for none
+    ui64 total_budget;
+    // lz4 before sealing, flagged per frame
+    bool compress;
+    // seal every message back to its sender (load tests, latency runs)
+    bool echo;
+    // no per-message console output
+    bool quiet;
+    // lines typed on stdin go to every connected client
+    bool read_stdin;
+    // reactor threads for ShardedServer, 0 for one per core
+    ui32 shards;
+
+    ServerConfig(ui16 port_ = SERVER_DEFAULT_PORT)
+        : port(port_), max_connections(SERVER_DEFAULT_MAX_CONNECTIONS), max_message(SERVER_MAX_MESSAGE),
+          budget(), total_budget(0), compress(true), echo(false), quiet(false), read_stdin(true),
+          shards(1) {}
+};
+
+struct ServerStats {
+    ui64 accepted;
+    ui64 rejected;
+    ui64 peak_connections;
+    ui64 messages;
+    ui64 shed;
+    // frames sealed for room members
+    ui64 relayed;
+
+    ServerStats() : accepted(0), rejected(0), peak_connections(0), messages(0), shed(0), relayed(0) {}
+};
+
+// the protocol half of the many-client server, shared by the transports
+// (epoll, io_uring): handshake, frame checks, sealing, console broadcast
+// rooms and connection bookkeeping. Transport derives from ServerCore<Transport>
+// and provides
+//
+//   Connection* make_connection(socket_t fd)
+//   SendStatus  transmit(Connection* c, const IoSlice* slices, int count)
+//   void        detach(Connection* c)      stop all i/o on c
+//   bool        can_free(Connection* c)    nothing in flight references c
+//   void        free_connection(Connection* c)
+//   void        wake()                     signal safe, breaks out of the wait
+//
+// bytes are handed in through received() (read straight into
+// read_target()) or feed() (copied out of a transport-owned buffer).
+// after each batch of events the transport calls end_round().
+template <class Transport>
+class ServerCore {
+protected:
+    ServerConfig config;
+    std::atomic<bool> stopping;
+    MemArena arena;
+    KeyPair my_keypair;
+    MessageLogger logger;
+    MemBudget total;
+    std::unordered_set<Connection*> conns;
+    // dropped, freed by reap() once the transport lets go of them
+    std::vector<Connection*> closed;
+    std::string stdin_pending;
+    RoomDirectory rooms;
+    // room text posted this round, emptied by flush_rooms()
+    MemArena round;
+    // set when this is one shard of a ShardedServer
+    ShardGroup* group;
+    ui32 shard;
+    // this round's entries for the other shards
+    std::vector<ui8> outgoing;
+    // batches a full mailbox didn't take yet, by receiving shard
+    std::vector<std::pair<ui32, ShardBatch*>> unsent;
+    // received batches whose room text is pending in rooms
+    std::vector<ShardBatch*> held;
+    ui64 next_id;
+    ServerStats stats;
+
+    explicit ServerCore(const ServerConfig& config_)
+        : config(config_), stopping(false), arena(CONN_ARENA_RESERVE), logger("logs/messages.txt"),
+          total(config_.total_budget), round(MiB(16)), group(nullptr),
+          shard(0), next_id(0) {
+        my_keypair.generate(arena);
+    }
+
+    ServerCore(const ServerCore&) = delete;
+    ServerCore& operator=(const ServerCore&) = delete;
+
+    Transport& transport() {
+        return static_cast<Transport&>(*this);
+    }
+
+    void announce(const char* backend) {
+        if (shard != 0) return;
+        std::cout << "\n========================================" << std::endl;
+        std::cout << "  Secure Messaging Server (" << backend;
+        if (group != nullptr) std::cout << ", " << group->size() << " shards";
+        std::cout << ")" << std::endl;
+        std::cout << "========================================\n" << std::endl;
+        ui64 limit = (ui64)config.max_connections * (group != nullptr ? group->size() : 1);
+        std::cout << "[Server] Listening on port " << config.port << ", up to " << limit << " clients" << std::endl;
+        MessageLogger::print_log_info();
+    }
+
+    // a non-blocking, bound and listening socket, -1 on failure
+    socket_t open_listener() {
+        socket_t fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+        if (fd < 0) {
+            std::cerr << "[Server] Socket creation failed!" << std::endl;
+            return -1;
+        }
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        // every shard binds the port, the kernel spreads connections
+        if (group != nullptr && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+            std::cerr << "[Server] SO_REUSEPORT failed: " << strerror(errno) << std::endl;
+            close(fd);
+            return -1;
+        }
+
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(config.port);
+        if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            std::cerr << "[Server] Bind failed: " << strerror(errno) << std::endl;
+            close(fd);
+            return -1;
+        }
+        if (listen(fd, SOMAXCONN) != 0) {
+            std::cerr << "[Server] Listen failed: " << strerror(errno) << std::endl;
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // a freshly accepted socket becomes a connection, nullptr when the
+    // server is full (the socket is closed then)
+    Connection* admit(socket_t fd) {
+        if (conns.size() >= config.max_connections) {
+            ++stats.rejected;
+            close(fd);
+            return nullptr;
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        Connection* c = transport().make_connection(fd);
+        c->id = ++next_id;
+        // shards hand out interleaved ids so they stay unique server-wide
+        if (group != nullptr) c->id = (c->id - 1) * group->size() + shard + 1;
+        conns.insert(c);
+        ++stats.accepted;
+        stats.peak_connections = MAX(stats.peak_connections, (ui64)conns.size());
+        return c;
+    }
+
+    // our public key + the suites we accept, as in exchange_keypairs
+    void greet(Connection* c) {
+        ui8 hello[HANDSHAKE_HELLO_BYTES];
+        memcpy(hello, my_keypair.public_key, X25519_KEY_BYTES);
+        hello[X25519_KEY_BYTES] = suite_offer_mask();
+        IoSlice slice = {hello, HANDSHAKE_HELLO_BYTES};
+        if (transport().transmit(c, &slice, 1) == SEND_FAILED) {
+            drop(c, "hello failed");
+        }
+    }
+
+    // where the next bytes from c go, and how many are wanted there
+    ui8* read_target(Connection* c) const {
+        return c->phase == CONN_HELLO ? c->hello + c->hello_received : c->reader.target();
+    }
+
+    ui32 read_missing(Connection* c) const {
+        return c->phase == CONN_HELLO ? HANDSHAKE_HELLO_BYTES - c->hello_received : c->reader.missing();
+    }
+
+    // n bytes landed at read_target(c)
+    void received(Connection* c, ui32 n) {
+        if (c->phase == CONN_HELLO) {
+            c->hello_received += n;
+            if (c->hello_received == HANDSHAKE_HELLO_BYTES && !finish_hello(c)) {
+                drop(c, "handshake failed");
+            }
+            return;
+        }
+
+        switch (c->reader.advance(n)) {
+        case READ_MORE:
+            break;
+        case READ_FRAME:
+            if (handle_frame(c)) c->reader.next();
+            break;
+        case READ_BAD_HEADER:
+            drop(c, "invalid frame header");
+            break;
+        case READ_OVER_BUDGET:
+            ++stats.shed;
+            drop(c, "over its memory budget");
+            break;
+        }
+    }
+
+    // received() over bytes the transport already holds
+    void feed(Connection* c, const ui8* data, ui64 len) {
+        while (len != 0 && !c->closing) {
+            ui32 n = (ui32)MIN(len, (ui64)read_missing(c));
+            memcpy(read_target(c), data, n);
+            received(c, n);
+            data += n;
+            len -= n;
+        }
+    }
+
+    bool finish_hello(Connection* c) {
+        ui8 chosen = c->hello[X25519_KEY_BYTES];
+        if (chosen >= 8 || !(suite_offer_mask() & (1u << chosen))) return false;
+        memcpy(c->peer_public_key, c->hello, X25519_KEY_BYTES);
+        try {
+            c->session.derive(c->peer_public_key, my_keypair.secret_key, my_keypair.public_key,
+                              (CipherSuite)chosen);
+        } catch (const std::exception&) {
+            return false;
+        }
+        c->phase = CONN_OPEN;
+        if (!config.quiet) {
+            std::cout << "[Server] Client #" << c->id << " connected (" << c->session.get_ops().name << ")"
+                      << std::endl;
+        }
+        return true;
+    }
+
+    // same checks as SecureServer::handle_frame. false once c is dropped.
+    bool handle_frame(Connection* c) {
+        const FrameHeader& header = c->reader.frame_header();
+        if (header.seq != c->recv_seq || header.suite != c->session.get_suite()) {
+            drop(c, "unexpected frame");
+            return false;
+        }
+        MessageView view = Frame::view(header, c->reader.frame_payload());
+        if (!view.open_in_place(c->session)) {
+            drop(c, "message authentication failed");
+            return false;
+        }
+        ++c->recv_seq;
+
+        ConnBuffer inflated;
+        ui64 inflated_len = view.inflated_len();
+        if (inflated_len > config.max_message ||
+            (inflated_len != 0 && inflated.acquire(&c->budget, inflated_len) == BUDGET_SHED)) {
+            drop(c, "compressed message too large");
+            return false;
+        }
+        ConstByteSpan text = view.payload(ByteSpan(inflated.data(), inflated.size()));
+        if (text.data == nullptr) {
+            drop(c, "malformed compressed message");
+            return false;
+        }
+        ++stats.messages;
+
+        std::string_view line((const char*)text.data, text.len);
+        if (!config.quiet) {
+            std::cout << "[Client #" << c->id << "] " << line << std::endl;
+            KeyPair peer;
+            peer.public_key = c->peer_public_key;
+            logger.log_received_message("Server", std::string(line), peer, my_keypair);
+        }
+        bool alive;
+        if (line.substr(0, 6) == "/join ") {
+            alive = join_room(c, line.substr(6));
+        } else if (line == "/leave") {
+            rooms.leave(c);
+            alive = send_text(c, "left the room");
+        } else {
+            if (c->room != 0) post_to_room(c, line);
+            alive = !config.echo || send_text(c, line);
+        }
+
+        view.wipe();
+        if (text.data == inflated.data()) {
+            memset(inflated.data(), 0, text.len);
+        }
+        return alive;
+    }
+
+    // seal under c's session and queue behind anything still pending.
+    // false once c is dropped.
+    bool send_text(Connection* c, std::string_view line) {
+        ScratchArena scratch;
+        MessageView view = config.compress
+            ? MessageView::seal_compressed(scratch.arena(), "Server", as_bytes(line), c->session, c->send_seq)
+            : MessageView::seal(scratch.arena(), "Server", as_bytes(line), c->session, c->send_seq);
+        ++c->send_seq;
+        ui8 header[FRAME_HEADER_BYTES];
+        Frame::encode(header, view);
+        IoSlice slices[2] = {{header, FRAME_HEADER_BYTES}, {view.body.data, view.body.len}};
+        if (transport().transmit(c, slices, 2) == SEND_FAILED) {
+            ++stats.shed;
+            drop(c, "send failed or queue over budget");
+            return false;
+        }
+        return true;
+    }
+
+    bool join_room(Connection* c, std::string_view name) {
+        Room* room = rooms.join(c, name);
+        if (room == nullptr) {
+            return send_text(c, "room names are 1 to " + std::to_string(ROOM_MAX_NAME) + " bytes");
+        }
+        // other shards' members are only known to them
+        std::string here = group != nullptr ? " members on this shard)" : " members)";
+        return send_text(c, "joined " + room->name + " (" + std::to_string(room->members.size()) + here);
+    }
+
+    // "[#id] line" for the rest of c's room at the end of the round.
+    // compressed here once, sealed per member in deliver().
+    void post_to_room(Connection* c, std::string_view line) {
+        ScratchArena scratch(&round);
+        char prefix[32];
+        ui64 prefix_len = (ui64)snprintf(prefix, sizeof(prefix), "[#%llu] ", (unsigned long long)c->id);
+        // members read at most max_message bytes, the prefix comes out of that
+        ui64 len = MIN(prefix_len + line.size(), (ui64)config.max_message);
+        ui8* text = (ui8*)scratch.arena().push(len, 1);
+        memcpy(text, prefix, MIN(prefix_len, len));
+        if (len > prefix_len) memcpy(text + prefix_len, line.data(), len - prefix_len);
+
+        if (round.get_used() + len > SERVER_ROUND_FLUSH_BYTES) flush_rooms();
+        RoomMessage message = {c, ConstByteSpan(), FRAME_FLAG_NONE};
+        if (config.compress && Compressor::looks_compressible(text, len)) {
+            ui64 cap = COMPRESS_HEADER_BYTES + Compressor::bound(len);
+            ui8* packed = (ui8*)round.push(cap, 1);
+            ui64 packed_len = Compressor::pack(packed, cap, text, len);
+            if (packed_len != 0) {
+                round.pop(cap - packed_len);
+                message.body = ConstByteSpan(packed, packed_len);
+                message.flags = FRAME_FLAG_COMPRESSED;
+            } else {
+                round.pop(cap);
+            }
+        }
+        if (message.body.data == nullptr) {
+            ui8* copy = (ui8*)round.push(len, 1);
+            memcpy(copy, text, len);
+            message.body = ConstByteSpan(copy, len);
+        }
+        rooms.post(c, message);
+
+        if (group != nullptr) {
+            const std::string& name = rooms.room_of(c)->name;
+            ShardBatch::append(outgoing, SHARD_ROOM_TEXT, message.flags, name.data(), (ui8)name.size(),
+                               message.body.data, (ui32)message.body.len);
+            if (outgoing.size() > SERVER_ROUND_FLUSH_BYTES) ship();
+        }
+    }
+
+    // every member but the sender gets the room's messages from this
+    // round, each sealed under its own session. chacha20 copies for
+    // consecutive members are sealed a window at a time (BatchCrypto),
+    // then each member's frames in the window go out as one gathered write.
+    void deliver(Room& room) {
+        ScratchArena scratch(&round);
+        MemArena& a = scratch.arena();
+        // members who fail a send leave the room while we walk it
+        ui64 count = room.members.size();
+        Connection** members = (Connection**)a.push(count * sizeof(Connection*), 1);
+        memcpy(members, room.members.data(), count * sizeof(Connection*));
+
+        RoomFrame frames[BATCH_WINDOW];
+        CryptoJob jobs[BATCH_WINDOW];
+        int queued = 0;
+        int batched = 0;
+        ui64 mark = a.get_pos();
+        for (ui64 i = 0; i < count; ++i) {
+            Connection* m = members[i];
+            for (const RoomMessage& message : room.pending) {
+                if (m->closing) break;
+                if (message.from == m) continue;
+                RoomFrame& frame = frames[queued++];
+                frame.to = m;
+                if (MessageView::seal_later(a, "Room", message.body, m->session, m->send_seq++, message.flags,
+                                            frame.view, jobs[batched])) {
+                    ++batched;
+                }
+                ++stats.relayed;
+                if (queued == BATCH_WINDOW) {
+                    relay_window(frames, queued, jobs, batched);
+                    queued = 0;
+                    batched = 0;
+                    a.pop(a.get_pos() - mark);
+                }
+            }
+        }
+        if (queued != 0) relay_window(frames, queued, jobs, batched);
+    }
+
+    // seals the window's batched jobs, then one relay per member. frames
+    // for a member are adjacent; a member dropped earlier is skipped.
+    void relay_window(const RoomFrame* frames, int count, CryptoJob* jobs, int batched) {
+        static_assert(2 * BATCH_WINDOW <= NET_MAX_SLICES, "a window fits one gathered write");
+        if (batched != 0) SimpleCrypto::seal_batch(jobs, batched);
+        ui8 headers[BATCH_WINDOW][FRAME_HEADER_BYTES];
+        IoSlice slices[NET_MAX_SLICES];
+        int used = 0;
+        for (int i = 0; i < count; ++i) {
+            const MessageView& view = frames[i].view;
+            Frame::encode(headers[i], view);
+            slices[used++] = {headers[i], FRAME_HEADER_BYTES};
+            slices[used++] = {view.body.data, view.body.len};
+            Connection* m = frames[i].to;
+            if (i + 1 < count && frames[i + 1].to == m) continue;
+            if (!m->closing) relay(m, slices, used);
+            used = 0;
+        }
+    }
+
+    // transmit copies what it can't write right away, the caller may
+    // reuse the slices. false once m is dropped.
+    bool relay(Connection* m, const IoSlice* slices, int count) {
+        if (transport().transmit(m, slices, count) == SEND_FAILED) {
+            ++stats.shed;
+            drop(m, "send failed or queue over budget");
+            return false;
+        }
+        return true;
+    }
+
+    void flush_rooms() {
+        if (!rooms.has_pending()) return;
+        rooms.drain([this](Room& room) { deliver(room); });
+        round.pop(round.get_used());
+    }
+
+    // room text and console lines from the other shards
+    void take_mail() {
+        group->receive(shard, [this](ShardBatch* b) {
+            b->for_each([this](const ShardEntry& e, const char* name, const ui8* body) {
+                if (e.kind == SHARD_ROOM_TEXT) {
+                    RoomMessage message = {nullptr, ConstByteSpan(body, e.body_len), e.flags};
+                    rooms.post_named(std::string_view(name, e.name_len), message);
+                } else if (e.kind == SHARD_CONSOLE) {
+                    send_all(std::string_view((const char*)body, e.body_len));
+                }
+            });
+            held.push_back(b);
+        });
+    }
+
+    // this round's outgoing entries, one batch shared by every other
+    // shard. a shard's batches go out in order, so once one waits for a
+    // mailbox the ones after it wait too.
+    void ship() {
+        size_t kept = 0;
+        for (size_t i = 0; i < unsent.size(); ++i) {
+            ui32 to = unsent[i].first;
+            bool blocked = false;
+            for (size_t j = 0; j < kept; ++j) blocked = blocked || unsent[j].first == to;
+            if (blocked || !group->send(shard, to, unsent[i].second)) unsent[kept++] = unsent[i];
+        }
+        unsent.resize(kept);
+        if (outgoing.empty()) return;
+
+        ShardBatch* b = ShardBatch::create(shard, outgoing.data(), outgoing.size(), group->size() - 1);
+        outgoing.clear();
+        for (ui32 to = 0; to < group->size(); ++to) {
+            if (to == shard) continue;
+            bool blocked = false;
+            for (const auto& u : unsent) blocked = blocked || u.first == to;
+            if (blocked || !group->send(shard, to, b)) unsent.push_back({to, b});
+        }
+    }
+
+    // after each batch of events: mail in, room traffic out, dropped
+    // connections freed
+    void end_round() {
+        if (group != nullptr) take_mail();
+        flush_rooms();
+        for (ShardBatch* b : held) b->release();
+        held.clear();
+        if (group != nullptr) ship();
+        reap();
+    }
+
+    ui64 send_all(std::string_view line) {
+        ui64 sent = 0;
+        for (Connection* c : conns) {
+            if (c->closing || c->phase != CONN_OPEN) continue;
+            if (send_text(c, line)) ++sent;
+        }
+        return sent;
+    }
+
+    void broadcast(const std::string& line) {
+        ui64 sent = send_all(line);
+        if (group != nullptr) {
+            ShardBatch::append(outgoing, SHARD_CONSOLE, FRAME_FLAG_NONE, nullptr, 0, (const ui8*)line.data(),
+                               (ui32)line.size());
+            std::cout << "[Server] Sent to " << sent << " client(s) here, forwarded to the other shards"
+                      << std::endl;
+        } else {
+            std::cout << "[Server] Sent to " << sent << " client(s)" << std::endl;
+        }
+        if (sent != 0) {
+            KeyPair all;
+            all.public_key = my_keypair.public_key;
+            logger.log_sent_message("Server", line, all, my_keypair);
+        }
+    }
+
+    // stdin is readable. false at eof: keep serving without a console.
+    bool read_console() {
+        char chunk[SERVER_STDIN_CHUNK];
+        ssize_t n = read(STDIN_FILENO, chunk, sizeof(chunk));
+        if (n <= 0) return false;
+        stdin_pending.append(chunk, (size_t)n);
+        size_t start = 0, end;
+        while ((end = stdin_pending.find('\n', start)) != std::string::npos) {
+            std::string line = stdin_pending.substr(start, end - start);
+            start = end + 1;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line == "exit") {
+                std::cout << "[Server] Shutting down..." << std::endl;
+                if (group != nullptr) {
+                    group->stop_all();
+                } else {
+                    stop();
+                }
+            } else if (line.length() > config.max_message) {
+                std::cerr << "[Server] Message too long (max " << config.max_message << " bytes)" << std::endl;
+            } else if (!line.empty()) {
+                broadcast(line);
+            }
+        }
+        stdin_pending.erase(0, start);
+        return true;
+    }
+
+    // stops i/o now, frees in reap()
+    void drop(Connection* c, const char* reason) {
+        if (c->closing) return;
+        c->closing = true;
+        rooms.leave(c);
+        transport().detach(c);
+        closed.push_back(c);
+        if (reason != nullptr && !config.quiet) {
+            std::cout << "[Server] Client #" << c->id << " " << reason << std::endl;
+        }
+    }
+
+    void reap() {
+        size_t kept = 0;
+        for (Connection* c : closed) {
+            if (!transport().can_free(c)) {
+                closed[kept++] = c;
+                continue;
+            }
+            conns.erase(c);
+            transport().free_connection(c);
+        }
+        closed.resize(kept);
+    }
+
+    // for the transport's destructor, the core can't reach it from its own
+    void free_all() {
+        for (Connection* c : conns) {
+            transport().free_connection(c);
+        }
+        conns.clear();
+        closed.clear();
+        for (ShardBatch* b : held) b->release();
+        held.clear();
+        for (auto& u : unsent) u.second->release();
+        unsent.clear();
+    }
+
+    void print_stats() {
+        std::cout << "[Server] ";
+        if (group != nullptr) std::cout << "shard " << shard << ": ";
+        std::cout << stats.accepted << " accepted (" << stats.rejected << " rejected), peak "
+                  << stats.peak_connections << " concurrent, " << stats.messages << " messages, "
+                  << stats.relayed << " relayed, " << stats.shed << " shed, buffer peak " << total.get_peak() << " bytes" << std::endl;
+    }
+
+public:
+    // thread and signal safe
+    void stop() {
+        stopping.store(true, std::memory_order_release);
+        transport().wake();
+    }
+
+    // thread safe: an extra pass through the loop, for mail
+    void notify() {
+        transport().wake();
+    }
+
+    // before start(): this server is shard index of group, listening on a
+    // shared SO_REUSEPORT port
+    void join_group(ShardGroup* group_, ui32 index) {
+        group = group_;
+        shard = index;
+    }
+
+    const ServerStats& get_stats() const {
+        return stats;
+    }
+
+    ui64 get_connection_count() const {
+        return conns.size();
+    }
+};
+
+#endif // __linux__
+
+#endif // SERVER_CORE_H
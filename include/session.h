@@ -0,0 +1,140 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <cstdint>
+#include <cstring>
+#include "crypto.h"
+#include "csprng.h"
+#include "suite.h"
+#include "x25519.h"
+
+typedef uint8_t ui8;
+typedef uint64_t ui64;
+
+#define SESSION_KEY_BYTES 32
+// handshake hello: x25519 public key || one suite byte. the server's byte
+// is its offer mask, the client's the suite it picked from that offer.
+#define HANDSHAKE_HELLO_BYTES (X25519_KEY_BYTES + 1)
+static_assert(SESSION_KEY_BYTES == DefaultSuite::key_bytes, "session key must fit the default suite");
+static_assert(SESSION_KEY_BYTES == AesSuite::key_bytes, "session key must fit the aes suite");
+
+// per-peer crypto context. the shared key is derived once (x25519) when the
+// peer's public key arrives and the suite's key context (chacha schedule,
+// aes round keys + ghash powers) is expanded up front, so per-message work
+// is just nonce + seal/open. messages from the peer go through open_next,
+// which refuses a nonce the peer has already used.
+class Session {
+private:
+    CipherSuite suite;
+    const SuiteOps* ops;
+    ui8 key[SESSION_KEY_BYTES];
+    alignas(16) ui8 context[SUITE_MAX_CONTEXT_BYTES];
+    NonceSequence nonces;
+    NonceWindow peer_nonces;
+    bool ready;
+
+public:
+    Session() : suite(SUITE_CHACHA20), ops(find_suite(SUITE_CHACHA20)), ready(false) {
+        memset(key, 0, sizeof(key));
+        memset(context, 0, sizeof(context));
+    }
+
+    Session(const ui8* peer_pk, const ui8* my_sk, CipherSuite suite_ = SUITE_CHACHA20) : Session() {
+        derive(peer_pk, my_sk, suite_);
+    }
+
+    ~Session() {
+        memset(key, 0, sizeof(key));
+        memset(context, 0, sizeof(context));
+    }
+
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    // x25519 with the peer's public key, then hchacha20 over the raw dh
+    // output. throws on low-order peer keys.
+    void derive(const ui8* peer_pk, const ui8* my_sk, CipherSuite suite_ = SUITE_CHACHA20) {
+        ui8 shared[X25519_KEY_BYTES];
+        if (!X25519::shared(shared, my_sk, peer_pk)) {
+            memset(shared, 0, sizeof(shared));
+            throw std::runtime_error("Invalid peer public key!");
+        }
+        ui8 kdf_in[16] = {0};
+        ChaCha20::hchacha(key, shared, kdf_in);
+        memset(shared, 0, sizeof(shared));
+        set_suite(suite_);
+        peer_nonces.reset();
+    }
+
+    // connection form: both sides end up with the same key, so the side
+    // with the smaller public key takes nonce role 0 and the other role 1
+    void derive(const ui8* peer_pk, const ui8* my_sk, const ui8* my_pk, CipherSuite suite_ = SUITE_CHACHA20) {
+        derive(peer_pk, my_sk, suite_);
+        int role = memcmp(my_pk, peer_pk, X25519_KEY_BYTES) < 0 ? 0 : 1;
+        nonces.set_role((ui8)role);
+        peer_nonces.reset(1 - role);
+    }
+
+    // picks the specialized suite once; every message then goes through ops
+    void set_suite(CipherSuite suite_) {
+        const SuiteOps* found = find_suite(suite_);
+        if (found == nullptr) {
+            throw std::invalid_argument("Unknown cipher suite!");
+        }
+        suite = suite_;
+        ops = found;
+        memset(context, 0, sizeof(context));
+        ops->prepare(context, key);
+        ready = true;
+    }
+
+    void next_nonce(ui8 nonce[CHACHA_IV_BYTES]) {
+        nonces.next(nonce);
+    }
+
+    // ciphertext and mac may alias the box layout (mac right after
+    // ciphertext). aad is authenticated, not encrypted.
+    void encrypt(ui8* ciphertext, ui8* mac, const ui8* plaintext, ui64 len, const ui8* nonce,
+                 const ui8* aad = nullptr, ui64 aad_len = 0) const {
+        ops->encrypt(ciphertext, mac, plaintext, len, aad, aad_len, key, context, nonce);
+    }
+
+    bool decrypt(ui8* plaintext, const ui8* ciphertext, ui64 len, const ui8* mac, const ui8* nonce,
+                 const ui8* aad = nullptr, ui64 aad_len = 0) const {
+        return ops->decrypt(plaintext, ciphertext, len, mac, aad, aad_len, key, context, nonce);
+    }
+
+    // decrypt for the next message from the peer: false without touching
+    // the ciphertext if its nonce is not past the last one that opened
+    bool open_next(ui8* plaintext, const ui8* ciphertext, ui64 len, const ui8* mac, const ui8* nonce,
+                   const ui8* aad = nullptr, ui64 aad_len = 0) {
+        if (!peer_nonces.fresh(nonce)) return false;
+        if (!decrypt(plaintext, ciphertext, len, mac, nonce, aad, aad_len)) return false;
+        peer_nonces.mark_used(nonce);
+        return true;
+    }
+
+    CipherSuite get_suite() const {
+        return suite;
+    }
+
+    const SuiteOps& get_ops() const {
+        return *ops;
+    }
+
+    // expanded chacha input block (nonce words zero), for batch jobs.
+    // only meaningful while the suite is SUITE_CHACHA20.
+    const ui32* get_schedule() const {
+        return (const ui32*)context;
+    }
+
+    const ui8* get_key() const {
+        return key;
+    }
+
+    bool is_ready() const {
+        return ready;
+    }
+};
+
+#endif // SESSION_H
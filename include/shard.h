@@ -0,0 +1,184 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+#include "slab.h"
+#include "spsc.h"
+
+typedef uint8_t ui8;
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+// batches one shard may have in flight to another before it holds them back
+#define SHARD_MAILBOX_BATCHES 1024
+
+enum ShardEntryKind : ui8 {
+    // room text: name + body (compressed if flagged), for that room's
+    // members on the receiving shard
+    SHARD_ROOM_TEXT = 1,
+    // a console line for every client of the receiving shard
+    SHARD_CONSOLE = 2,
+};
+
+// one entry in a batch, followed by name_len bytes of room name and
+// body_len bytes of body
+struct ShardEntry {
+    ui8 kind;
+    ui8 flags;
+    ui8 name_len;
+    ui8 reserved;
+    ui32 body_len;
+};
+
+static_assert(sizeof(ShardEntry) == 8, "shard entry layout");
+
+// a round of cross-shard traffic from one shard, built once and read by
+// every other shard. the last reader gives it back to the slab pool.
+struct ShardBatch {
+    std::atomic<ui32> refs;
+    ui32 from;
+    ui64 len;
+
+    ui8* data() {
+        return (ui8*)(this + 1);
+    }
+
+    static ShardBatch* create(ui32 from, const ui8* bytes, ui64 len, ui32 readers) {
+        ShardBatch* b = new (SlabPool::alloc(sizeof(ShardBatch) + len)) ShardBatch();
+        b->refs.store(readers, std::memory_order_relaxed);
+        b->from = from;
+        b->len = len;
+        memcpy(b->data(), bytes, len);
+        return b;
+    }
+
+    // any thread
+    void release() {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        this->~ShardBatch();
+        SlabPool::release(this);
+    }
+
+    // fn(const ShardEntry&, name, body) for each entry, in order
+    template <class F>
+    void for_each(F&& fn) {
+        const ui8* p = data();
+        const ui8* end = p + len;
+        while (p + sizeof(ShardEntry) <= end) {
+            ShardEntry e;
+            memcpy(&e, p, sizeof(e));
+            p += sizeof(e);
+            fn(e, (const char*)p, p + e.name_len);
+            p += e.name_len + e.body_len;
+        }
+    }
+
+    // appends an entry to a batch under construction
+    static void append(std::vector<ui8>& out, ShardEntryKind kind, ui8 flags, const char* name, ui8 name_len,
+                       const ui8* body, ui32 body_len) {
+        ShardEntry e = {kind, flags, name_len, 0, body_len};
+        ui64 at = out.size();
+        out.resize(at + sizeof(e) + name_len + body_len);
+        memcpy(out.data() + at, &e, sizeof(e));
+        memcpy(out.data() + at + sizeof(e), name, name_len);
+        memcpy(out.data() + at + sizeof(e) + name_len, body, body_len);
+    }
+};
+
+// the reactors of one sharded server. every ordered pair of shards has
+// its own spsc mailbox, so a shard only ever writes the queues it sends
+// on and reads the ones it receives on. a shard is woken when a batch
+// lands in a mailbox it had emptied, and a sender that found a mailbox
+// full is woken once the receiver has drained it.
+class ShardGroup {
+private:
+    struct Member {
+        void* shard;
+        void (*wake)(void*);
+        void (*stop)(void*);
+    };
+
+    ui32 count;
+    std::vector<Member> members;
+    // [from * count + to]
+    std::vector<std::unique_ptr<SpscQueue<ShardBatch*>>> mail;
+    std::unique_ptr<std::atomic<bool>[]> sender_waiting;
+
+    ui32 pair(ui32 from, ui32 to) const {
+        return from * count + to;
+    }
+
+public:
+    explicit ShardGroup(ui32 count_, ui64 mailbox_batches = SHARD_MAILBOX_BATCHES)
+        : count(count_), members(count_), sender_waiting(new std::atomic<bool>[count_ * count_]) {
+        mail.reserve(count * count);
+        for (ui32 i = 0; i < count * count; ++i) {
+            mail.emplace_back(new SpscQueue<ShardBatch*>(mailbox_batches));
+            sender_waiting[i].store(false, std::memory_order_relaxed);
+        }
+    }
+
+    ~ShardGroup() {
+        ShardBatch* b;
+        for (auto& q : mail) {
+            while (q->pop(b)) b->release();
+        }
+    }
+
+    ShardGroup(const ShardGroup&) = delete;
+    ShardGroup& operator=(const ShardGroup&) = delete;
+
+    // before any shard runs
+    void attach(ui32 index, void* shard, void (*wake)(void*), void (*stop)(void*)) {
+        members[index] = {shard, wake, stop};
+    }
+
+    ui32 size() const {
+        return count;
+    }
+
+    // on from's thread. false when the mailbox is full; from is woken once
+    // to has drained it and should send again then.
+    bool send(ui32 from, ui32 to, ShardBatch* b) {
+        SpscQueue<ShardBatch*>& q = *mail[pair(from, to)];
+        bool was_empty = false;
+        if (!q.push(b, &was_empty)) {
+            // flag first, then retry: to either sees the flag after its
+            // next drain or has already made room
+            sender_waiting[pair(from, to)].store(true, std::memory_order_seq_cst);
+            if (!q.push(b, &was_empty)) return false;
+        }
+        if (was_empty) members[to].wake(members[to].shard);
+        return true;
+    }
+
+    // on to's thread: fn(ShardBatch*) for everything waiting, per sender
+    // in the order it was sent. fn owns one reference.
+    template <class F>
+    void receive(ui32 to, F&& fn) {
+        for (ui32 from = 0; from < count; ++from) {
+            if (from == to) continue;
+            SpscQueue<ShardBatch*>& q = *mail[pair(from, to)];
+            ShardBatch* b;
+            while (q.pop(b)) fn(b);
+            std::atomic<bool>& waiting = sender_waiting[pair(from, to)];
+            if (waiting.load(std::memory_order_seq_cst) && waiting.exchange(false)) {
+                members[from].wake(members[from].shard);
+            }
+        }
+    }
+
+    // thread and signal safe
+    void stop_all() {
+        for (const Member& m : members) {
+            if (m.stop != nullptr) m.stop(m.shard);
+        }
+    }
+};
+
+#endif // SHARD_H
@@ -0,0 +1,178 @@
+#ifndef SHARDED_SERVER_H
+#define SHARDED_SERVER_H
+
+#ifdef __linux__
+
+#include <cstdint>
+#include <iostream>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include "server_core.h"
+#include "shard.h"
+
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+// one reactor per core. every shard is a whole Server (EpollServer or
+// UringServer) on its own pinned thread with its own SO_REUSEPORT
+// listener, so the kernel spreads new connections and a connection lives
+// and dies on the shard that accepted it. arenas, sessions, rooms and the
+// logger are per shard; the only thing shards share is the ShardGroup
+// mailboxes that carry room text and console lines between them. each
+// shard is built and started on its own thread (memory first touched on
+// its core, and an io_uring stays with the thread that submits to it);
+// shard 0 is the calling thread and owns the console.
+template <class Server>
+class ShardedServer {
+private:
+    ServerConfig config;
+    std::unique_ptr<ShardGroup> group;
+    std::vector<std::unique_ptr<Server>> shards;
+    std::vector<int> cpus;
+    std::vector<std::thread> threads;
+    // released by run(), or by the destructor after a failed start()
+    std::promise<void> go;
+    bool launched;
+    bool released;
+
+    static void wake_shard(void* server) {
+        ((Server*)server)->notify();
+    }
+
+    static void stop_shard(void* server) {
+        ((Server*)server)->stop();
+    }
+
+    // the cpus this process may run on, in order
+    static std::vector<int> allowed_cpus() {
+        std::vector<int> out;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &set)) out.push_back(cpu);
+            }
+        }
+        if (out.empty()) out.push_back(0);
+        return out;
+    }
+
+    // best effort, an unpinned shard still works
+    static void pin(pthread_t thread, int cpu) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(thread, sizeof(set), &set);
+    }
+
+    // on the shard's own thread
+    bool open_shard(ui32 i) {
+        ui32 n = config.shards;
+        // limits are server-wide, each shard gets its share
+        ServerConfig local = config;
+        local.max_connections = (config.max_connections + n - 1) / n;
+        local.total_budget = (config.total_budget + n - 1) / n;
+        local.read_stdin = config.read_stdin && i == 0;
+        try {
+            shards[i].reset(new Server(local));
+        } catch (const std::exception& e) {
+            std::cerr << "[Server] shard " << i << ": " << e.what() << std::endl;
+            return false;
+        }
+        // a lone shard is a plain server: no mailboxes to ship to, and a
+        // batch nobody reads would never be released
+        if (n > 1) shards[i]->join_group(group.get(), i);
+        group->attach(i, shards[i].get(), wake_shard, stop_shard);
+        return shards[i]->start();
+    }
+
+    void release(bool launch) {
+        if (released) return;
+        released = true;
+        launched = launch;
+        go.set_value();
+    }
+
+public:
+    explicit ShardedServer(const ServerConfig& config_ = ServerConfig())
+        : config(config_), cpus(allowed_cpus()), launched(false), released(false) {
+        if (config.shards == 0) config.shards = (ui32)cpus.size();
+    }
+
+    ~ShardedServer() {
+        release(false);
+        for (auto& t : threads) t.join();
+        // servers before the group their unsent batches point into
+        shards.clear();
+    }
+
+    ShardedServer(const ShardedServer&) = delete;
+    ShardedServer& operator=(const ShardedServer&) = delete;
+
+    // every shard listening, none serving yet. false if any failed.
+    bool start() {
+        ui32 n = config.shards;
+        group.reset(new ShardGroup(n));
+        shards.resize(n);
+        std::shared_future<void> started = go.get_future().share();
+        std::vector<std::future<bool>> opened;
+        for (ui32 i = 1; i < n; ++i) {
+            std::promise<bool> ready;
+            opened.push_back(ready.get_future());
+            threads.emplace_back([this, i, started, ready = std::move(ready)]() mutable {
+                pin(pthread_self(), cpus[i % cpus.size()]);
+                bool ok = open_shard(i);
+                ready.set_value(ok);
+                started.wait();
+                if (ok && launched) shards[i]->run();
+            });
+        }
+        pin(pthread_self(), cpus[0]);
+        bool ok = open_shard(0);
+        for (auto& f : opened) ok = f.get() && ok;
+        return ok;
+    }
+
+    // until stop() or "exit" on the console
+    void run() {
+        release(true);
+        shards[0]->run();
+        for (auto& t : threads) t.join();
+        threads.clear();
+
+        ServerStats s = get_stats();
+        std::cout << "[Server] all " << shards.size() << " shards: " << s.accepted << " accepted, peak "
+                  << s.peak_connections << " concurrent, " << s.messages << " messages, " << s.relayed
+                  << " relayed, " << s.shed << " shed" << std::endl;
+    }
+
+    // thread and signal safe
+    void stop() {
+        if (group) group->stop_all();
+    }
+
+    // summed over the shards; peak is the sum of per-shard peaks. read
+    // once run() has returned.
+    ServerStats get_stats() const {
+        ServerStats total;
+        for (const auto& s : shards) {
+            if (!s) continue;
+            const ServerStats& one = s->get_stats();
+            total.accepted += one.accepted;
+            total.rejected += one.rejected;
+            total.peak_connections += one.peak_connections;
+            total.messages += one.messages;
+            total.shed += one.shed;
+            total.relayed += one.relayed;
+        }
+        return total;
+    }
+};
+
+#endif // __linux__
+
+#endif // SHARDED_SERVER_H
@@ -0,0 +1,321 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include "arena.h"
+
+typedef uint8_t ui8;
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+// usable sizes, picked around frame sizes: chat lines, a full BUFFER_SIZE
+// frame, coalesced batches, stream chunks
+#define SLAB_CLASS_COUNT 9
+// memory carved per refill of an empty class
+#define SLAB_BYTES KiB(256)
+// per-thread blocks per class before half go back to the global list
+#define SLAB_CACHE_LIMIT 64
+#define SLAB_HEADER_BYTES 16
+#define SLAB_LARGE_CLASS 0xffu
+#define SLAB_MAGIC_LIVE 0x51ab11feu
+#define SLAB_MAGIC_FREE 0x51abf7eeu
+
+static const ui32 SLAB_CLASS_BYTES[SLAB_CLASS_COUNT] = {
+    64, 128, 256, 512, 1024, 2048, 4096, 16384, 65536,
+};
+
+// sits in front of every block. next links free blocks; the class tells
+// release() where the block goes, so it can be freed on any thread.
+struct SlabBlock {
+    SlabBlock* next;
+    ui32 size_class;
+    ui32 magic;
+};
+
+static_assert(sizeof(SlabBlock) == SLAB_HEADER_BYTES, "slab header layout");
+
+struct SlabStats {
+    ui64 slabs[SLAB_CLASS_COUNT];
+    ui64 reserved_bytes;
+    ui64 large_allocs;
+};
+
+// process-wide size-class allocator. each thread keeps a small free list
+// per class, so alloc/release are a pointer pop/push with no atomics. a
+// thread whose cache overflows pushes half of it onto the class's global
+// list with one cas, and an empty cache takes the whole global list with
+// one exchange (take-all, so no aba). blocks may be released on a
+// different thread than the one that allocated them. only carving a new
+// slab takes a lock. slabs come from VirtualMemory and are kept for the
+// life of the process: nothing fragments, a class only ever holds blocks
+// of its own size.
+class SlabPool {
+private:
+    struct SizeClass {
+        std::atomic<SlabBlock*> freed;
+        std::atomic<ui64> slabs;
+    };
+
+    struct State {
+        SizeClass classes[SLAB_CLASS_COUNT];
+        std::atomic<ui64> large_allocs;
+        // carving only; recycling never takes it
+        std::mutex grow_lock;
+
+        State() : large_allocs(0) {
+            for (auto& c : classes) {
+                c.freed.store(nullptr, std::memory_order_relaxed);
+                c.slabs.store(0, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    struct ThreadCache {
+        SlabBlock* head[SLAB_CLASS_COUNT];
+        ui32 count[SLAB_CLASS_COUNT];
+
+        ThreadCache() {
+            for (int c = 0; c < SLAB_CLASS_COUNT; ++c) {
+                head[c] = nullptr;
+                count[c] = 0;
+            }
+        }
+
+        // thread exit: everything goes back for other threads to use
+        ~ThreadCache() {
+            for (ui32 c = 0; c < SLAB_CLASS_COUNT; ++c) {
+                if (head[c] != nullptr) {
+                    push_global(c, head[c]);
+                    head[c] = nullptr;
+                    count[c] = 0;
+                }
+            }
+        }
+    };
+
+    // never destroyed, thread caches may outlive static teardown
+    static State& state() {
+        static State* s = new State();
+        return *s;
+    }
+
+    static ThreadCache& cache() {
+        thread_local ThreadCache c;
+        return c;
+    }
+
+    static ui32 class_of(ui64 size) {
+        for (ui32 c = 0; c < SLAB_CLASS_COUNT; ++c) {
+            if (size <= SLAB_CLASS_BYTES[c]) return c;
+        }
+        return SLAB_LARGE_CLASS;
+    }
+
+    static SlabBlock* tail_of(SlabBlock* chain, ui32& length) {
+        length = 1;
+        while (chain->next != nullptr) {
+            chain = chain->next;
+            ++length;
+        }
+        return chain;
+    }
+
+    static void push_global(ui32 c, SlabBlock* chain) {
+        ui32 length;
+        SlabBlock* tail = tail_of(chain, length);
+        std::atomic<SlabBlock*>& freed = state().classes[c].freed;
+        SlabBlock* old = freed.load(std::memory_order_relaxed);
+        do {
+            tail->next = old;
+        } while (!freed.compare_exchange_weak(old, chain, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // global list, or a fresh slab when that is empty too. keeps at most
+    // SLAB_CACHE_LIMIT and puts the rest back, so one thread can't hoard
+    // blocks while the others carve new slabs.
+    static void refill(ThreadCache& tc, ui32 c) {
+        std::atomic<SlabBlock*>& freed = state().classes[c].freed;
+        SlabBlock* chain = freed.exchange(nullptr, std::memory_order_acquire);
+        if (chain == nullptr) {
+            // another thread may be handing blocks back right now, look
+            // again once we hold the lock before growing the class
+            std::lock_guard<std::mutex> guard(state().grow_lock);
+            chain = freed.exchange(nullptr, std::memory_order_acquire);
+            if (chain == nullptr) {
+                chain = carve(c);
+            }
+        }
+        SlabBlock* tail = chain;
+        ui32 length = 1;
+        while (tail->next != nullptr && length < SLAB_CACHE_LIMIT) {
+            tail = tail->next;
+            ++length;
+        }
+        if (tail->next != nullptr) {
+            push_global(c, tail->next);
+            tail->next = nullptr;
+        }
+        tc.head[c] = chain;
+        tc.count[c] = length;
+    }
+
+    static ui64 slab_bytes_of(ui32 c) {
+        return MAX(SLAB_BYTES, 4 * (SLAB_HEADER_BYTES + SLAB_CLASS_BYTES[c]));
+    }
+
+    static SlabBlock* carve(ui32 c) {
+        ui64 block_bytes = SLAB_HEADER_BYTES + SLAB_CLASS_BYTES[c];
+        ui64 slab_bytes = slab_bytes_of(c);
+        ui8* slab = (ui8*)VirtualMemory::reserve(slab_bytes);
+        if (slab == nullptr) {
+            throw std::bad_alloc();
+        }
+        if (!VirtualMemory::commit(slab, slab_bytes)) {
+            VirtualMemory::release(slab, slab_bytes);
+            throw std::bad_alloc();
+        }
+        state().classes[c].slabs.fetch_add(1, std::memory_order_relaxed);
+
+        ui64 blocks = slab_bytes / block_bytes;
+        SlabBlock* chain = nullptr;
+        for (ui64 i = blocks; i-- > 0;) {
+            SlabBlock* b = (SlabBlock*)(slab + i * block_bytes);
+            b->next = chain;
+            b->size_class = c;
+            b->magic = SLAB_MAGIC_FREE;
+            chain = b;
+        }
+        return chain;
+    }
+
+public:
+    // O(1) from the thread cache; sizes above the largest class go to malloc
+    static void* alloc(ui64 size) {
+        ui32 c = class_of(size);
+        if (c == SLAB_LARGE_CLASS) {
+            SlabBlock* b = (SlabBlock*)malloc(SLAB_HEADER_BYTES + size);
+            if (b == nullptr) throw std::bad_alloc();
+            b->next = nullptr;
+            b->size_class = SLAB_LARGE_CLASS;
+            b->magic = SLAB_MAGIC_LIVE;
+            state().large_allocs.fetch_add(1, std::memory_order_relaxed);
+            return (ui8*)b + SLAB_HEADER_BYTES;
+        }
+
+        ThreadCache& tc = cache();
+        if (tc.head[c] == nullptr) {
+            refill(tc, c);
+        }
+        SlabBlock* b = tc.head[c];
+        tc.head[c] = b->next;
+        --tc.count[c];
+        b->next = nullptr;
+        b->magic = SLAB_MAGIC_LIVE;
+        return (ui8*)b + SLAB_HEADER_BYTES;
+    }
+
+    // any thread. throws on a pointer that is not a live slab block.
+    static void release(void* ptr) {
+        if (ptr == nullptr) return;
+        SlabBlock* b = (SlabBlock*)((ui8*)ptr - SLAB_HEADER_BYTES);
+        if (b->magic != SLAB_MAGIC_LIVE) {
+            throw std::logic_error("Slab release of a block that is not live!");
+        }
+        b->magic = SLAB_MAGIC_FREE;
+        if (b->size_class == SLAB_LARGE_CLASS) {
+            free(b);
+            return;
+        }
+
+        ui32 c = b->size_class;
+        ThreadCache& tc = cache();
+        b->next = tc.head[c];
+        tc.head[c] = b;
+        if (++tc.count[c] < SLAB_CACHE_LIMIT) return;
+
+        // keep the newest half, hand the rest over
+        SlabBlock* keep_tail = tc.head[c];
+        for (ui32 i = 1; i < SLAB_CACHE_LIMIT / 2; ++i) {
+            keep_tail = keep_tail->next;
+        }
+        SlabBlock* rest = keep_tail->next;
+        keep_tail->next = nullptr;
+        tc.count[c] = SLAB_CACHE_LIMIT / 2;
+        push_global(c, rest);
+    }
+
+    // bytes the block can hold, at least what was asked for
+    static ui64 usable_size(const void* ptr) {
+        const SlabBlock* b = (const SlabBlock*)((const ui8*)ptr - SLAB_HEADER_BYTES);
+        return b->size_class == SLAB_LARGE_CLASS ? 0 : SLAB_CLASS_BYTES[b->size_class];
+    }
+
+    static SlabStats get_stats() {
+        SlabStats stats;
+        stats.reserved_bytes = 0;
+        for (ui32 c = 0; c < SLAB_CLASS_COUNT; ++c) {
+            stats.slabs[c] = state().classes[c].slabs.load(std::memory_order_relaxed);
+            stats.reserved_bytes += stats.slabs[c] * slab_bytes_of(c);
+        }
+        stats.large_allocs = state().large_allocs.load(std::memory_order_relaxed);
+        return stats;
+    }
+};
+
+// owning handle for one slab block, move-only
+class SlabBuffer {
+private:
+    ui8* ptr;
+    ui64 len;
+
+public:
+    SlabBuffer() : ptr(nullptr), len(0) {}
+
+    explicit SlabBuffer(ui64 len_) : ptr((ui8*)SlabPool::alloc(len_)), len(len_) {}
+
+    ~SlabBuffer() {
+        SlabPool::release(ptr);
+    }
+
+    SlabBuffer(SlabBuffer&& other) : ptr(other.ptr), len(other.len) {
+        other.ptr = nullptr;
+        other.len = 0;
+    }
+
+    SlabBuffer& operator=(SlabBuffer&& other) {
+        if (this != &other) {
+            SlabPool::release(ptr);
+            ptr = other.ptr;
+            len = other.len;
+            other.ptr = nullptr;
+            other.len = 0;
+        }
+        return *this;
+    }
+
+    SlabBuffer(const SlabBuffer&) = delete;
+    SlabBuffer& operator=(const SlabBuffer&) = delete;
+
+    ui8* data() const {
+        return ptr;
+    }
+
+    ui64 size() const {
+        return len;
+    }
+
+    // ownership passes to the caller, SlabPool::release it on any thread
+    ui8* detach() {
+        ui8* out = ptr;
+        ptr = nullptr;
+        len = 0;
+        return out;
+    }
+};
+
+#endif // SLAB_H
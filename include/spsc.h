@@ -0,0 +1,74 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+// keeps the producer's and the consumer's index off each other's line
+#define SPSC_CACHE_LINE 64
+
+// bounded ring for exactly one producer thread and one consumer thread.
+// push and pop are a few loads and stores around one fence, no locks and
+// no cas. capacity is rounded up to a power of two.
+template <class T>
+class SpscQueue {
+private:
+    std::vector<T> slots;
+    ui64 mask;
+    // next slot the consumer reads, written by the consumer only
+    alignas(SPSC_CACHE_LINE) std::atomic<ui64> head;
+    // next slot the producer writes, written by the producer only
+    alignas(SPSC_CACHE_LINE) std::atomic<ui64> tail;
+
+public:
+    explicit SpscQueue(ui64 capacity = 1024) : head(0), tail(0) {
+        ui64 size = 1;
+        while (size < capacity) size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // producer side. false when full. was_empty is set when the consumer
+    // had taken everything before this value, so it may be asleep and
+    // needs a wake. the fences here and in pop() pair up: either the
+    // producer sees the consumer caught up, or the consumer sees the value.
+    bool push(const T& value, bool* was_empty = nullptr) {
+        ui64 t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask) return false;
+        slots[t & mask] = value;
+        tail.store(t + 1, std::memory_order_release);
+        if (was_empty != nullptr) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            *was_empty = head.load(std::memory_order_relaxed) == t;
+        }
+        return true;
+    }
+
+    // consumer side. false when empty.
+    bool pop(T& out) {
+        ui64 h = head.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        out = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // either side, a snapshot
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    ui64 capacity() const {
+        return mask + 1;
+    }
+};
+
+#endif // SPSC_H
@@ -0,0 +1,243 @@
+#ifndef SUITE_H
+#define SUITE_H
+
+#include <cstdint>
+#include <cstring>
+#include "aes_gcm.h"
+#include "crypto.h"
+
+typedef uint8_t ui8;
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+// cipher suites with their sizes fixed at compile time. key/nonce/mac
+// lengths are template parameters, so index math folds into masks and the
+// per-key-period loops unroll. each suite also names the per-key context it
+// wants precomputed (prepare) and gets it back on every message.
+template <ui64 KeyBytes, ui64 NonceBytes, ui64 MacBytes>
+struct SuiteParams {
+    static_assert(KeyBytes && (KeyBytes & (KeyBytes - 1)) == 0, "key size must be a power of two");
+    static constexpr ui64 key_bytes = KeyBytes;
+    static constexpr ui64 nonce_bytes = NonceBytes;
+    static constexpr ui64 mac_bytes = MacBytes;
+};
+
+// legacy serial xor chain. still serial, but one key period is an
+// unrolled inner loop and the key index is a constant. the tag is
+// poly1305 over aad and ciphertext (rfc 8439 layout) under a one-time key
+// (chacha20 block 0 for this nonce, as in the aead suites), never under
+// the session key itself.
+template <ui64 KeyBytes>
+struct XorChainSuite : SuiteParams<KeyBytes, 16, POLY1305_MAC_BYTES> {
+    static_assert(KeyBytes >= CHACHA_KEY_BYTES, "the mac key is derived with chacha20");
+    static constexpr CipherSuite id = SUITE_LEGACY_XOR_CHAIN;
+    static constexpr const char* name = "xor-chain";
+    static constexpr ui64 context_bytes = 0;
+
+    static void prepare(void* context, const ui8* key) {
+        (void)context;
+        (void)key;
+    }
+
+    static void tag(ui8 mac[POLY1305_MAC_BYTES], const ui8* ciphertext, ui64 len, const ui8* aad,
+                    ui64 aad_len, const ui8* key, const ui8* nonce) {
+        ui32 state[16];
+        ui8 otk[CHACHA_BLOCK_BYTES];
+        ChaCha20::init_state(state, key, nonce);
+        ChaCha20::block(otk, state);
+        Poly1305 poly;
+        poly.init(otk);
+        poly.update(aad, aad_len);
+        poly.pad16();
+        poly.update(ciphertext, len);
+        poly.pad16();
+        ui8 lens[16];
+        for (int i = 0; i < 8; ++i) {
+            lens[i] = (ui8)(aad_len >> (8 * i));
+            lens[8 + i] = (ui8)(len >> (8 * i));
+        }
+        poly.update(lens, sizeof(lens));
+        poly.finish(mac);
+        memset(state, 0, sizeof(state));
+        memset(otk, 0, sizeof(otk));
+    }
+
+    static void encrypt(ui8* ciphertext, ui8* mac, const ui8* plaintext, ui64 len, const ui8* aad,
+                        ui64 aad_len, const ui8* key, const void* context, const ui8* nonce) {
+        (void)context;
+        ui8 state = 0;
+        ui64 i = 0;
+        for (; i + KeyBytes <= len; i += KeyBytes) {
+            for (ui64 k = 0; k < KeyBytes; ++k) {
+                state = (state + key[k]) ^ plaintext[i + k];
+                ciphertext[i + k] = state;
+            }
+        }
+        for (; i < len; ++i) {
+            state = (state + key[i & (KeyBytes - 1)]) ^ plaintext[i];
+            ciphertext[i] = state;
+        }
+        tag(mac, ciphertext, len, aad, aad_len, key, nonce);
+    }
+
+    static bool decrypt(ui8* plaintext, const ui8* ciphertext, ui64 len, const ui8* mac, const ui8* aad,
+                        ui64 aad_len, const ui8* key, const void* context, const ui8* nonce) {
+        (void)context;
+        ui8 expected[POLY1305_MAC_BYTES];
+        tag(expected, ciphertext, len, aad, aad_len, key, nonce);
+        bool ok = Poly1305::verify(expected, mac);
+        memset(expected, 0, sizeof(expected));
+        if (!ok) {
+            return false;
+        }
+        ui8 state = 0;
+        ui64 i = 0;
+        for (; i + KeyBytes <= len; i += KeyBytes) {
+            for (ui64 k = 0; k < KeyBytes; ++k) {
+                ui8 temp = ciphertext[i + k];
+                plaintext[i + k] = (state + key[k]) ^ temp;
+                state = temp;
+            }
+        }
+        for (; i < len; ++i) {
+            ui8 temp = ciphertext[i];
+            plaintext[i] = (state + key[i & (KeyBytes - 1)]) ^ temp;
+            state = temp;
+        }
+        return true;
+    }
+};
+
+template <ui64 NonceBytes, ui64 MacBytes>
+struct ChaChaPolySuite : SuiteParams<CHACHA_KEY_BYTES, NonceBytes, MacBytes> {
+    static_assert(NonceBytes == CHACHA_IV_BYTES, "chacha20 nonce is the 16-byte counter block");
+    static_assert(MacBytes == POLY1305_MAC_BYTES, "poly1305 tags are 16 bytes");
+    static constexpr CipherSuite id = SUITE_CHACHA20;
+    static constexpr const char* name = "chacha20-poly1305";
+    // the expanded input block, nonce words zero
+    static constexpr ui64 context_bytes = 16 * sizeof(ui32);
+
+    static void prepare(void* context, const ui8* key) {
+        ui8 zero_iv[CHACHA_IV_BYTES] = {0};
+        ChaCha20::init_state((ui32*)context, key, zero_iv);
+    }
+
+    static void encrypt(ui8* ciphertext, ui8* mac, const ui8* plaintext, ui64 len, const ui8* aad,
+                        ui64 aad_len, const ui8* key, const void* context, const ui8* nonce) {
+        (void)key;
+        SimpleCrypto::seal_expanded(ciphertext, mac, plaintext, len, aad, aad_len, (const ui32*)context, nonce);
+    }
+
+    static bool decrypt(ui8* plaintext, const ui8* ciphertext, ui64 len, const ui8* mac, const ui8* aad,
+                        ui64 aad_len, const ui8* key, const void* context, const ui8* nonce) {
+        (void)key;
+        return SimpleCrypto::open_expanded(plaintext, ciphertext, len, mac, aad, aad_len,
+                                           (const ui32*)context, nonce);
+    }
+};
+
+// aes-256-gcm over the same 16-byte message nonce as chacha20: the first
+// word (block counter, always 0) is skipped, the other 12 bytes are the iv
+template <ui64 NonceBytes, ui64 MacBytes>
+struct AesGcmSuite : SuiteParams<AES256_KEY_BYTES, NonceBytes, MacBytes> {
+    static_assert(NonceBytes == 4 + GCM_IV_BYTES, "message nonce is a 96-bit iv behind the counter word");
+    static_assert(MacBytes == GCM_TAG_BYTES, "gcm tags are 16 bytes");
+    static constexpr CipherSuite id = SUITE_AES256_GCM;
+    static constexpr const char* name = "aes-256-gcm";
+    static constexpr ui64 context_bytes = sizeof(AesGcmKey);
+
+    static void prepare(void* context, const ui8* key) {
+        AesGcm::expand(*(AesGcmKey*)context, key);
+    }
+
+    static void encrypt(ui8* ciphertext, ui8* mac, const ui8* plaintext, ui64 len, const ui8* aad,
+                        ui64 aad_len, const ui8* key, const void* context, const ui8* nonce) {
+        (void)key;
+        AesGcm::seal(ciphertext, mac, plaintext, len, aad, aad_len, *(const AesGcmKey*)context, nonce + 4);
+    }
+
+    static bool decrypt(ui8* plaintext, const ui8* ciphertext, ui64 len, const ui8* mac, const ui8* aad,
+                        ui64 aad_len, const ui8* key, const void* context, const ui8* nonce) {
+        (void)key;
+        return AesGcm::open(plaintext, ciphertext, len, mac, aad, aad_len, *(const AesGcmKey*)context,
+                            nonce + 4);
+    }
+};
+
+typedef XorChainSuite<32> LegacySuite;
+typedef ChaChaPolySuite<16, 16> DefaultSuite;
+typedef AesGcmSuite<16, 16> AesSuite;
+
+typedef void (*SuitePrepareFn)(void* context, const ui8* key);
+typedef void (*SuiteEncryptFn)(ui8* ciphertext, ui8* mac, const ui8* plaintext, ui64 len, const ui8* aad,
+                               ui64 aad_len, const ui8* key, const void* context, const ui8* nonce);
+typedef bool (*SuiteDecryptFn)(ui8* plaintext, const ui8* ciphertext, ui64 len, const ui8* mac,
+                               const ui8* aad, ui64 aad_len, const ui8* key, const void* context,
+                               const ui8* nonce);
+
+// one row per specialized suite, looked up once per connection
+struct SuiteOps {
+    CipherSuite id;
+    const char* name;
+    ui64 key_bytes;
+    ui64 nonce_bytes;
+    ui64 mac_bytes;
+    ui64 context_bytes;
+    SuitePrepareFn prepare;
+    SuiteEncryptFn encrypt;
+    SuiteDecryptFn decrypt;
+};
+
+template <class Suite>
+constexpr SuiteOps make_suite_ops() {
+    return SuiteOps{Suite::id, Suite::name, Suite::key_bytes, Suite::nonce_bytes, Suite::mac_bytes,
+                    Suite::context_bytes, &Suite::prepare, &Suite::encrypt, &Suite::decrypt};
+}
+
+// indexed by CipherSuite id
+inline constexpr SuiteOps SUITE_TABLE[] = {
+    make_suite_ops<LegacySuite>(),
+    make_suite_ops<DefaultSuite>(),
+    make_suite_ops<AesSuite>(),
+};
+
+inline constexpr ui64 SUITE_COUNT = sizeof(SUITE_TABLE) / sizeof(SUITE_TABLE[0]);
+
+constexpr ui64 suite_max_context_bytes() {
+    ui64 most = 0;
+    for (const SuiteOps& ops : SUITE_TABLE) {
+        if (ops.context_bytes > most) most = ops.context_bytes;
+    }
+    return most;
+}
+
+inline constexpr ui64 SUITE_MAX_CONTEXT_BYTES = suite_max_context_bytes();
+
+// nullptr for ids this build doesn't know
+inline const SuiteOps* find_suite(ui8 id) {
+    if (id >= SUITE_COUNT) return nullptr;
+    return &SUITE_TABLE[id];
+}
+
+// handshake negotiation. the server offers a mask (bit i = suite id i),
+// the client picks one. the legacy xor chain is never offered.
+inline ui8 suite_offer_mask() {
+    return (ui8)((1u << SUITE_CHACHA20) | (1u << SUITE_AES256_GCM));
+}
+
+// aes-gcm first where this cpu has aes-ni, chacha20 first everywhere else
+inline bool choose_suite(ui8 offer, CipherSuite& chosen) {
+    const CipherSuite hw_order[] = {SUITE_AES256_GCM, SUITE_CHACHA20};
+    const CipherSuite sw_order[] = {SUITE_CHACHA20, SUITE_AES256_GCM};
+    const CipherSuite* order = AesGcm::hardware() ? hw_order : sw_order;
+    ui8 ours = suite_offer_mask();
+    for (int i = 0; i < 2; ++i) {
+        if (offer & ours & (1u << order[i])) {
+            chosen = order[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif // SUITE_H
@@ -0,0 +1,344 @@
+#ifndef URING_H
+#define URING_H
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "arena.h"
+
+typedef uint8_t ui8;
+typedef uint16_t ui16;
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+// completions outnumber submissions with multishot accept/recv, so the
+// completion queue gets URING_CQ_FACTOR times the submission entries
+#define URING_DEFAULT_ENTRIES 1024
+#define URING_CQ_FACTOR 8
+#define URING_PAGE_BYTES KiB(4)
+
+// io_uring through the raw syscalls (no liburing): the two rings mapped
+// from the kernel, sqes handed out by get_sqe() and sent in one
+// io_uring_enter by submit(), completions walked with for_each_cqe().
+// one thread owns the ring; the kernel is the only other party.
+class IoRing {
+private:
+    int fd;
+    ui32 sq_entries;
+    ui32 sq_mask;
+    ui32 cq_mask;
+    ui32* sq_head;
+    ui32* sq_tail;
+    ui32* cq_head;
+    ui32* cq_tail;
+    io_uring_sqe* sqes;
+    io_uring_cqe* cqes;
+    void* sq_ring;
+    void* cq_ring;
+    ui64 sq_ring_len;
+    ui64 cq_ring_len;
+    ui64 sqes_len;
+    // handed out by get_sqe, not yet seen by the kernel
+    ui32 local_tail;
+    ui32 unsubmitted;
+
+    static ui32 load_acquire(const ui32* p) {
+        return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+    }
+
+    static void store_release(ui32* p, ui32 v) {
+        __atomic_store_n(p, v, __ATOMIC_RELEASE);
+    }
+
+    static int sys_setup(ui32 entries, io_uring_params* p) {
+        return (int)syscall(__NR_io_uring_setup, entries, p);
+    }
+
+    int sys_enter(ui32 to_submit, ui32 min_complete, ui32 flags) {
+        return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+    }
+
+    int sys_register(ui32 opcode, const void* arg, ui32 nr_args) {
+        return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+    }
+
+    void unmap() {
+        if (sqes != nullptr) munmap(sqes, sqes_len);
+        if (cq_ring != nullptr && cq_ring != sq_ring) munmap(cq_ring, cq_ring_len);
+        if (sq_ring != nullptr) munmap(sq_ring, sq_ring_len);
+        sqes = nullptr;
+        sq_ring = cq_ring = nullptr;
+    }
+
+public:
+    IoRing()
+        : fd(-1), sq_entries(0), sq_mask(0), cq_mask(0), sq_head(nullptr), sq_tail(nullptr), cq_head(nullptr),
+          cq_tail(nullptr), sqes(nullptr), cqes(nullptr), sq_ring(nullptr), cq_ring(nullptr), sq_ring_len(0),
+          cq_ring_len(0), sqes_len(0), local_tail(0), unsubmitted(0) {}
+
+    ~IoRing() {
+        unmap();
+        if (fd >= 0) close(fd);
+    }
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    // false with errno set when the kernel has no io_uring (or it is
+    // disabled by policy)
+    bool init(ui32 entries = URING_DEFAULT_ENTRIES) {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        // one submitter and completions run when we enter the kernel
+        // anyway: skip the cross-thread wakeups
+        p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN |
+                  IORING_SETUP_SINGLE_ISSUER;
+        p.cq_entries = entries * URING_CQ_FACTOR;
+        fd = sys_setup(entries, &p);
+        if (fd < 0 && errno == EINVAL) {
+            // older kernel: only the flags every version has
+            memset(&p, 0, sizeof(p));
+            p.flags = IORING_SETUP_CQSIZE;
+            p.cq_entries = entries * URING_CQ_FACTOR;
+            fd = sys_setup(entries, &p);
+        }
+        if (fd < 0) return false;
+
+        sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(ui32);
+        cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) {
+            sq_ring_len = cq_ring_len = MAX(sq_ring_len, cq_ring_len);
+        }
+        sq_ring = mmap(nullptr, sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                       IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED) {
+            sq_ring = nullptr;
+            return false;
+        }
+        cq_ring = single ? sq_ring
+                         : mmap(nullptr, cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED) {
+            cq_ring = nullptr;
+            return false;
+        }
+        sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                   IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            sqes = nullptr;
+            return false;
+        }
+
+        ui8* sq = (ui8*)sq_ring;
+        ui8* cq = (ui8*)cq_ring;
+        sq_entries = p.sq_entries;
+        sq_head = (ui32*)(sq + p.sq_off.head);
+        sq_tail = (ui32*)(sq + p.sq_off.tail);
+        sq_mask = *(ui32*)(sq + p.sq_off.ring_mask);
+        cq_head = (ui32*)(cq + p.cq_off.head);
+        cq_tail = (ui32*)(cq + p.cq_off.tail);
+        cq_mask = *(ui32*)(cq + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        // sqe i always sits in slot i
+        ui32* array = (ui32*)(sq + p.sq_off.array);
+        for (ui32 i = 0; i < sq_entries; ++i) array[i] = i;
+        local_tail = *sq_tail;
+        return true;
+    }
+
+    int get_fd() const {
+        return fd;
+    }
+
+    // a zeroed sqe, submitting what is queued first if the ring is full.
+    // nullptr only if the kernel would not take any of it.
+    io_uring_sqe* get_sqe() {
+        if (local_tail - load_acquire(sq_head) >= sq_entries) {
+            submit();
+            if (local_tail - load_acquire(sq_head) >= sq_entries) return nullptr;
+        }
+        io_uring_sqe* sqe = &sqes[local_tail & sq_mask];
+        ++local_tail;
+        ++unsubmitted;
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    // everything from get_sqe() since the last call goes to the kernel in
+    // one syscall; with wait_nr, also waits for that many completions.
+    // returns submitted count or -errno.
+    int submit(ui32 wait_nr = 0) {
+        store_release(sq_tail, local_tail);
+        if (unsubmitted == 0 && wait_nr == 0) return 0;
+        int n = sys_enter(unsubmitted, wait_nr, wait_nr != 0 ? IORING_ENTER_GETEVENTS : 0);
+        if (n < 0) return -errno;
+        unsubmitted -= MIN((ui32)n, unsubmitted);
+        return n;
+    }
+
+    // fn(const io_uring_cqe&) for every completion ready now; the slots
+    // are handed back once all of them ran. returns how many.
+    template <class F>
+    ui32 for_each_cqe(F&& fn) {
+        ui32 head = *cq_head;
+        ui32 tail = load_acquire(cq_tail);
+        ui32 seen = 0;
+        for (; head != tail; ++head, ++seen) {
+            fn(cqes[head & cq_mask]);
+        }
+        store_release(cq_head, head);
+        return seen;
+    }
+
+    // pins memory for the *_FIXED ops, iovec index = buf_index
+    bool register_buffers(const iovec* iov, ui32 count) {
+        return sys_register(IORING_REGISTER_BUFFERS, iov, count) == 0;
+    }
+
+    // a provided-buffer ring the kernel picks receive buffers from
+    bool register_buf_ring(io_uring_buf_ring* ring, ui32 entries, ui16 group) {
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (ui64)(uintptr_t)ring;
+        reg.ring_entries = entries;
+        reg.bgid = group;
+        return sys_register(IORING_REGISTER_PBUF_RING, &reg, 1) == 0;
+    }
+
+    // sqe builders
+
+    static void prep_accept_multishot(io_uring_sqe* sqe, int listen_fd, ui64 user_data) {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = listen_fd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        sqe->user_data = user_data;
+    }
+
+    // one completion per arrival until it fails or runs out of buffers,
+    // each in a buffer picked from the group's ring
+    static void prep_recv_multishot(io_uring_sqe* sqe, int sock, ui16 group, ui64 user_data) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = sock;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = group;
+        sqe->user_data = user_data;
+    }
+
+    // buf lies inside registered buffer buf_index when fixed is set
+    static void prep_send(io_uring_sqe* sqe, int sock, const ui8* buf, ui32 len, bool fixed, ui16 buf_index,
+                          ui64 user_data) {
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = sock;
+        sqe->addr = (ui64)(uintptr_t)buf;
+        sqe->len = len;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        if (fixed) {
+            sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+            sqe->buf_index = buf_index;
+        }
+        sqe->user_data = user_data;
+    }
+
+    static void prep_read(io_uring_sqe* sqe, int read_fd, void* buf, ui32 len, ui64 user_data) {
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = read_fd;
+        sqe->addr = (ui64)(uintptr_t)buf;
+        sqe->len = len;
+        sqe->off = (ui64)-1;
+        sqe->user_data = user_data;
+    }
+
+    static void prep_poll_in(io_uring_sqe* sqe, int poll_fd, ui64 user_data) {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = poll_fd;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = user_data;
+    }
+
+    static void prep_cancel(io_uring_sqe* sqe, ui64 target, ui64 user_data) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = target;
+        sqe->user_data = user_data;
+    }
+};
+
+// the receive buffers of a provided-buffer ring: count buffers of
+// buf_bytes each plus the ring itself, carved page aligned out of a
+// MemArena so the region never moves while the kernel holds it. a
+// completion names the buffer it filled; recycle() hands it back.
+class BufferRing {
+private:
+    io_uring_buf_ring* ring;
+    ui8* base;
+    ui32 count;
+    ui32 buf_bytes;
+    ui16 tail;
+    ui16 group;
+
+public:
+    BufferRing() : ring(nullptr), base(nullptr), count(0), buf_bytes(0), tail(0), group(0) {}
+
+    BufferRing(const BufferRing&) = delete;
+    BufferRing& operator=(const BufferRing&) = delete;
+
+    // count must be a power of two, at most 32768
+    bool init(IoRing& io, MemArena& region, ui32 count_, ui32 buf_bytes_, ui16 group_) {
+        count = count_;
+        buf_bytes = buf_bytes_;
+        group = group_;
+        ui64 ring_bytes = ALIGN_UP_POW2(count * sizeof(io_uring_buf), URING_PAGE_BYTES);
+        ui8* mem = (ui8*)region.push(ring_bytes + (ui64)count * buf_bytes + URING_PAGE_BYTES);
+        ring = (io_uring_buf_ring*)ALIGN_UP_POW2((uintptr_t)mem, URING_PAGE_BYTES);
+        base = (ui8*)ring + ring_bytes;
+        if (!io.register_buf_ring(ring, count, group)) return false;
+        for (ui32 i = 0; i < count; ++i) add((ui16)i);
+        publish();
+        return true;
+    }
+
+    ui16 get_group() const {
+        return group;
+    }
+
+    ui8* buffer(ui16 bid) const {
+        return base + (ui64)bid * buf_bytes;
+    }
+
+    void recycle(ui16 bid) {
+        add(bid);
+        publish();
+    }
+
+private:
+    // entries from the ring's own address: the uapi flex-array macro puts
+    // ring->bufs 8 bytes in when compiled as c++
+    void add(ui16 bid) {
+        io_uring_buf* buf = (io_uring_buf*)ring + (tail & (count - 1));
+        buf->addr = (ui64)(uintptr_t)buffer(bid);
+        buf->len = buf_bytes;
+        buf->bid = bid;
+        ++tail;
+    }
+
+    void publish() {
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+};
+
+#endif // __linux__
+
+#endif // URING_H
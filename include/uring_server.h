@@ -0,0 +1,480 @@
+#ifndef URING_SERVER_H
+#define URING_SERVER_H
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <vector>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "arena.h"
+#include "conn.h"
+#include "net.h"
+#include "server_core.h"
+#include "uring.h"
+
+typedef uint8_t ui8;
+typedef uint16_t ui16;
+typedef int32_t i32;
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+
+// receive buffers the kernel picks from, shared by every connection; one
+// is held only between a completion and the copy into the FrameReader
+#define URING_RECV_BUFFERS 1024
+#define URING_RECV_BUFFER_BYTES KiB(2)
+#define URING_RECV_GROUP 0
+// registered send buffers: one per connection with a write in flight,
+// the rest of its output waits in its SendQueue
+#define URING_SEND_SLOTS 512
+#define URING_SEND_SLOT_BYTES KiB(4)
+// both of the above plus alignment
+#define URING_REGION_RESERVE MiB(8)
+
+// what a completion is for, in the low bits of user_data (the rest is
+// the Connection, or nothing)
+enum UringOp : ui64 {
+    // start()'s fixed-send probe, ignored if it turns up in run()
+    URING_OP_PROBE = 0,
+    URING_OP_ACCEPT = 1,
+    URING_OP_RECV = 2,
+    URING_OP_SEND = 3,
+    URING_OP_WAKE = 4,
+    URING_OP_CONSOLE = 5,
+    URING_OP_CANCEL = 6,
+    URING_OP_MASK = 7,
+};
+
+// a Connection plus the io_uring ops in flight for it. it is freed only
+// once none are left, since their completions still point at it.
+struct UringConnection : Connection {
+    ui32 inflight;
+    bool recv_armed;
+    // recv cancelled for backpressure, re-armed once the outbox drains
+    bool recv_paused;
+    // waiting in line for a send slot
+    bool starved;
+    // send slot being written from, -1 for none
+    i32 slot;
+    ui32 slot_sent;
+    ui32 slot_len;
+    // the send in flight names the registered buffer
+    bool slot_fixed;
+
+    UringConnection(socket_t sock_, ConnBudgetConfig config, MemBudget* global, ui32 max_payload)
+        : Connection(sock_, config, global, max_payload), inflight(0), recv_armed(false), recv_paused(false),
+          starved(false), slot(-1), slot_sent(0), slot_len(0), slot_fixed(false) {}
+};
+
+static_assert(alignof(UringConnection) > URING_OP_MASK, "op tag must fit below the pointer");
+
+// the many-client server on io_uring instead of epoll: one multishot
+// accept, one multishot recv per connection drawing from a shared
+// provided-buffer ring, and sends out of registered fixed buffers. every
+// sqe prepared while handling a batch of completions goes to the kernel
+// in the next io_uring_enter, which also waits for the next batch, so a
+// busy server makes about one syscall per batch instead of several per
+// message. all buffers the kernel touches come from one MemArena region.
+// same protocol and behaviour as EpollServer.
+class UringServer : public ServerCore<UringServer> {
+    friend class ServerCore<UringServer>;
+
+private:
+    socket_t listener;
+    int wake_fd;
+    ui64 wake_value;
+    // declared before ring: the ring goes first and unregisters the region
+    MemArena region;
+    IoRing ring;
+    BufferRing recv_buffers;
+    ui8* send_base;
+    std::vector<ui32> free_slots;
+    std::deque<UringConnection*> starved;
+    // many kernels take IORING_RECVSEND_FIXED_BUF only on send_zc and
+    // fail a plain send with EINVAL; then the slots go out as plain memory.
+    // probed in start(), and cleared by any fixed send that still fails.
+    bool fixed_sends;
+    // out of descriptors: accept again once a connection is freed
+    bool accept_paused;
+    ui64 waits;
+    ui64 completions;
+
+    static ui64 tag(void* p, UringOp op) {
+        return (ui64)(uintptr_t)p | op;
+    }
+
+public:
+    explicit UringServer(const ServerConfig& config_ = ServerConfig())
+        : ServerCore<UringServer>(config_), listener(-1), wake_fd(-1), wake_value(0),
+          region(URING_REGION_RESERVE), send_base(nullptr), fixed_sends(false), accept_paused(false), waits(0),
+          completions(0) {}
+
+    ~UringServer() {
+        free_all();
+        if (listener >= 0) close(listener);
+        if (wake_fd >= 0) close(wake_fd);
+    }
+
+    bool start() {
+        if (!ring.init(URING_DEFAULT_ENTRIES)) {
+            std::cerr << "[Server] io_uring unavailable: " << strerror(errno) << std::endl;
+            return false;
+        }
+        if (!recv_buffers.init(ring, region, URING_RECV_BUFFERS, URING_RECV_BUFFER_BYTES, URING_RECV_GROUP)) {
+            std::cerr << "[Server] io_uring buffer rings need linux 6.0 or later" << std::endl;
+            return false;
+        }
+        ui64 send_bytes = (ui64)URING_SEND_SLOTS * URING_SEND_SLOT_BYTES;
+        ui8* mem = (ui8*)region.push(send_bytes + URING_PAGE_BYTES);
+        send_base = (ui8*)ALIGN_UP_POW2((uintptr_t)mem, URING_PAGE_BYTES);
+        iovec iov = {send_base, send_bytes};
+        fixed_sends = ring.register_buffers(&iov, 1) && probe_fixed_send();
+        for (ui32 i = URING_SEND_SLOTS; i-- > 0;) free_slots.push_back(i);
+
+        listener = open_listener();
+        if (listener < 0) return false;
+        wake_fd = eventfd(0, EFD_CLOEXEC);
+        if (wake_fd < 0) {
+            std::cerr << "[Server] eventfd failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        if (!arm_accept() || !arm_wake() || (config.read_stdin && !arm_console())) {
+            std::cerr << "[Server] io_uring submission queue full" << std::endl;
+            return false;
+        }
+
+        announce("io_uring");
+        return true;
+    }
+
+    // serves until stop() or "exit" on stdin
+    void run() {
+        while (!stopping.load(std::memory_order_acquire)) {
+            int n = ring.submit(1);
+            ++waits;
+            // EAGAIN/EBUSY: completions must be reaped first
+            if (n < 0 && n != -EINTR && n != -EAGAIN && n != -EBUSY) {
+                std::cerr << "[Server] io_uring_enter failed: " << strerror(-n) << std::endl;
+                break;
+            }
+            completions += ring.for_each_cqe([this](const io_uring_cqe& cqe) { complete(cqe); });
+            end_round();
+        }
+        print_stats();
+        std::cout << "[Server] io_uring: " << completions << " completions in " << waits << " waits, "
+                  << (fixed_sends ? "fixed" : "plain") << " send buffers" << std::endl;
+    }
+
+private:
+    // transport hooks for ServerCore
+
+    Connection* make_connection(socket_t fd) {
+        return new UringConnection(fd, config.budget, &total, config.max_message);
+    }
+
+    // straight into a free send slot when nothing is queued ahead,
+    // otherwise behind the rest in the outbox
+    SendStatus transmit(Connection* c, const IoSlice* slices, int count) {
+        UringConnection* u = (UringConnection*)c;
+        ui64 len = 0;
+        for (int i = 0; i < count; ++i) len += slices[i].len;
+        if (u->slot < 0 && u->outbox.empty() && !free_slots.empty() && len <= URING_SEND_SLOT_BYTES) {
+            u->slot = (i32)free_slots.back();
+            free_slots.pop_back();
+            ui8* dst = slot_data(u->slot);
+            for (int i = 0; i < count; ++i) {
+                memcpy(dst, slices[i].data, slices[i].len);
+                dst += slices[i].len;
+            }
+            u->slot_sent = 0;
+            u->slot_len = (ui32)len;
+            return submit_send(u) ? SEND_OK : SEND_FAILED;
+        }
+        SendStatus status = u->outbox.queue(slices, count);
+        if (status != SEND_FAILED && u->slot < 0) start_send(u);
+        return status;
+    }
+
+    // shutdown ends the multishot recv and any send in flight; the
+    // descriptor is closed once their completions are in
+    void detach(Connection* c) {
+        shutdown(c->sock, SHUT_RDWR);
+    }
+
+    bool can_free(Connection* c) {
+        UringConnection* u = (UringConnection*)c;
+        return u->inflight == 0 && !u->starved;
+    }
+
+    void free_connection(Connection* c) {
+        UringConnection* u = (UringConnection*)c;
+        close(u->sock);
+        release_slot(u);
+        delete u;
+        if (accept_paused && !stopping.load(std::memory_order_relaxed)) {
+            accept_paused = !arm_accept();
+        }
+    }
+
+    void wake() {
+        ui64 one = 1;
+        if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0) {
+            // the counter is already non-zero, the loop wakes up anyway
+        }
+    }
+
+    ui8* slot_data(i32 slot) const {
+        return send_base + (ui64)slot * URING_SEND_SLOT_BYTES;
+    }
+
+    bool arm_accept() {
+        io_uring_sqe* sqe = ring.get_sqe();
+        if (sqe == nullptr) return false;
+        IoRing::prep_accept_multishot(sqe, listener, tag(nullptr, URING_OP_ACCEPT));
+        return true;
+    }
+
+    bool arm_wake() {
+        io_uring_sqe* sqe = ring.get_sqe();
+        if (sqe == nullptr) return false;
+        IoRing::prep_read(sqe, wake_fd, &wake_value, sizeof(wake_value), tag(nullptr, URING_OP_WAKE));
+        return true;
+    }
+
+    bool arm_console() {
+        io_uring_sqe* sqe = ring.get_sqe();
+        if (sqe == nullptr) return false;
+        IoRing::prep_poll_in(sqe, STDIN_FILENO, tag(nullptr, URING_OP_CONSOLE));
+        return true;
+    }
+
+    void arm_recv(UringConnection* u) {
+        u->recv_paused = false;
+        io_uring_sqe* sqe = ring.get_sqe();
+        if (sqe == nullptr) {
+            drop(u, "submission queue full");
+            return;
+        }
+        IoRing::prep_recv_multishot(sqe, u->sock, recv_buffers.get_group(), tag(u, URING_OP_RECV));
+        u->recv_armed = true;
+        ++u->inflight;
+    }
+
+    // over the soft budget: stop taking input until the outbox drains
+    void pause_recv(UringConnection* u) {
+        if (u->recv_paused) return;
+        u->recv_paused = true;
+        if (!u->recv_armed) return;
+        io_uring_sqe* sqe = ring.get_sqe();
+        if (sqe != nullptr) {
+            IoRing::prep_cancel(sqe, tag(u, URING_OP_RECV), tag(nullptr, URING_OP_CANCEL));
+        }
+    }
+
+    void resume_recv(UringConnection* u) {
+        if (!u->recv_paused || !u->reader.wants_read()) return;
+        if (u->recv_armed) {
+            // the cancel is still on its way; its completion re-arms
+            u->recv_paused = false;
+        } else {
+            arm_recv(u);
+        }
+    }
+
+    // one fixed-buffer send over a socketpair before any client traffic,
+    // so a kernel that refuses them never fails a real send
+    bool probe_fixed_send() {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) return false;
+        bool done = false, ok = false;
+        io_uring_sqe* sqe = ring.get_sqe();
+        if (sqe != nullptr) {
+            send_base[0] = 0;
+            IoRing::prep_send(sqe, pair[0], send_base, 1, true, 0, tag(nullptr, URING_OP_PROBE));
+            while (!done) {
+                int n = ring.submit(1);
+                if (n < 0 && n != -EINTR) break;
+                ring.for_each_cqe([&](const io_uring_cqe& cqe) {
+                    if ((cqe.user_data & URING_OP_MASK) != URING_OP_PROBE) return;
+                    done = true;
+                    ok = cqe.res == 1;
+                });
+            }
+        }
+        close(pair[0]);
+        close(pair[1]);
+        return ok;
+    }
+
+    bool submit_send(UringConnection* u) {
+        io_uring_sqe* sqe = ring.get_sqe();
+        if (sqe == nullptr) {
+            drop(u, "submission queue full");
+            return false;
+        }
+        u->slot_fixed = fixed_sends;
+        IoRing::prep_send(sqe, u->sock, slot_data(u->slot) + u->slot_sent, u->slot_len - u->slot_sent,
+                          u->slot_fixed, 0, tag(u, URING_OP_SEND));
+        ++u->inflight;
+        return true;
+    }
+
+    // next chunk of the outbox into u's slot
+    void fill_slot(UringConnection* u) {
+        ConstByteSpan queued = u->outbox.front();
+        ui32 n = (ui32)MIN(queued.len, (ui64)URING_SEND_SLOT_BYTES);
+        memcpy(slot_data(u->slot), queued.data, n);
+        u->outbox.consume(n);
+        u->slot_sent = 0;
+        u->slot_len = n;
+    }
+
+    // u has queued output and no slot: take one, or wait in line
+    void start_send(UringConnection* u) {
+        if (free_slots.empty()) {
+            if (!u->starved) {
+                u->starved = true;
+                starved.push_back(u);
+            }
+            return;
+        }
+        u->slot = (i32)free_slots.back();
+        free_slots.pop_back();
+        fill_slot(u);
+        submit_send(u);
+    }
+
+    // a slot came free: first connection in line gets it
+    void release_slot(UringConnection* u) {
+        if (u->slot < 0) return;
+        i32 slot = u->slot;
+        u->slot = -1;
+        while (!starved.empty()) {
+            UringConnection* next = starved.front();
+            starved.pop_front();
+            next->starved = false;
+            if (next->closing || next->outbox.empty()) continue;
+            next->slot = slot;
+            fill_slot(next);
+            submit_send(next);
+            return;
+        }
+        free_slots.push_back((ui32)slot);
+    }
+
+    void complete(const io_uring_cqe& cqe) {
+        UringOp op = (UringOp)(cqe.user_data & URING_OP_MASK);
+        void* owner = (void*)(uintptr_t)(cqe.user_data & ~(ui64)URING_OP_MASK);
+        switch (op) {
+        case URING_OP_ACCEPT:
+            on_accept(cqe);
+            break;
+        case URING_OP_RECV:
+            on_recv((UringConnection*)owner, cqe);
+            break;
+        case URING_OP_SEND:
+            on_send((UringConnection*)owner, cqe);
+            break;
+        case URING_OP_WAKE:
+            if (!stopping.load(std::memory_order_acquire)) arm_wake();
+            break;
+        case URING_OP_CONSOLE:
+            if (cqe.res >= 0 && read_console()) arm_console();
+            break;
+        default:
+            break;
+        }
+    }
+
+    void on_accept(const io_uring_cqe& cqe) {
+        if (cqe.res >= 0) {
+            UringConnection* u = (UringConnection*)admit(cqe.res);
+            if (u != nullptr) {
+                arm_recv(u);
+                if (!u->closing) greet(u);
+            }
+        } else if (cqe.res == -EMFILE || cqe.res == -ENFILE) {
+            std::cerr << "[Server] Out of file descriptors, " << conns.size() << " clients connected"
+                      << std::endl;
+            if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                accept_paused = true;
+                return;
+            }
+        }
+        if (!(cqe.flags & IORING_CQE_F_MORE) && !stopping.load(std::memory_order_acquire)) {
+            accept_paused = !arm_accept();
+        }
+    }
+
+    void on_recv(UringConnection* u, const io_uring_cqe& cqe) {
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            ui16 bid = (ui16)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            if (cqe.res > 0 && !u->closing) {
+                feed(u, recv_buffers.buffer(bid), (ui64)cqe.res);
+            }
+            recv_buffers.recycle(bid);
+        }
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            u->recv_armed = false;
+            --u->inflight;
+        }
+        if (u->closing) return;
+        if (cqe.res == 0) {
+            drop(u, "disconnected");
+            return;
+        }
+        // ENOBUFS: the ring ran dry and the recv ended, the buffers are
+        // back by now. ECANCELED: paused.
+        if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+            drop(u, "recv error");
+            return;
+        }
+        if (!u->reader.wants_read()) {
+            pause_recv(u);
+        } else if (!u->recv_armed) {
+            arm_recv(u);
+        }
+    }
+
+    void on_send(UringConnection* u, const io_uring_cqe& cqe) {
+        --u->inflight;
+        if (u->closing) {
+            release_slot(u);
+            return;
+        }
+        if (cqe.res < 0) {
+            // every send submitted before the first refusal comes back
+            // like this too, each one goes again as plain memory
+            if (cqe.res == -EINVAL && u->slot_fixed) {
+                fixed_sends = false;
+                submit_send(u);
+                return;
+            }
+            release_slot(u);
+            drop(u, "send failed");
+            return;
+        }
+        u->slot_sent += (ui32)cqe.res;
+        if (u->slot_sent < u->slot_len) {
+            submit_send(u);
+            return;
+        }
+        if (!u->outbox.empty()) {
+            fill_slot(u);
+            submit_send(u);
+        } else {
+            release_slot(u);
+        }
+        resume_recv(u);
+    }
+};
+
+#endif // __linux__
+
+#endif // URING_SERVER_H
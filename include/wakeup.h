@@ -0,0 +1,213 @@
+#ifndef WAKEUP_H
+#define WAKEUP_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include "net.h"
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#endif
+
+typedef uint8_t ui8;
+typedef uint64_t ui64;
+
+enum WaitResult {
+    // data, eof or an error is waiting on the socket; recv says which
+    WAIT_READABLE = 0,
+    // the waker fired, stop
+    WAIT_WOKEN = 1,
+    WAIT_TIMEOUT = 2,
+    WAIT_ERROR = 3,
+};
+
+// a handle a thread blocked in wait_readable can be woken through from
+// any other thread. windows select() only takes sockets, so there it is a
+// loopback udp socket connected to itself; linux uses an eventfd, other
+// systems a pipe. stays readable from the first wake() until drain().
+class Waker {
+private:
+    socket_t read_fd;
+    socket_t write_fd;
+
+public:
+    Waker() : read_fd((socket_t)-1), write_fd((socket_t)-1) {}
+
+    ~Waker() {
+        close_all();
+    }
+
+    Waker(const Waker&) = delete;
+    Waker& operator=(const Waker&) = delete;
+
+    bool open() {
+        close_all();
+#ifdef _WIN32
+        SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (s == INVALID_SOCKET) return false;
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        socklen_t len = sizeof(addr);
+        if (bind(s, (sockaddr*)&addr, sizeof(addr)) != 0 || getsockname(s, (sockaddr*)&addr, &len) != 0 ||
+            connect(s, (sockaddr*)&addr, sizeof(addr)) != 0 || !set_nonblocking(s)) {
+            closesocket(s);
+            return false;
+        }
+        read_fd = write_fd = s;
+#elif defined(__linux__)
+        int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0) return false;
+        read_fd = write_fd = fd;
+#else
+        int fds[2];
+        if (pipe(fds) != 0) return false;
+        set_nonblocking(fds[0]);
+        set_nonblocking(fds[1]);
+        read_fd = fds[0];
+        write_fd = fds[1];
+#endif
+        return true;
+    }
+
+    // thread safe, and signal safe on posix
+    void wake() {
+        if (write_fd == (socket_t)-1) return;
+#ifdef _WIN32
+        char one = 1;
+        send(write_fd, &one, 1, 0);
+#elif defined(__linux__)
+        ui64 one = 1;
+        if (write(write_fd, &one, sizeof(one)) < 0) {
+            // already signalled
+        }
+#else
+        char one = 1;
+        if (write(write_fd, &one, 1) < 0) {
+            // pipe full, already signalled
+        }
+#endif
+    }
+
+    // back to not readable
+    void drain() {
+        if (read_fd == (socket_t)-1) return;
+        char buf[64];
+#ifdef _WIN32
+        while (recv(read_fd, buf, sizeof(buf), 0) > 0) {
+        }
+#else
+        while (read(read_fd, buf, sizeof(buf)) > 0) {
+        }
+#endif
+    }
+
+    socket_t get_fd() const {
+        return read_fd;
+    }
+
+private:
+    void close_all() {
+        if (read_fd != (socket_t)-1) {
+#ifdef _WIN32
+            closesocket(read_fd);
+#else
+            close(read_fd);
+            if (write_fd != read_fd) close(write_fd);
+#endif
+        }
+        read_fd = write_fd = (socket_t)-1;
+    }
+};
+
+// blocks until sock has something for recv or the waker fires, whichever
+// comes first (the waker wins a tie). timeout_ms < 0 waits forever.
+inline WaitResult wait_readable(socket_t sock, const Waker& waker, int timeout_ms = -1) {
+#ifdef _WIN32
+    for (;;) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(sock, &readable);
+        FD_SET(waker.get_fd(), &readable);
+        timeval tv;
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        int n = select(0, &readable, nullptr, nullptr, timeout_ms < 0 ? nullptr : &tv);
+        if (n == SOCKET_ERROR) {
+            if (WSAGetLastError() == WSAEINTR) continue;
+            return WAIT_ERROR;
+        }
+        if (n == 0) return WAIT_TIMEOUT;
+        if (FD_ISSET(waker.get_fd(), &readable)) return WAIT_WOKEN;
+        return WAIT_READABLE;
+    }
+#else
+    pollfd fds[2];
+    fds[0].fd = sock;
+    fds[0].events = POLLIN;
+    fds[1].fd = waker.get_fd();
+    fds[1].events = POLLIN;
+    for (;;) {
+        fds[0].revents = fds[1].revents = 0;
+        int n = poll(fds, 2, timeout_ms);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return WAIT_ERROR;
+        }
+        if (n == 0) return WAIT_TIMEOUT;
+        if (fds[1].revents != 0) return WAIT_WOKEN;
+        return WAIT_READABLE;
+    }
+#endif
+}
+
+// one-way stop flag shared by a connection's threads. reads are a single
+// atomic load; set() also wakes a thread parked in wait() and one blocked
+// in wait_readable on the attached waker, so nobody polls it on a timer.
+class ExitSignal {
+private:
+    std::atomic<bool> flag;
+    std::mutex lock;
+    std::condition_variable changed;
+    Waker* waker;
+
+public:
+    explicit ExitSignal(Waker* waker_ = nullptr) : flag(false), waker(waker_) {}
+
+    ExitSignal(const ExitSignal&) = delete;
+    ExitSignal& operator=(const ExitSignal&) = delete;
+
+    bool is_set() const {
+        return flag.load(std::memory_order_acquire);
+    }
+
+    void set() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            flag.store(true, std::memory_order_release);
+        }
+        changed.notify_all();
+        if (waker != nullptr) waker->wake();
+    }
+
+    // until set()
+    void wait() {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this] { return flag.load(std::memory_order_acquire); });
+    }
+};
+
+#endif // WAKEUP_H
@@ -0,0 +1,616 @@
+#ifndef X25519_H
+#define X25519_H
+
+#include <cstdint>
+#include <cstring>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "chacha.h"
+#include "csprng.h"
+
+#if !defined(__SIZEOF_INT128__)
+#error "x25519.h needs a 64-bit compiler with unsigned __int128"
+#endif
+
+typedef uint8_t ui8;
+typedef uint32_t ui32;
+typedef uint64_t ui64;
+typedef unsigned __int128 ui128;
+
+#define X25519_KEY_BYTES 32
+// fixed-base comb: 32 rows of j * 256^i * B for j = 1..8
+#define X25519_COMB_ROWS 32
+#define X25519_COMB_ENTRIES 8
+// keypairs per shared inversion in generate_batch
+#define X25519_BATCH 64
+
+// curve25519 diffie-hellman (rfc 7748).
+//
+// field elements are five 51-bit limbs in 64-bit words, products go through
+// unsigned __int128. shared secrets use the constant-time montgomery ladder.
+// public keys (fixed base) use a precomputed edwards comb instead: 64 signed
+// 4-bit digits, 4 doublings and 64 table lookups, each a full scan of its
+// row so the access pattern doesn't depend on the secret.
+class X25519 {
+private:
+    struct Fe {
+        ui64 v[5];
+    };
+
+    // extended twisted edwards point (X:Y:Z:T), x = X/Z, y = Y/Z, xy = T/Z
+    struct Point {
+        Fe X, Y, Z, T;
+    };
+
+    // affine table entry (y+x, y-x, 2dxy)
+    struct Niels {
+        Fe yplusx, yminusx, xy2d;
+    };
+
+    struct CombTable {
+        Niels row[X25519_COMB_ROWS][X25519_COMB_ENTRIES];
+        CombTable() { build(*this); }
+    };
+
+    static constexpr ui64 MASK51 = ((ui64)1 << 51) - 1;
+
+public:
+    static void clamp(ui8 sk[X25519_KEY_BYTES]) {
+        sk[0] &= 248;
+        sk[31] &= 127;
+        sk[31] |= 64;
+    }
+
+    // out = scalar * u. the scalar is clamped on a copy.
+    static void scalarmult(ui8 out[X25519_KEY_BYTES], const ui8 scalar[X25519_KEY_BYTES],
+                           const ui8 u[X25519_KEY_BYTES]) {
+        ui8 k[X25519_KEY_BYTES];
+        memcpy(k, scalar, sizeof(k));
+        clamp(k);
+
+        Fe x1, x2, z2, x3, z3, a, aa, b, bb, e, c, d, da, cb;
+        from_bytes(x1, u);
+        set_one(x2);
+        set_zero(z2);
+        x3 = x1;
+        set_one(z3);
+
+        ui64 swap = 0;
+        for (int t = 254; t >= 0; --t) {
+            ui64 bit = (k[t >> 3] >> (t & 7)) & 1;
+            swap ^= bit;
+            cswap(x2, x3, swap);
+            cswap(z2, z3, swap);
+            swap = bit;
+
+            add(a, x2, z2);
+            sq(aa, a);
+            sub(b, x2, z2);
+            sq(bb, b);
+            sub(e, aa, bb);
+            add(c, x3, z3);
+            sub(d, x3, z3);
+            mul(da, d, a);
+            mul(cb, c, b);
+            add(x3, da, cb);
+            sq(x3, x3);
+            sub(z3, da, cb);
+            sq(z3, z3);
+            mul(z3, z3, x1);
+            mul(x2, aa, bb);
+            mul_small(z2, e, 121665);
+            add(z2, z2, aa);
+            mul(z2, z2, e);
+        }
+        cswap(x2, x3, swap);
+        cswap(z2, z3, swap);
+
+        invert(z2, z2);
+        mul(x2, x2, z2);
+        to_bytes(out, x2);
+        memset(k, 0, sizeof(k));
+    }
+
+    // pk = sk * 9 via the comb table, same clamping as scalarmult
+    static void public_key(ui8 pk[X25519_KEY_BYTES], const ui8 sk[X25519_KEY_BYTES]) {
+        Point p;
+        base_mult(p, sk);
+        Fe num, den;
+        montgomery_u(num, den, p);
+        invert(den, den);
+        mul(num, num, den);
+        to_bytes(pk, num);
+    }
+
+    // false when the peer sent a low-order point (all-zero shared secret)
+    static bool shared(ui8 out[X25519_KEY_BYTES], const ui8 sk[X25519_KEY_BYTES],
+                       const ui8 peer_pk[X25519_KEY_BYTES]) {
+        scalarmult(out, sk, peer_pk);
+        ui8 acc = 0;
+        for (int i = 0; i < X25519_KEY_BYTES; ++i) {
+            acc |= out[i];
+        }
+        return acc != 0;
+    }
+
+    static void generate(ui8 pk[X25519_KEY_BYTES], ui8 sk[X25519_KEY_BYTES]) {
+        ThreadRng::local().fill(sk, X25519_KEY_BYTES);
+        clamp(sk);
+        public_key(pk, sk);
+    }
+
+    // many keypairs at once. the field inversion dominates a single keygen,
+    // so the (Z - Y) denominators of a batch share one inversion
+    // (montgomery's trick: 3 multiplications per extra key instead).
+    static void generate_batch(ui8 (*pks)[X25519_KEY_BYTES], ui8 (*sks)[X25519_KEY_BYTES], ui64 count) {
+        Fe num[X25519_BATCH], den[X25519_BATCH], prefix[X25519_BATCH];
+        for (ui64 base = 0; base < count; base += X25519_BATCH) {
+            ui64 n = count - base < X25519_BATCH ? count - base : X25519_BATCH;
+            ThreadRng::local().fill(sks[base], n * X25519_KEY_BYTES);
+            for (ui64 i = 0; i < n; ++i) {
+                clamp(sks[base + i]);
+                Point p;
+                base_mult(p, sks[base + i]);
+                montgomery_u(num[i], den[i], p);
+                if (i == 0) {
+                    prefix[0] = den[0];
+                } else {
+                    mul(prefix[i], prefix[i - 1], den[i]);
+                }
+            }
+
+            Fe inv, tmp;
+            invert(inv, prefix[n - 1]);
+            for (ui64 i = n; i-- > 0;) {
+                if (i > 0) {
+                    mul(tmp, inv, prefix[i - 1]);
+                    mul(inv, inv, den[i]);
+                } else {
+                    tmp = inv;
+                }
+                mul(num[i], num[i], tmp);
+                to_bytes(pks[base + i], num[i]);
+            }
+        }
+    }
+
+private:
+    // ---- field arithmetic mod 2^255 - 19 ----
+
+    static void set_zero(Fe& h) {
+        memset(h.v, 0, sizeof(h.v));
+    }
+
+    static void set_one(Fe& h) {
+        set_zero(h);
+        h.v[0] = 1;
+    }
+
+    static ui64 load64(const ui8* p) {
+        ui64 v = 0;
+        for (int i = 7; i >= 0; --i) {
+            v = (v << 8) | p[i];
+        }
+        return v;
+    }
+
+    static void store64(ui8* p, ui64 v) {
+        for (int i = 0; i < 8; ++i) {
+            p[i] = (ui8)(v >> (8 * i));
+        }
+    }
+
+    // ignores bit 255 as rfc 7748 requires
+    static void from_bytes(Fe& h, const ui8 s[32]) {
+        ui64 w0 = load64(s), w1 = load64(s + 8), w2 = load64(s + 16), w3 = load64(s + 24);
+        h.v[0] = w0 & MASK51;
+        h.v[1] = ((w0 >> 51) | (w1 << 13)) & MASK51;
+        h.v[2] = ((w1 >> 38) | (w2 << 26)) & MASK51;
+        h.v[3] = ((w2 >> 25) | (w3 << 39)) & MASK51;
+        h.v[4] = (w3 >> 12) & MASK51;
+    }
+
+    static void to_bytes(ui8 s[32], const Fe& f) {
+        Fe h = f;
+        carry(h);
+        carry(h);
+        // h < 2^255 + small now; subtract p once if h >= p
+        ui64 q = (h.v[0] + 19) >> 51;
+        q = (h.v[1] + q) >> 51;
+        q = (h.v[2] + q) >> 51;
+        q = (h.v[3] + q) >> 51;
+        q = (h.v[4] + q) >> 51;
+        h.v[0] += 19 * q;
+        h.v[1] += h.v[0] >> 51;
+        h.v[0] &= MASK51;
+        h.v[2] += h.v[1] >> 51;
+        h.v[1] &= MASK51;
+        h.v[3] += h.v[2] >> 51;
+        h.v[2] &= MASK51;
+        h.v[4] += h.v[3] >> 51;
+        h.v[3] &= MASK51;
+        h.v[4] &= MASK51;
+
+        store64(s, h.v[0] | (h.v[1] << 51));
+        store64(s + 8, (h.v[1] >> 13) | (h.v[2] << 38));
+        store64(s + 16, (h.v[2] >> 26) | (h.v[3] << 25));
+        store64(s + 24, (h.v[3] >> 39) | (h.v[4] << 12));
+    }
+
+    // one pass back to ~51-bit limbs
+    static void carry(Fe& h) {
+        ui64 c;
+        c = h.v[0] >> 51; h.v[0] &= MASK51; h.v[1] += c;
+        c = h.v[1] >> 51; h.v[1] &= MASK51; h.v[2] += c;
+        c = h.v[2] >> 51; h.v[2] &= MASK51; h.v[3] += c;
+        c = h.v[3] >> 51; h.v[3] &= MASK51; h.v[4] += c;
+        c = h.v[4] >> 51; h.v[4] &= MASK51; h.v[0] += 19 * c;
+    }
+
+    // no carry: limbs grow by one bit, fine as a mul/sub input
+    static void add(Fe& h, const Fe& f, const Fe& g) {
+        for (int i = 0; i < 5; ++i) {
+            h.v[i] = f.v[i] + g.v[i];
+        }
+    }
+
+    // f + 4p - g, carried. g may be an uncarried add() result.
+    static void sub(Fe& h, const Fe& f, const Fe& g) {
+        h.v[0] = (f.v[0] + 0x1fffffffffffb4) - g.v[0];
+        h.v[1] = (f.v[1] + 0x1ffffffffffffc) - g.v[1];
+        h.v[2] = (f.v[2] + 0x1ffffffffffffc) - g.v[2];
+        h.v[3] = (f.v[3] + 0x1ffffffffffffc) - g.v[3];
+        h.v[4] = (f.v[4] + 0x1ffffffffffffc) - g.v[4];
+        carry(h);
+    }
+
+    static void neg(Fe& h, const Fe& f) {
+        Fe zero;
+        set_zero(zero);
+        sub(h, zero, f);
+    }
+
+    static void reduce(Fe& h, ui128 r0, ui128 r1, ui128 r2, ui128 r3, ui128 r4) {
+        r1 += (ui64)(r0 >> 51);
+        r2 += (ui64)(r1 >> 51);
+        r3 += (ui64)(r2 >> 51);
+        r4 += (ui64)(r3 >> 51);
+        ui64 c = (ui64)(r4 >> 51);
+        h.v[0] = ((ui64)r0 & MASK51) + 19 * c;
+        h.v[1] = (ui64)r1 & MASK51;
+        h.v[2] = (ui64)r2 & MASK51;
+        h.v[3] = (ui64)r3 & MASK51;
+        h.v[4] = (ui64)r4 & MASK51;
+        h.v[1] += h.v[0] >> 51;
+        h.v[0] &= MASK51;
+    }
+
+    static void mul(Fe& h, const Fe& f, const Fe& g) {
+        ui64 f0 = f.v[0], f1 = f.v[1], f2 = f.v[2], f3 = f.v[3], f4 = f.v[4];
+        ui64 g0 = g.v[0], g1 = g.v[1], g2 = g.v[2], g3 = g.v[3], g4 = g.v[4];
+        ui64 g1_19 = 19 * g1, g2_19 = 19 * g2, g3_19 = 19 * g3, g4_19 = 19 * g4;
+
+        ui128 r0 = (ui128)f0 * g0 + (ui128)f1 * g4_19 + (ui128)f2 * g3_19 + (ui128)f3 * g2_19 + (ui128)f4 * g1_19;
+        ui128 r1 = (ui128)f0 * g1 + (ui128)f1 * g0 + (ui128)f2 * g4_19 + (ui128)f3 * g3_19 + (ui128)f4 * g2_19;
+        ui128 r2 = (ui128)f0 * g2 + (ui128)f1 * g1 + (ui128)f2 * g0 + (ui128)f3 * g4_19 + (ui128)f4 * g3_19;
+        ui128 r3 = (ui128)f0 * g3 + (ui128)f1 * g2 + (ui128)f2 * g1 + (ui128)f3 * g0 + (ui128)f4 * g4_19;
+        ui128 r4 = (ui128)f0 * g4 + (ui128)f1 * g3 + (ui128)f2 * g2 + (ui128)f3 * g1 + (ui128)f4 * g0;
+        reduce(h, r0, r1, r2, r3, r4);
+    }
+
+    static void sq(Fe& h, const Fe& f) {
+        ui64 f0 = f.v[0], f1 = f.v[1], f2 = f.v[2], f3 = f.v[3], f4 = f.v[4];
+        ui64 f0_2 = 2 * f0, f1_2 = 2 * f1, f2_2 = 2 * f2;
+        ui64 f3_19 = 19 * f3, f4_19 = 19 * f4;
+
+        ui128 r0 = (ui128)f0 * f0 + (ui128)f1_2 * f4_19 + (ui128)f2_2 * f3_19;
+        ui128 r1 = (ui128)f0_2 * f1 + (ui128)f2_2 * f4_19 + (ui128)f3 * f3_19;
+        ui128 r2 = (ui128)f0_2 * f2 + (ui128)f1 * f1 + (ui128)(2 * f3) * f4_19;
+        ui128 r3 = (ui128)f0_2 * f3 + (ui128)f1_2 * f2 + (ui128)f4 * f4_19;
+        ui128 r4 = (ui128)f0_2 * f4 + (ui128)f1_2 * f3 + (ui128)f2 * f2;
+        reduce(h, r0, r1, r2, r3, r4);
+    }
+
+    static void sq_n(Fe& h, const Fe& f, int n) {
+        sq(h, f);
+        for (int i = 1; i < n; ++i) {
+            sq(h, h);
+        }
+    }
+
+    static void mul_small(Fe& h, const Fe& f, ui32 k) {
+        reduce(h, (ui128)f.v[0] * k, (ui128)f.v[1] * k, (ui128)f.v[2] * k,
+               (ui128)f.v[3] * k, (ui128)f.v[4] * k);
+    }
+
+    // z^(p-2)
+    static void invert(Fe& out, const Fe& z) {
+        Fe t0, t1, t2, t3;
+        sq(t0, z);                 // 2
+        sq_n(t1, t0, 2);           // 8
+        mul(t1, t1, z);            // 9
+        mul(t0, t0, t1);           // 11
+        sq(t2, t0);                // 22
+        mul(t1, t1, t2);           // 2^5 - 1
+        sq_n(t2, t1, 5);
+        mul(t1, t2, t1);           // 2^10 - 1
+        sq_n(t2, t1, 10);
+        mul(t2, t2, t1);           // 2^20 - 1
+        sq_n(t3, t2, 20);
+        mul(t2, t3, t2);           // 2^40 - 1
+        sq_n(t2, t2, 10);
+        mul(t1, t2, t1);           // 2^50 - 1
+        sq_n(t2, t1, 50);
+        mul(t2, t2, t1);           // 2^100 - 1
+        sq_n(t3, t2, 100);
+        mul(t2, t3, t2);           // 2^200 - 1
+        sq_n(t2, t2, 50);
+        mul(t1, t2, t1);           // 2^250 - 1
+        sq_n(t1, t1, 5);           // 2^255 - 32
+        mul(out, t1, t0);          // 2^255 - 21
+    }
+
+    static void cswap(Fe& f, Fe& g, ui64 bit) {
+        ui64 mask = 0 - bit;
+        for (int i = 0; i < 5; ++i) {
+            ui64 x = mask & (f.v[i] ^ g.v[i]);
+            f.v[i] ^= x;
+            g.v[i] ^= x;
+        }
+    }
+
+    static void cmov(Fe& f, const Fe& g, ui64 bit) {
+        ui64 mask = 0 - bit;
+        for (int i = 0; i < 5; ++i) {
+            f.v[i] ^= mask & (f.v[i] ^ g.v[i]);
+        }
+    }
+
+    // ---- edwards25519, used only for the fixed base ----
+
+    static const Fe& edwards_d2() {
+        static const Fe d2 = {{0x69b9426b2f159, 0x35050762add7a, 0x3cf44c0038052, 0x6738cc7407977, 0x2406d9dc56dff}};
+        return d2;
+    }
+
+    // the ed25519 base point, birationally equivalent to u = 9
+    static void base_point(Point& p) {
+        static const Fe x = {{0x62d608f25d51a, 0x412a4b4f6592a, 0x75b7171a4b31d, 0x1ff60527118fe, 0x216936d3cd6e5}};
+        static const Fe y = {{0x6666666666658, 0x4cccccccccccc, 0x1999999999999, 0x3333333333333, 0x6666666666666}};
+        p.X = x;
+        p.Y = y;
+        set_one(p.Z);
+        mul(p.T, x, y);
+    }
+
+    static void identity(Point& p) {
+        set_zero(p.X);
+        set_one(p.Y);
+        set_one(p.Z);
+        set_zero(p.T);
+    }
+
+    static void dbl(Point& r, const Point& p) {
+        Fe xx, yy, zz2, a, aa, ex, ey, ez, et;
+        sq(xx, p.X);
+        sq(yy, p.Y);
+        sq(zz2, p.Z);
+        add(zz2, zz2, zz2);
+        add(a, p.X, p.Y);
+        sq(aa, a);
+        add(ey, yy, xx);
+        sub(ez, yy, xx);
+        sub(ex, aa, ey);
+        sub(et, zz2, ez);
+        mul(r.X, ex, et);
+        mul(r.Y, ey, ez);
+        mul(r.Z, ez, et);
+        mul(r.T, ex, ey);
+    }
+
+    // r = p + q, q affine
+    static void madd(Point& r, const Point& p, const Niels& q) {
+        Fe a, b, c, d, ex, ey, ez, et;
+        add(a, p.Y, p.X);
+        sub(b, p.Y, p.X);
+        mul(a, a, q.yplusx);
+        mul(b, b, q.yminusx);
+        mul(c, p.T, q.xy2d);
+        add(d, p.Z, p.Z);
+        sub(ex, a, b);
+        add(ey, a, b);
+        add(ez, d, c);
+        sub(et, d, c);
+        mul(r.X, ex, et);
+        mul(r.Y, ey, ez);
+        mul(r.Z, ez, et);
+        mul(r.T, ex, ey);
+    }
+
+    static void to_niels(Niels& n, const Point& p) {
+        Fe zi, x, y;
+        invert(zi, p.Z);
+        mul(x, p.X, zi);
+        mul(y, p.Y, zi);
+        add(n.yplusx, y, x);
+        carry(n.yplusx);
+        sub(n.yminusx, y, x);
+        mul(n.xy2d, x, y);
+        mul(n.xy2d, n.xy2d, edwards_d2());
+    }
+
+    // one-off, ~256 inversions; built on first use
+    static void build(CombTable& table) {
+        Point p, cur;
+        base_point(p);
+        for (int i = 0; i < X25519_COMB_ROWS; ++i) {
+            Niels* row = table.row[i];
+            to_niels(row[0], p);
+            cur = p;
+            for (int j = 1; j < X25519_COMB_ENTRIES; ++j) {
+                madd(cur, cur, row[0]);
+                to_niels(row[j], cur);
+            }
+            for (int k = 0; k < 8; ++k) {
+                dbl(p, p);
+            }
+        }
+    }
+
+    static const CombTable& comb() {
+        static const CombTable table;
+        return table;
+    }
+
+    static ui64 equal(int a, int b) {
+        ui32 x = (ui32)(a ^ b);
+        return (ui64)((x - 1) >> 31);
+    }
+
+    // t = b * 256^pos * B for b in [-8, 8], scanning the whole row
+    static void select(Niels& t, int pos, int b) {
+        const Niels* row = comb().row[pos];
+        ui64 negative = (ui64)((ui32)b >> 31);
+        int babs = b - (int)(((0 - negative) & (ui64)b) << 1);
+
+        set_one(t.yplusx);
+        set_one(t.yminusx);
+        set_zero(t.xy2d);
+        for (int j = 0; j < X25519_COMB_ENTRIES; ++j) {
+            ui64 hit = equal(babs, j + 1);
+            cmov(t.yplusx, row[j].yplusx, hit);
+            cmov(t.yminusx, row[j].yminusx, hit);
+            cmov(t.xy2d, row[j].xy2d, hit);
+        }
+
+        Fe minus;
+        neg(minus, t.xy2d);
+        cswap(t.yplusx, t.yminusx, negative);
+        cmov(t.xy2d, minus, negative);
+    }
+
+    // p = sk * B, sk clamped on a copy (so < 2^255)
+    static void base_mult(Point& p, const ui8 sk[X25519_KEY_BYTES]) {
+        ui8 k[X25519_KEY_BYTES];
+        memcpy(k, sk, sizeof(k));
+        clamp(k);
+        signed char e[64];
+        for (int i = 0; i < 32; ++i) {
+            e[2 * i] = (signed char)(k[i] & 15);
+            e[2 * i + 1] = (signed char)(k[i] >> 4);
+        }
+        memset(k, 0, sizeof(k));
+        // recode to [-8, 8)
+        signed char c = 0;
+        for (int i = 0; i < 63; ++i) {
+            e[i] += c;
+            c = (signed char)((e[i] + 8) >> 4);
+            e[i] -= (signed char)(c * 16);
+        }
+        e[63] += c;
+
+        Niels t;
+        identity(p);
+        for (int i = 1; i < 64; i += 2) {
+            select(t, i / 2, e[i]);
+            madd(p, p, t);
+        }
+        for (int k = 0; k < 4; ++k) {
+            dbl(p, p);
+        }
+        for (int i = 0; i < 64; i += 2) {
+            select(t, i / 2, e[i]);
+            madd(p, p, t);
+        }
+        memset(e, 0, sizeof(e));
+    }
+
+    // montgomery u = (1 + y) / (1 - y) = (Z + Y) / (Z - Y)
+    static void montgomery_u(Fe& num, Fe& den, const Point& p) {
+        add(num, p.Z, p.Y);
+        sub(den, p.Z, p.Y);
+    }
+};
+
+// keypairs generated ahead of time on a background thread, so a burst of
+// new connections doesn't pay for keygen on the accept path. take() falls
+// back to generating inline when the pool has run dry.
+class KeyPairPool {
+private:
+    std::vector<ui8> keys; // capacity * (pk | sk)
+    ui64 count;
+    ui64 capacity;
+    bool stopping;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::thread worker;
+
+public:
+    explicit KeyPairPool(ui64 capacity_ = 4 * X25519_BATCH)
+        : keys(capacity_ * 2 * X25519_KEY_BYTES), count(0), capacity(capacity_), stopping(false) {
+        worker = std::thread([this] { refill_loop(); });
+    }
+
+    ~KeyPairPool() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+        memset(keys.data(), 0, keys.size());
+    }
+
+    KeyPairPool(const KeyPairPool&) = delete;
+    KeyPairPool& operator=(const KeyPairPool&) = delete;
+
+    void take(ui8 pk[X25519_KEY_BYTES], ui8 sk[X25519_KEY_BYTES]) {
+        bool hit = false;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (count > 0) {
+                ui8* slot = keys.data() + (--count) * 2 * X25519_KEY_BYTES;
+                memcpy(pk, slot, X25519_KEY_BYTES);
+                memcpy(sk, slot + X25519_KEY_BYTES, X25519_KEY_BYTES);
+                memset(slot, 0, 2 * X25519_KEY_BYTES);
+                hit = true;
+            }
+        }
+        wake.notify_one();
+        if (!hit) {
+            X25519::generate(pk, sk);
+        }
+    }
+
+    ui64 available() {
+        std::lock_guard<std::mutex> guard(lock);
+        return count;
+    }
+
+private:
+    void refill_loop() {
+        ui8 pks[X25519_BATCH][X25519_KEY_BYTES];
+        ui8 sks[X25519_BATCH][X25519_KEY_BYTES];
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [this] { return stopping || count < capacity; });
+                if (stopping) break;
+            }
+            X25519::generate_batch(pks, sks, X25519_BATCH);
+
+            std::lock_guard<std::mutex> guard(lock);
+            for (ui64 i = 0; i < X25519_BATCH && count < capacity; ++i, ++count) {
+                ui8* slot = keys.data() + count * 2 * X25519_KEY_BYTES;
+                memcpy(slot, pks[i], X25519_KEY_BYTES);
+                memcpy(slot + X25519_KEY_BYTES, sks[i], X25519_KEY_BYTES);
+            }
+        }
+        memset(pks, 0, sizeof(pks));
+        memset(sks, 0, sizeof(sks));
+    }
+};
+
+#endif // X25519_H
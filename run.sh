@@ -8,7 +8,7 @@ echo
 
 
 echo "[1/1] building combined binary..."
-g++ -std=c++17 -Wall -I./include -o main_combined src/main_combined.cpp src/server.cpp src/client.cpp src/crypto.cpp -lpthread
+g++ -std=c++17 -Wall -O2 -I./include -o main_combined src/main_combined.cpp src/crypto.cpp -lpthread
 if [ $? -ne 0 ]; then
     echo "error: failed to build main_combined!"
     exit 1
@@ -23,8 +23,8 @@ echo "========================================="
 echo
 
 echo "to run the system:"
-echo "  1. open first terminal and run: ./server"
-echo "  2. open second terminal and run: ./client"
+echo "  1. open first terminal and run: ./main_combined --server"
+echo "  2. connect clients to port 9001"
 echo
 
 echo "all conversations will be logged to: logs/messages.txt"
@@ -3,11 +3,16 @@
 #include <string>
 #include <sstream>
 #include <process.h>
+#include <thread>
 #include <cstdlib>
 #include "../include/crypto.h"
 #include "../include/arena.h"
 #include "../include/message.h"
+#include "../include/frame.h"
+#include "../include/coalesce.h"
+#include "../include/conn.h"
 #include "../include/logger.h"
+#include "../include/wakeup.h"
 
 #ifdef _MSC_VER
 #pragma comment(lib, "ws2_32.lib")
@@ -16,6 +21,15 @@
 #define SERVER_IP "127.0.0.1"
 #define SERVER_PORT 9001
 #define BUFFER_SIZE 1024
+// frames are batched per write until 16 KB or 200 us; 0 us sends each one alone
+#define COALESCE_FLUSH_BYTES (16 * 1024)
+#define COALESCE_DEADLINE_US 200
+// buffer budget for the connection: reading pauses at soft, past hard the
+// peer is dropped
+#define CONN_BUDGET_SOFT_BYTES (64 * 1024)
+#define CONN_BUDGET_HARD_BYTES (256 * 1024)
+// lz4-compress compressible payloads before sealing (flagged per frame)
+#define COMPRESS_MESSAGES 1
 
 // clientside messaging
 class SecureClient {
@@ -26,17 +40,30 @@ private:
     MessageLogger logger;
     KeyPair my_keypair;
     KeyPair peer_keypair;
+    Session session;
     std::string my_name;
-    bool should_exit;
+    ui64 send_seq;
+    ui64 recv_seq;
+    ConnBudget budget;
+    FrameCoalescer coalescer;
+    // wakes the receive thread out of its wait on shutdown
+    Waker waker;
+    ExitSignal should_exit;
 
 public:
-    SecureClient() : socket_fd(INVALID_SOCKET), arena(10 * 1024 * 1024), crypto_engine(), 
-                    logger("logs/messages.txt"), my_name("Client"), should_exit(false) {
+    SecureClient() : socket_fd(INVALID_SOCKET), arena(CONN_ARENA_RESERVE), crypto_engine(), 
+                    logger("logs/messages.txt"), my_name("Client"), send_seq(0), recv_seq(0),
+                    budget(ConnBudgetConfig(CONN_BUDGET_SOFT_BYTES, CONN_BUDGET_HARD_BYTES)),
+                    coalescer(CoalesceConfig(COALESCE_FLUSH_BYTES, COALESCE_DEADLINE_US)), waker(), should_exit(&waker) {
         WSADATA wsa_data;
         if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
             std::cerr << "[Client] WSAStartup failed!" << std::endl;
             throw std::runtime_error("WSAStartup failed");
         }
+        if (!waker.open()) {
+            WSACleanup();
+            throw std::runtime_error("Wakeup socket failed");
+        }
 
         // gen keys
         my_keypair.generate(arena);
@@ -84,21 +111,32 @@ public:
     }
 
     bool exchange_keypairs() {
-        // receive server's public key
-        ui8 received_key[32];
-        int recv_len = recv(socket_fd, (char*)received_key, 32, 0);
-        if (recv_len != 32) {
+        // receive server's public key + suite offer
+        ui8 hello[HANDSHAKE_HELLO_BYTES];
+        int recv_len = recv(socket_fd, (char*)hello, HANDSHAKE_HELLO_BYTES, 0);
+        if (recv_len != HANDSHAKE_HELLO_BYTES) {
             std::cerr << "[Client] Failed to receive server's public key!" << std::endl;
             return false;
         }
 
         peer_keypair.public_key = (ui8*)arena.push(32, 0);
-        memcpy(peer_keypair.public_key, received_key, 32);
+        memcpy(peer_keypair.public_key, hello, 32);
 
         std::cout << "[Client] Received server's public key" << std::endl;
 
-        //send my public key
-        if (send(socket_fd, (const char*)my_keypair.public_key, 32, 0) == SOCKET_ERROR) {
+        CipherSuite suite;
+        if (!choose_suite(hello[X25519_KEY_BYTES], suite)) {
+            std::cerr << "[Client] No common cipher suite with server!" << std::endl;
+            return false;
+        }
+        if (!derive_session(suite)) {
+            return false;
+        }
+
+        //send my public key + chosen suite
+        memcpy(hello, my_keypair.public_key, 32);
+        hello[X25519_KEY_BYTES] = (ui8)suite;
+        if (send(socket_fd, (const char*)hello, HANDSHAKE_HELLO_BYTES, 0) == SOCKET_ERROR) {
             std::cerr << "[Client] Failed to send public key!" << std::endl;
             return false;
         }
@@ -107,75 +145,119 @@ public:
         return true;
     }
 
+    // x25519 shared key, same on both ends
+    bool derive_session(CipherSuite suite) {
+        try {
+            session.derive(peer_keypair.public_key, my_keypair.secret_key, my_keypair.public_key, suite);
+        } catch (const std::exception& e) {
+            std::cerr << "[Client] Key agreement failed: " << e.what() << std::endl;
+            return false;
+        }
+        std::cout << "[Client] Derived shared session key (" << session.get_ops().name << ")" << std::endl;
+        return true;
+    }
+
+    // authenticate + decrypt in the receive buffer, nothing is copied out.
+    // false drops the connection.
+    bool handle_frame(const FrameHeader& header, ui8* payload) {
+        if (header.seq != recv_seq || header.suite != session.get_suite()) {
+            std::cerr << "\n[Client] Unexpected frame (seq " << header.seq << ")" << std::endl;
+            return false;
+        }
+        MessageView view = Frame::view(header, payload);
+        if (!view.open_in_place(session)) {
+            std::cerr << "\n[Client] Message authentication failed!" << std::endl;
+            return false;
+        }
+        ++recv_seq;
+
+        // only compressed frames need a second buffer, sized to the message
+        ConnBuffer inflated;
+        ui64 inflated_len = view.inflated_len();
+        if (inflated_len > BUFFER_SIZE ||
+            (inflated_len != 0 && inflated.acquire(&budget, inflated_len) == BUDGET_SHED)) {
+            std::cerr << "\n[Client] Compressed message too large!" << std::endl;
+            return false;
+        }
+        ConstByteSpan text = view.payload(ByteSpan(inflated.data(), inflated.size()));
+        if (text.data == nullptr) {
+            std::cerr << "\n[Client] Malformed compressed message!" << std::endl;
+            return false;
+        }
+
+        std::cout << "\n[Server] " << std::string_view((const char*)text.data, text.len) << std::endl;
+        std::cout << "[You] ";
+        std::cout.flush();
+        view.wipe();
+        if (text.data == inflated.data()) {
+            memset(inflated.data(), 0, text.len);
+        }
+        return true;
+    }
+
     static void recv_thread_func(void* arg) {
         SecureClient* client = (SecureClient*)arg;
-        char buffer[BUFFER_SIZE];
-        char len_buffer[4];
-        int len_received = 0;
+        // holds the header bytes between frames; each payload is a slab block
+        // sized to the frame and charged to the connection's budget
+        FrameReader reader(&client->budget, BUFFER_SIZE);
         
-        while (!client->should_exit) {
-            // read message length (4 bytes)
-            if (len_received < 4) {
-                int recv_len = recv(client->socket_fd, len_buffer + len_received, 4 - len_received, 0);
-                
-                if (recv_len == 0) {
-                    std::cout << "\n[Client] Server disconnected!" << std::endl;
-                    client->should_exit = true;
-                    break;
-                } else if (recv_len == SOCKET_ERROR) {
-                    int error = WSAGetLastError();
-                    if (error != WSAEWOULDBLOCK && error != WSAEINTR && error != WSAECONNRESET) {
-                        std::cerr << "\n[Client] Recv error: " << error << std::endl;
-                        client->should_exit = true;
-                        break;
-                    }
-                    Sleep(10);
-                    continue;
-                } else if (recv_len > 0) {
-                    len_received += recv_len;
-                }
+        while (!client->should_exit.is_set()) {
+            // parked until the peer sends something or shutdown wakes us
+            WaitResult ready = wait_readable(client->socket_fd, client->waker);
+            if (ready == WAIT_WOKEN) {
+                break;
+            }
+            if (ready == WAIT_ERROR) {
+                std::cerr << "\n[Client] Wait failed: " << WSAGetLastError() << std::endl;
+                client->should_exit.set();
+                break;
             }
+
+            int recv_len = recv(client->socket_fd, (char*)reader.target(), (int)reader.missing(), 0);
             
-            if (len_received == 4) {
-                ui32 msg_len = *(ui32*)len_buffer;
-                
-                if (msg_len > 0 && msg_len < BUFFER_SIZE) {
-                    // read the message content
-                    int recv_len = recv(client->socket_fd, buffer, msg_len, 0);
-                    
-                    if (recv_len > 0) {
-                        buffer[recv_len] = '\0';
-                        std::cout << "\n[Server] " << buffer << std::endl;
-                        std::cout << "[You] ";
-                        std::cout.flush();
-                        
-                        
-                        //eeset for nxt msg
-                        len_received = 0;
-                    } else if (recv_len == SOCKET_ERROR) {
-                        int error = WSAGetLastError();
-                        if (error == WSAEWOULDBLOCK || error == WSAEINTR) {
-                            //wait for continous data
-                            Sleep(10);
-                        } else {
-                            std::cerr << "\n[Client] Message recv error: " << error << std::endl;
-                            client->should_exit = true;
-                            break;
-                        }
-                    }
-                } else if (msg_len == 0) {
-                    // empty message, just reset
-                    len_received = 0;
+            if (recv_len == 0) {
+                std::cout << "\n[Client] Server disconnected!" << std::endl;
+                client->should_exit.set();
+                break;
+            } else if (recv_len == SOCKET_ERROR) {
+                int error = WSAGetLastError();
+                if (error == WSAEWOULDBLOCK || error == WSAEINTR) {
+                    continue;
+                }
+                if (error == WSAECONNRESET) {
+                    std::cout << "\n[Client] Server disconnected!" << std::endl;
                 } else {
-                    // invalid message length
-                    std::cerr << "\n[Client] Invalid message length: " << msg_len << std::endl;
-                    len_received = 0;
+                    std::cerr << "\n[Client] Recv error: " << error << std::endl;
                 }
+                client->should_exit.set();
+                break;
+            }
+            
+            ReadStatus status = reader.advance((ui32)recv_len);
+            if (status == READ_MORE) {
+                continue;
+            }
+            if (status == READ_BAD_HEADER) {
+                const FrameHeader& header = reader.frame_header();
+                std::cerr << "\n[Client] Invalid frame header (version " << (int)header.version
+                          << ", length " << header.payload_len << ")" << std::endl;
+                client->should_exit.set();
+                break;
+            }
+            if (status == READ_OVER_BUDGET) {
+                std::cerr << "\n[Client] Server went over its memory budget, dropping the connection" << std::endl;
+                client->should_exit.set();
+                break;
+            }
+            
+            if (!client->handle_frame(reader.frame_header(), reader.frame_payload())) {
+                client->should_exit.set();
+                break;
             }
             
-            Sleep(10);
+            // the payload goes back to the pool until the next frame
+            reader.next();
         }
-        _endthread();
     }
 
     static void send_thread_func(void* arg) {
@@ -185,53 +267,35 @@ public:
         std::cout << "[You] ";
         std::cout.flush();
         
-        while (!client->should_exit) {
+        while (!client->should_exit.is_set()) {
             if (std::getline(std::cin, input_line)) {
                 if (input_line == "exit") {
-                    client->should_exit = true;
+                    client->should_exit.set();
                     std::cout << "[Client] Shutting down..." << std::endl;
                     break;
                 }
 
-                if (!input_line.empty()) {
-                    ui32 msg_len = (ui32)input_line.length();
-                    int bytes_sent = 0;
-                    
-                    while (bytes_sent < (int)sizeof(ui32)) {
-                        int send_result = send(client->socket_fd, (const char*)&msg_len + bytes_sent, sizeof(ui32) - bytes_sent, 0);
-                        
-                        if (send_result == SOCKET_ERROR) {
-                            int error = WSAGetLastError();
-                            std::cerr << "\n[Client] Send length failed! Error: " << error << std::endl;
-                            client->should_exit = true;
-                            break;
-                        } else if (send_result > 0) {
-                            bytes_sent += send_result;
-                        } else {
-                            Sleep(10);
-                        }
-                    }
-                    
-                    if (client->should_exit) break;
+                if (input_line.length() > BUFFER_SIZE) {
+                    std::cerr << "[Client] Message too long (max " << BUFFER_SIZE << " bytes)" << std::endl;
+                } else if (!input_line.empty()) {
+                    // seal into this thread's scratch arena, released at the end of
+                    // the block. the coalescer copies header + ciphertext into its
+                    // batch, or sends them in one call when it is off
+                    ScratchArena scratch;
+                    ui64 seq = client->send_seq++;
+                    MessageView view = COMPRESS_MESSAGES
+                        ? MessageView::seal_compressed(scratch.arena(), client->my_name,
+                                                       as_bytes(input_line), client->session, seq)
+                        : MessageView::seal(scratch.arena(), client->my_name,
+                                            as_bytes(input_line), client->session, seq);
+                    bool sent = client->coalescer.push(view);
                     
-                    bytes_sent = 0;
-                    while (bytes_sent < (int)input_line.length()) {
-                        int send_result = send(client->socket_fd, input_line.c_str() + bytes_sent, input_line.length() - bytes_sent, 0);
-                        
-                        if (send_result == SOCKET_ERROR) {
-                            int error = WSAGetLastError();
-                            std::cerr << "\n[Client] Send message failed! Error: " << error << std::endl;
-                            client->should_exit = true;
-                            break;
-                        } else if (send_result > 0) {
-                            bytes_sent += send_result;
-                        } else {
-                            Sleep(10);
-                        }
+                    if (!sent) {
+                        std::cerr << "\n[Client] Send failed! Error: " << WSAGetLastError() << std::endl;
+                        client->should_exit.set();
+                        break;
                     }
                     
-                    if (client->should_exit) break;
-                    
                     try {
                         client->logger.log_sent_message("Client", input_line,
                                                        client->peer_keypair, client->my_keypair);
@@ -256,17 +320,28 @@ public:
 
         MessageLogger::print_log_info();
 
+        coalescer.start(socket_fd);
+
         // start receive thread
-        _beginthread(recv_thread_func, 0, (void*)this);
+        std::thread receiver(recv_thread_func, (void*)this);
         
-        // start send thread
+        // start send thread; it stays detached, it may sit in getline for good
         _beginthread(send_thread_func, 0, (void*)this);
         
-        // wait for threads to finish
-        while (!should_exit) {
-            Sleep(100);
-        }
-        Sleep(500); //clean
+        // parked until a thread or the console asks to stop; set() also
+        // wakes the receiver, so the join returns right away
+        should_exit.wait();
+        receiver.join();
+        coalescer.stop();
+        print_coalesce_stats();
+    }
+
+    void print_coalesce_stats() {
+        if (!coalescer.enabled()) return;
+        CoalesceStats stats = coalescer.get_stats();
+        std::cout << "[Client] Coalescing: " << stats.frames << " frames in " << stats.writes
+                  << " writes (" << stats.size_flushes << " size / " << stats.deadline_flushes
+                  << " deadline flushes), ratio " << stats.ratio() << std::endl;
     }
 };
 
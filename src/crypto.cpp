@@ -1,3 +1,2 @@
 #include "../include/crypto.h"
-std::mt19937_64 SimpleCrypto::rng;
 bool SimpleCrypto::initialized = false;
\ No newline at end of file
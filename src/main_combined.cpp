@@ -3,21 +3,29 @@
 
 #include <iostream>
 #include <string>
+#include <cstdlib>
+#include <cstring>
 #ifdef _WIN32
 #include <windows.h>
+#else
+#include <csignal>
 #endif
 
 #include "../include/crypto.h"
 #include "../include/arena.h"
 #include "../include/message.h"
 #include "../include/logger.h"
+#include "../include/epoll_server.h"
+#include "../include/uring_server.h"
+#include "../include/sharded_server.h"
 
 int run_server(int argc, char* argv[]);
 int run_client(int argc, char* argv[]);
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        std::cout << "usage: main_combined --server | --client" << std::endl;
+        std::cout << "usage: main_combined --server [--port N] [--max-clients N] [--echo] [--quiet] [--uring] [--shards N] | --client"
+                  << std::endl;
         return 1;
     }
     std::string mode = argv[1];
@@ -31,9 +39,76 @@ int main(int argc, char* argv[]) {
     }
 }
 
+#ifdef __linux__
+// whichever server is running, for the signal handler
+static void* running_server = nullptr;
+static void (*stop_running)(void*) = nullptr;
+
+template <class Server>
+static void stop_server(void* server) {
+    ((Server*)server)->stop();
+}
+
+static void on_signal(int) {
+    if (running_server != nullptr) stop_running(running_server);
+}
+
+template <class Server>
+static int serve(const ServerConfig& config) {
+    try {
+        Server server(config);
+        if (!server.start()) {
+            return 1;
+        }
+        stop_running = stop_server<Server>;
+        running_server = &server;
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+        server.run();
+        running_server = nullptr;
+    } catch (const std::exception& e) {
+        std::cerr << "[Error] " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+#endif
+
+// many-client server on linux (epoll, or io_uring with --uring), one
+// reactor per shard with --shards; windows keeps the one-to-one server.exe
 int run_server(int argc, char* argv[]) {
-    std::cout << "server mode not yet implemented" << std::endl;
+#ifdef __linux__
+    ServerConfig config;
+    bool uring = false;
+    for (int i = 2; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--port") && has_value) {
+            config.port = (ui16)atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--max-clients") && has_value) {
+            config.max_connections = (ui32)strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--echo")) {
+            config.echo = true;
+        } else if (!strcmp(argv[i], "--quiet")) {
+            config.quiet = true;
+        } else if (!strcmp(argv[i], "--uring")) {
+            uring = true;
+        } else if (!strcmp(argv[i], "--shards") && has_value) {
+            config.shards = (ui32)strtoul(argv[++i], nullptr, 10);
+        } else {
+            std::cout << "unknown server option: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+    if (config.shards != 1) {
+        return uring ? serve<ShardedServer<UringServer>>(config) : serve<ShardedServer<EpollServer>>(config);
+    }
+    return uring ? serve<UringServer>(config) : serve<EpollServer>(config);
+#else
+    (void)argc;
+    (void)argv;
+    std::cout << "server mode needs linux (epoll); on windows run server.exe" << std::endl;
     return 0;
+#endif
 }
 
 int run_client(int argc, char* argv[]) {
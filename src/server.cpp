@@ -3,11 +3,16 @@
 #include <string>
 #include <sstream>
 #include <process.h>
+#include <thread>
 #include <cstdlib>
 #include "../include/crypto.h"
 #include "../include/arena.h"
 #include "../include/message.h"
+#include "../include/frame.h"
+#include "../include/coalesce.h"
+#include "../include/conn.h"
 #include "../include/logger.h"
+#include "../include/wakeup.h"
 
 #ifdef _MSC_VER
 #pragma comment(lib, "ws2_32.lib")
@@ -15,6 +20,15 @@
 
 #define PORT 9001
 #define BUFFER_SIZE 1024
+// frames are batched per write until 16 KB or 200 us; 0 us sends each one alone
+#define COALESCE_FLUSH_BYTES (16 * 1024)
+#define COALESCE_DEADLINE_US 200
+// buffer budget for the connection: reading pauses at soft, past hard the
+// peer is dropped
+#define CONN_BUDGET_SOFT_BYTES (64 * 1024)
+#define CONN_BUDGET_HARD_BYTES (256 * 1024)
+// lz4-compress compressible payloads before sealing (flagged per frame)
+#define COMPRESS_MESSAGES 1
 
 //server side messaging
 class SecureServer {
@@ -26,17 +40,30 @@ private:
     MessageLogger logger;
     KeyPair my_keypair;
     KeyPair peer_keypair;
+    Session session;
     std::string my_name;
-    bool should_exit;
+    ui64 send_seq;
+    ui64 recv_seq;
+    ConnBudget budget;
+    FrameCoalescer coalescer;
+    // wakes the receive thread out of its wait on shutdown
+    Waker waker;
+    ExitSignal should_exit;
 
 public:
     SecureServer() : server_socket(INVALID_SOCKET), client_socket(INVALID_SOCKET), 
-                    arena(10 * 1024 * 1024), crypto_engine(), logger("logs/messages.txt"), my_name("Server"), should_exit(false) {
+                    arena(CONN_ARENA_RESERVE), crypto_engine(), logger("logs/messages.txt"), my_name("Server"), send_seq(0), recv_seq(0),
+                    budget(ConnBudgetConfig(CONN_BUDGET_SOFT_BYTES, CONN_BUDGET_HARD_BYTES)),
+                    coalescer(CoalesceConfig(COALESCE_FLUSH_BYTES, COALESCE_DEADLINE_US)), waker(), should_exit(&waker) {
         WSADATA wsa_data;
         if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
             std::cerr << "[Server] WSAStartup failed!" << std::endl;
             throw std::runtime_error("WSAStartup failed");
         }
+        if (!waker.open()) {
+            WSACleanup();
+            throw std::runtime_error("Wakeup socket failed");
+        }
 
         // gen keys
         my_keypair.generate(arena);
@@ -108,94 +135,150 @@ public:
     }
 
     bool exchange_keypairs() {
-        // send my public key to client
-        if (send(client_socket, (const char*)my_keypair.public_key, 32, 0) == SOCKET_ERROR) {
+        // send my public key + the suites we accept
+        ui8 hello[HANDSHAKE_HELLO_BYTES];
+        memcpy(hello, my_keypair.public_key, 32);
+        hello[X25519_KEY_BYTES] = suite_offer_mask();
+        if (send(client_socket, (const char*)hello, HANDSHAKE_HELLO_BYTES, 0) == SOCKET_ERROR) {
             std::cerr << "[Server] Failed to send public key!" << std::endl;
             return false;
         }
 
         std::cout << "[Server] Sent public key to client" << std::endl;
 
-        // recv--client--public--key
-        ui8 received_key[32];
-        int recv_len = recv(client_socket, (char*)received_key, 32, 0);
-        if (recv_len != 32) {
+        // recv--client--public--key + chosen suite
+        int recv_len = recv(client_socket, (char*)hello, HANDSHAKE_HELLO_BYTES, 0);
+        if (recv_len != HANDSHAKE_HELLO_BYTES) {
             std::cerr << "[Server] Failed to receive public key!" << std::endl;
             return false;
         }
 
         peer_keypair.public_key = (ui8*)arena.push(32, 0);
-        memcpy(peer_keypair.public_key, received_key, 32);
+        memcpy(peer_keypair.public_key, hello, 32);
 
         std::cout << "[Server] Received client's public key" << std::endl;
+
+        ui8 chosen = hello[X25519_KEY_BYTES];
+        if (chosen >= 8 || !(suite_offer_mask() & (1u << chosen))) {
+            std::cerr << "[Server] Client picked a suite we did not offer!" << std::endl;
+            return false;
+        }
+        return derive_session((CipherSuite)chosen);
+    }
+
+    // x25519 shared key, same on both ends
+    bool derive_session(CipherSuite suite) {
+        try {
+            session.derive(peer_keypair.public_key, my_keypair.secret_key, my_keypair.public_key, suite);
+        } catch (const std::exception& e) {
+            std::cerr << "[Server] Key agreement failed: " << e.what() << std::endl;
+            return false;
+        }
+        std::cout << "[Server] Derived shared session key (" << session.get_ops().name << ")" << std::endl;
+        return true;
+    }
+
+    // authenticate + decrypt in the receive buffer, nothing is copied out.
+    // false drops the connection.
+    bool handle_frame(const FrameHeader& header, ui8* payload) {
+        if (header.seq != recv_seq || header.suite != session.get_suite()) {
+            std::cerr << "\n[Server] Unexpected frame (seq " << header.seq << ")" << std::endl;
+            return false;
+        }
+        MessageView view = Frame::view(header, payload);
+        if (!view.open_in_place(session)) {
+            std::cerr << "\n[Server] Message authentication failed!" << std::endl;
+            return false;
+        }
+        ++recv_seq;
+
+        // only compressed frames need a second buffer, sized to the message
+        ConnBuffer inflated;
+        ui64 inflated_len = view.inflated_len();
+        if (inflated_len > BUFFER_SIZE ||
+            (inflated_len != 0 && inflated.acquire(&budget, inflated_len) == BUDGET_SHED)) {
+            std::cerr << "\n[Server] Compressed message too large!" << std::endl;
+            return false;
+        }
+        ConstByteSpan text = view.payload(ByteSpan(inflated.data(), inflated.size()));
+        if (text.data == nullptr) {
+            std::cerr << "\n[Server] Malformed compressed message!" << std::endl;
+            return false;
+        }
+
+        std::cout << "\n[Client] " << std::string_view((const char*)text.data, text.len) << std::endl;
+        std::cout << "[You] ";
+        std::cout.flush();
+        view.wipe();
+        if (text.data == inflated.data()) {
+            memset(inflated.data(), 0, text.len);
+        }
         return true;
     }
 
     static void recv_thread_func(void* arg) {
         SecureServer* server = (SecureServer*)arg;
-        char buffer[BUFFER_SIZE];
-        char len_buffer[4];
-        int len_received = 0;
+        // holds the header bytes between frames; each payload is a slab block
+        // sized to the frame and charged to the connection's budget
+        FrameReader reader(&server->budget, BUFFER_SIZE);
         
-        while (!server->should_exit) {
-            // read message length (4 bytes)
-            if (len_received < 4) {
-                int recv_len = recv(server->client_socket, len_buffer + len_received, 4 - len_received, 0);
-                
-                if (recv_len == 0) {
-                    std::cout << "\n[Server] Client disconnected!" << std::endl;
-                    server->should_exit = true;
-                    break;
-                } else if (recv_len == SOCKET_ERROR) {
-                    int error = WSAGetLastError();
-                    if (error != WSAEWOULDBLOCK && error != WSAEINTR && error != WSAECONNRESET) {
-                        std::cerr << "\n[Server] Recv error: " << error << std::endl;
-                        server->should_exit = true;
-                        break;
-                    }
-                    Sleep(10);
-                    continue;
-                } else if (recv_len > 0) {
-                    len_received += recv_len;
-                }
+        while (!server->should_exit.is_set()) {
+            // parked until the peer sends something or shutdown wakes us
+            WaitResult ready = wait_readable(server->client_socket, server->waker);
+            if (ready == WAIT_WOKEN) {
+                break;
+            }
+            if (ready == WAIT_ERROR) {
+                std::cerr << "\n[Server] Wait failed: " << WSAGetLastError() << std::endl;
+                server->should_exit.set();
+                break;
             }
+
+            int recv_len = recv(server->client_socket, (char*)reader.target(), (int)reader.missing(), 0);
             
-            if (len_received == 4) {
-                ui32 msg_len = *(ui32*)len_buffer;
-                
-                if (msg_len > 0 && msg_len < BUFFER_SIZE) {
-                    // read the message content
-                    int recv_len = recv(server->client_socket, buffer, msg_len, 0);
-                    
-                    if (recv_len > 0) {
-                        buffer[recv_len] = '\0';
-                        std::cout << "\n[Client] " << buffer << std::endl;
-                        std::cout << "[You] ";
-                        std::cout.flush();
-                        
-                        len_received = 0;
-                    } else if (recv_len == SOCKET_ERROR) {
-                        int error = WSAGetLastError();
-                        if (error == WSAEWOULDBLOCK || error == WSAEINTR) {
-                            // Just wait for more data
-                            Sleep(10);
-                        } else {
-                            std::cerr << "\n[Server] Message recv error: " << error << std::endl;
-                            server->should_exit = true;
-                            break;
-                        }
-                    }
-                } else if (msg_len == 0) {
-                    len_received = 0;
+            if (recv_len == 0) {
+                std::cout << "\n[Server] Client disconnected!" << std::endl;
+                server->should_exit.set();
+                break;
+            } else if (recv_len == SOCKET_ERROR) {
+                int error = WSAGetLastError();
+                if (error == WSAEWOULDBLOCK || error == WSAEINTR) {
+                    continue;
+                }
+                if (error == WSAECONNRESET) {
+                    std::cout << "\n[Server] Client disconnected!" << std::endl;
                 } else {
-                    std::cerr << "\n[Server] Invalid message length: " << msg_len << std::endl;
-                    len_received = 0;
+                    std::cerr << "\n[Server] Recv error: " << error << std::endl;
                 }
+                server->should_exit.set();
+                break;
+            }
+            
+            ReadStatus status = reader.advance((ui32)recv_len);
+            if (status == READ_MORE) {
+                continue;
+            }
+            if (status == READ_BAD_HEADER) {
+                const FrameHeader& header = reader.frame_header();
+                std::cerr << "\n[Server] Invalid frame header (version " << (int)header.version
+                          << ", length " << header.payload_len << ")" << std::endl;
+                server->should_exit.set();
+                break;
+            }
+            if (status == READ_OVER_BUDGET) {
+                std::cerr << "\n[Server] Client went over its memory budget, dropping the connection" << std::endl;
+                server->should_exit.set();
+                break;
+            }
+            
+            if (!server->handle_frame(reader.frame_header(), reader.frame_payload())) {
+                server->should_exit.set();
+                break;
             }
             
-            Sleep(10);
+            // the payload goes back to the pool until the next frame
+            reader.next();
         }
-        _endthread();
     }
 
     static void send_thread_func(void* arg) {
@@ -205,55 +288,35 @@ public:
         std::cout << "[You] ";
         std::cout.flush();
         
-        while (!server->should_exit) {
+        while (!server->should_exit.is_set()) {
             if (std::getline(std::cin, input_line)) {
                 if (input_line == "exit") {
-                    server->should_exit = true;
+                    server->should_exit.set();
                     std::cout << "[Server] Shutting down..." << std::endl;
                     break;
                 }
 
-                if (!input_line.empty()) {
-                    ui32 msg_len = (ui32)input_line.length();
-                    int bytes_sent = 0;
+                if (input_line.length() > BUFFER_SIZE) {
+                    std::cerr << "[Server] Message too long (max " << BUFFER_SIZE << " bytes)" << std::endl;
+                } else if (!input_line.empty()) {
+                    // seal into this thread's scratch arena, released at the end of
+                    // the block. the coalescer copies header + ciphertext into its
+                    // batch, or sends them in one call when it is off
+                    ScratchArena scratch;
+                    ui64 seq = server->send_seq++;
+                    MessageView view = COMPRESS_MESSAGES
+                        ? MessageView::seal_compressed(scratch.arena(), server->my_name,
+                                                       as_bytes(input_line), server->session, seq)
+                        : MessageView::seal(scratch.arena(), server->my_name,
+                                            as_bytes(input_line), server->session, seq);
+                    bool sent = server->coalescer.push(view);
                     
-                    // keep sending until all length bytes are sent
-                    while (bytes_sent < (int)sizeof(ui32)) {
-                        int send_result = send(server->client_socket, (const char*)&msg_len + bytes_sent, sizeof(ui32) - bytes_sent, 0);
-                        
-                        if (send_result == SOCKET_ERROR) {
-                            int error = WSAGetLastError();
-                            std::cerr << "\n[Server] Send length failed! Error: " << error << std::endl;
-                            server->should_exit = true;
-                            break;
-                        } else if (send_result > 0) {
-                            bytes_sent += send_result;
-                        } else {
-                            Sleep(10);
-                        }
-                    }
-                    
-                    if (server->should_exit) break;
-                    
-                    // send message content
-                    bytes_sent = 0;
-                    while (bytes_sent < (int)input_line.length()) {
-                        int send_result = send(server->client_socket, input_line.c_str() + bytes_sent, input_line.length() - bytes_sent, 0);
-                        
-                        if (send_result == SOCKET_ERROR) {
-                            int error = WSAGetLastError();
-                            std::cerr << "\n[Server] Send message failed! Error: " << error << std::endl;
-                            server->should_exit = true;
-                            break;
-                        } else if (send_result > 0) {
-                            bytes_sent += send_result;
-                        } else {
-                            Sleep(10);
-                        }
+                    if (!sent) {
+                        std::cerr << "\n[Server] Send failed! Error: " << WSAGetLastError() << std::endl;
+                        server->should_exit.set();
+                        break;
                     }
                     
-                    if (server->should_exit) break;
-                    
                     try {
                         server->logger.log_sent_message("Server", input_line,
                                                        server->peer_keypair, server->my_keypair);
@@ -274,12 +337,24 @@ public:
 
     void run() {
         std::cout << "\n[Server] Ready to send/receive messages. Type 'exit' to quit.\n" << std::endl;
-        _beginthread(recv_thread_func, 0, (void*)this);
+        coalescer.start(client_socket);
+        std::thread receiver(recv_thread_func, (void*)this);
+        // the console thread stays detached, it may sit in getline for good
         _beginthread(send_thread_func, 0, (void*)this);
-        while (!should_exit) {
-            Sleep(100);
-        }
-        Sleep(500);
+        // parked until a thread or the console asks to stop; set() also
+        // wakes the receiver, so the join returns right away
+        should_exit.wait();
+        receiver.join();
+        coalescer.stop();
+        print_coalesce_stats();
+    }
+
+    void print_coalesce_stats() {
+        if (!coalescer.enabled()) return;
+        CoalesceStats stats = coalescer.get_stats();
+        std::cout << "[Server] Coalescing: " << stats.frames << " frames in " << stats.writes
+                  << " writes (" << stats.size_flushes << " size / " << stats.deadline_flushes
+                  << " deadline flushes), ratio " << stats.ratio() << std::endl;
     }
 };
 